@@ -0,0 +1,690 @@
+///\author Sean Malloy
+///\name	 bench.cpp
+///\brief  Timing harness for matrix.hpp kernels.
+/**********************************************************************/
+// System includes
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <string>
+#include <functional>
+
+/**********************************************************************/
+// Local includes
+#include "matrix.hpp"
+
+/**********************************************************************/
+// Helper function declarations
+
+mat::matrix
+randomMatrix(size_t rows, size_t cols, unsigned long seed);
+
+double
+seconds(const std::function<void()>& f);
+
+void
+report(const std::string& name, size_t n, double work, double secs,
+       const std::string& unit = "GFLOP/s");
+
+mat::matrix
+naiveMultiply(const mat::matrix& A, const mat::matrix& B);
+
+elem_t
+maxDifference(const mat::matrix& A, const mat::matrix& B);
+
+void
+benchMultiply(size_t n);
+
+void
+benchStrassen(size_t n);
+
+void
+benchVector(size_t n);
+
+void
+benchElementwise(size_t n);
+
+void
+benchPower(size_t n, unsigned long k);
+
+elem_t
+cofactorDeterminant(const mat::matrix& A);
+
+void
+benchDeterminant(size_t n);
+
+void
+benchInverse(size_t n);
+
+void
+benchCholesky(size_t n);
+
+void
+benchSolve(size_t n);
+
+void
+benchQr(size_t n);
+
+void
+benchEigen(size_t n);
+
+void
+benchSvd(size_t n);
+
+void
+benchModular(size_t n);
+
+void
+benchStructured(size_t n);
+
+void
+benchRowOperations(size_t n);
+
+template <size_t N>
+void
+benchFixed(size_t count);
+
+void
+benchTranspose(size_t n);
+
+void
+benchBatch(size_t n, size_t count);
+
+void
+benchSparse(size_t n, double density);
+
+/**********************************************************************/
+
+int
+main(int argc, char* argv[])
+{
+  size_t maxSize = argc > 1 ? std::stoul(argv[1]) : 1024;
+
+  std::cout << std::left;
+  for (size_t n = 128; n <= maxSize; n *= 2)
+    benchMultiply(n);
+  for (size_t n = 1024; n <= 2 * maxSize; n *= 2)
+    benchStrassen(n);
+  for (size_t n = 1024; n <= 4 * maxSize; n *= 2)
+    benchVector(n);
+  for (size_t n = 128; n <= 4 * maxSize; n *= 2)
+    benchElementwise(n);
+  benchPower(256, 100);
+  benchDeterminant(8);
+  for (size_t n = 128; n <= maxSize; n *= 2)
+    benchDeterminant(n);
+  for (size_t n = 128; n <= maxSize; n *= 2)
+    benchInverse(n);
+  for (size_t n = 128; n <= maxSize; n *= 2)
+    benchCholesky(n);
+  for (size_t n = 128; n <= maxSize; n *= 2)
+    benchSolve(n);
+  for (size_t n = 128; n <= maxSize; n *= 2)
+    benchQr(n);
+  for (size_t n = 128; n <= maxSize; n *= 2)
+    benchEigen(n);
+  for (size_t n = 128; n <= maxSize; n *= 2)
+    benchSvd(n);
+  for (size_t n = 128; n <= maxSize; n *= 2)
+    benchModular(n);
+  for (size_t n = 128; n <= maxSize; n *= 2)
+    benchStructured(n);
+  std::cout << "SIMD kernels: " << mat::simdLevel() << '\n';
+  for (size_t n = 128; n <= 4 * maxSize; n *= 2)
+    benchRowOperations(n);
+  benchFixed<2>(1000000);
+  benchFixed<3>(1000000);
+  benchFixed<4>(1000000);
+  for (size_t n = 1024; n <= 4 * maxSize; n *= 2)
+    benchTranspose(n);
+  for (size_t n : { 4, 8, 16 })
+    benchBatch(n, 100000);
+  for (size_t n = 1024; n <= 4 * maxSize; n *= 2)
+    benchSparse(n, 0.01);
+
+  return 0;
+}
+
+mat::matrix
+randomMatrix(size_t rows, size_t cols, unsigned long seed)
+{
+  std::mt19937 gen(seed);
+  std::uniform_real_distribution<elem_t> dist(-1, 1);
+
+  mat::matrix A(rows, cols);
+  for (elem_t& elem : A)
+    elem = dist(gen);
+
+  return A;
+}
+
+double
+seconds(const std::function<void()>& f)
+{
+  auto start = std::chrono::steady_clock::now();
+  f();
+  auto stop = std::chrono::steady_clock::now();
+  return std::chrono::duration<double>(stop - start).count();
+}
+
+void
+report(const std::string& name, size_t n, double work, double secs, const std::string& unit)
+{
+  std::cout << std::setw(24) << name << std::setw(8) << n
+            << std::setw(12) << secs << work / secs * 1e-9 << ' ' << unit << '\n';
+}
+
+// Reference i-j-k loop used by operator*= before blocking
+mat::matrix
+naiveMultiply(const mat::matrix& A, const mat::matrix& B)
+{
+  mat::matrix result(A.rows(), B.cols(), elem_t(0));
+  for (size_t i = 0; i < result.rows(); ++i)
+    for (size_t j = 0; j < result.cols(); ++j)
+      for (size_t k = 0; k < A.cols(); ++k)
+        result(i, j) += A(i, k) * B(k, j);
+
+  return result;
+}
+
+elem_t
+maxDifference(const mat::matrix& A, const mat::matrix& B)
+{
+  elem_t diff = 0;
+  auto b = B.begin();
+  for (const elem_t& a : A)
+    diff = std::max(diff, std::fabs(a - *(b++)));
+  return diff;
+}
+
+void
+benchMultiply(size_t n)
+{
+  mat::matrix A = randomMatrix(n, n, 1);
+  mat::matrix B = randomMatrix(n, n, 2);
+  mat::matrix C, D;
+  double flops = 2.0 * n * n * n;
+
+  report("multiply (naive)", n, flops, seconds([&] { C = naiveMultiply(A, B); }));
+  size_t threads = mat::getNumThreads();
+  mat::setNumThreads(1);
+  report("multiply (blocked)", n, flops, seconds([&] { D = A * B; }));
+  mat::setNumThreads(threads);
+  if (threads > 1)
+    report("multiply (" + std::to_string(threads) + " threads)", n, flops,
+           seconds([&] { D = A * B; }));
+  if (maxDifference(C, D) > 1e-9 * n)
+    std::cerr << "Blocked result differs from naive result\n";
+}
+
+void
+benchStrassen(size_t n)
+{
+  mat::matrix A = randomMatrix(n, n, 1);
+  mat::matrix B = randomMatrix(n, n, 2);
+  mat::matrix C, D;
+  // Conventional flops, so the rates show the effective speedup
+  double flops = 2.0 * n * n * n;
+
+  report("multiply", n, flops, seconds([&] { C = A * B; }));
+  mat::setStrassenCrossover();
+  report("multiply (strassen)", n, flops, seconds([&] { D = A * B; }));
+  mat::setStrassenCrossover(0);
+  if (maxDifference(C, D) > 1e-9 * n)
+    std::cerr << "Strassen result differs from conventional result\n";
+}
+
+void
+benchVector(size_t n)
+{
+  mat::matrix A = randomMatrix(n, n, 1);
+  mat::matrix column = randomMatrix(n, 1, 2);
+  mat::vector x(column), y(n), z(n);
+  mat::matrix C(n, 1, elem_t(0));
+  // Level-2 kernels are bound by reading A once, so report bandwidth
+  double bytes = double(n) * n * sizeof(elem_t);
+
+  report("gemv (gemm kernel)", n, bytes, seconds([&] {
+    mat::detail::gemm(n, size_t(1), n, A.begin(), n, column.begin(), size_t(1), C.begin(), size_t(1));
+  }), "GB/s");
+  report("gemv", n, bytes, seconds([&] { mat::gemv(A, x, y); }), "GB/s");
+  report("gemv (transposed)", n, bytes, seconds([&] { mat::gemvTransposed(A, x, z); }), "GB/s");
+  report("ger", n, 2 * bytes, seconds([&] { mat::ger(A, x, y, elem_t(1e-9)); }), "GB/s");
+  elem_t d = 0;
+  report("dot", n, 2.0 * n * sizeof(elem_t), seconds([&] { d = mat::dot(x, y); }), "GB/s");
+  report("axpy", n, 3.0 * n * sizeof(elem_t), seconds([&] { mat::axpy(elem_t(1e-9), x, y); }), "GB/s");
+  (void)d;
+}
+
+void
+benchElementwise(size_t n)
+{
+  mat::matrix A = randomMatrix(n, n, 1);
+  mat::matrix B = randomMatrix(n, n, 2);
+  mat::matrix C = randomMatrix(n, n, 3);
+  mat::matrix D(n, n), E(n, n);
+  double flops = 3.0 * n * n;
+
+  // One temporary per operator, as the free operators used to do
+  report("A + B - C * 2 (temps)", n, flops, seconds([&] {
+    mat::matrix scaled(C);
+    scaled *= 2;
+    mat::matrix sum(A);
+    sum += B;
+    sum -= scaled;
+    D = sum;
+  }));
+  report("A + B - C * 2 (fused)", n, flops, seconds([&] { E = A + B - C * 2; }));
+  if (maxDifference(D, E) > 0)
+    std::cerr << "Fused result differs from temporaries\n";
+}
+
+void
+benchPower(size_t n, unsigned long k)
+{
+  mat::matrix A = randomMatrix(n, n, 1) * (1.0 / n);
+  mat::matrix B, C;
+
+  // k - 1 multiplies, as operator^= used to do
+  report("A ^ " + std::to_string(k) + " (repeated)", n, 2.0 * n * n * n * (k - 1),
+         seconds([&] {
+           B = A;
+           for (unsigned long i = 1; i < k; ++i)
+             B *= A;
+         }));
+  report("A ^ " + std::to_string(k) + " (squaring)", n, 2.0 * n * n * n * (k - 1),
+         seconds([&] { C = A ^ k; }));
+  if (maxDifference(B, C) > 1e-9)
+    std::cerr << "Squaring result differs from repeated multiplication\n";
+}
+
+// Cofactor expansion along the first row, as determinant used to do
+elem_t
+cofactorDeterminant(const mat::matrix& A)
+{
+  if (A.rows() == 1)
+    return A(0, 0);
+
+  elem_t det = 0, sign = 1;
+  for (size_t j = 0; j < A.cols(); ++j)
+  {
+    det += sign * A(0, j) * cofactorDeterminant(mat::minorMatrix(A, 0, j));
+    sign *= -1;
+  }
+
+  return det;
+}
+
+void
+benchDeterminant(size_t n)
+{
+  mat::matrix A = randomMatrix(n, n, 1);
+  elem_t lu = 0, cofactor = 0;
+  double flops = 2.0 / 3.0 * n * n * n;
+
+  if (n <= 9)
+  {
+    report("determinant (cofactor)", n, flops, seconds([&] { cofactor = cofactorDeterminant(A); }));
+    report("determinant (LU)", n, flops, seconds([&] { lu = mat::determinant(A); }));
+    if (std::fabs(lu - cofactor) > 1e-9)
+      std::cerr << "LU determinant differs from cofactor expansion\n";
+
+    // Exactly singular integer input must give 0, and badly scaled but
+    // regular input must not be taken for singular
+    mat::matrix S(3, 3);
+    for (size_t i = 0; i < 9; ++i)
+      S[i] = elem_t(i + 1);
+    mat::matrix D(2, 2, 0);
+    D(0, 0) = 1e-10;
+    D(0, 1) = 1;
+    D(1, 1) = 1e10;
+    if (mat::determinant(S) != 0 || !mat::lu_factorization(S).singular())
+      std::cerr << "LU missed a singular matrix\n";
+    if (std::fabs(mat::determinant(D) - 1) > 1e-12 || mat::lu_factorization(D).singular())
+      std::cerr << "LU took a badly scaled matrix for singular\n";
+  }
+  else
+    report("determinant (LU)", n, flops, seconds([&] { lu = mat::determinant(A); }));
+}
+
+void
+benchInverse(size_t n)
+{
+  mat::matrix A = randomMatrix(n, n, 1);
+  mat::matrix B, C;
+  double flops = 2.0 * n * n * n;
+
+  report("inverse", n, flops, seconds([&] { B = mat::inverse(A); }));
+  report("adjugate", n, flops, seconds([&] { C = mat::adjugate(A); }));
+  if (maxDifference(A * B, mat::identity(n)) > 1e-8)
+    std::cerr << "A * inverse(A) is not the identity\n";
+}
+
+void
+benchCholesky(size_t n)
+{
+  mat::matrix M = randomMatrix(n, n, 1);
+  mat::matrix A = M * mat::transpose(M) + mat::identity(n) * n;
+  mat::matrix B = randomMatrix(n, 1, 2);
+  mat::cholesky_factorization factor;
+  mat::matrix X;
+
+  report("cholesky", n, n * n * n / 3.0, seconds([&] { factor = mat::cholesky_factorization(A); }));
+  report("cholesky solve", n, 2.0 * n * n, seconds([&] { X = factor.solve(B); }));
+  if (maxDifference(A * X, B) > 1e-9)
+    std::cerr << "Cholesky solve residual too large\n";
+}
+
+void
+benchSolve(size_t n)
+{
+  mat::matrix A = randomMatrix(n, n, 1);
+  mat::matrix B = randomMatrix(n, 1, 2);
+  mat::matrix X, Y, Z;
+
+  // Flops of the LU factorization, so the rates compare directly
+  double flops = 2.0 * n * n * n / 3;
+  report("solve (inverse)", n, flops, seconds([&] { X = mat::inverse(A) * B; }));
+  mat::setSolveCacheBudget(2 * n * n * sizeof(elem_t));
+  report("solve", n, flops, seconds([&] { Y = mat::solve(A, B); }));
+  report("solve (cached)", n, flops, seconds([&] { Z = mat::solve(A, B); }));
+  mat::setSolveCacheBudget(0);
+  if (maxDifference(A * Y, B) > 1e-9 || maxDifference(Y, Z) != 0)
+    std::cerr << "Solve residual too large\n";
+
+  // Diagonally weighted so float refinement converges
+  A += mat::identity(n) * std::sqrt(elem_t(n));
+  mat::refinement_result<> refined;
+  report("solve (double LU)", n, flops, seconds([&] { Y = mat::lu_factorization(A).solve(B); }));
+  report("solve (mixed)", n, flops, seconds([&] { refined = mat::solveMixed(A, B); }));
+  if (refined.fellBack || maxDifference(refined.x, Y) > 1e-9)
+    std::cerr << "Mixed-precision solve fell back or disagrees\n";
+}
+
+void
+benchQr(size_t n)
+{
+  // Tall 2n x n, as in regression
+  size_t m = 2 * n;
+  mat::matrix A = randomMatrix(m, n, 1);
+  mat::matrix B = randomMatrix(m, 1, 2);
+  mat::matrix X, Y;
+  mat::qr_factorization<> qr;
+
+  double flops = 2.0 * m * n * n - 2.0 * n * n * n / 3;
+  report("qr", n, flops, seconds([&] { qr = mat::qr_factorization(A); }));
+  report("least squares", n, flops, seconds([&] { X = mat::leastSquares(A, B); }));
+  report("least squares (normal)", n, flops, seconds([&] {
+    Y = mat::solve(mat::matrix(mat::transpose(A) * A), mat::matrix(mat::transpose(A) * B));
+  }));
+  if (maxDifference(X, Y) > 1e-9)
+    std::cerr << "Least-squares solutions disagree\n";
+}
+
+void
+benchEigen(size_t n)
+{
+  mat::matrix M = randomMatrix(n, n, 1);
+  mat::matrix A = M + mat::transpose(M);
+  std::vector<elem_t> values;
+  mat::eigen_decomposition<> full, top;
+
+  // Flops of the tridiagonal reduction, which all three share
+  double flops = 4.0 * n * n * n / 3;
+  report("eigenvalues", n, flops, seconds([&] { values = mat::symmetricEigenvalues(A); }));
+  report("eigen (full)", n, flops, seconds([&] { full = mat::symmetricEigen(A); }));
+  report("eigen (top 10)", n, flops, seconds([&] { top = mat::symmetricEigen(A, 10); }));
+
+  elem_t worst = 0;
+  for (size_t i = 0; i < n; ++i)
+    worst = std::max(worst, std::abs(values[i] - full.values[i]));
+  for (size_t i = 0; i < top.values.size(); ++i)
+    worst = std::max(worst, std::abs(top.values[i] - values[n - 1 - i]));
+  mat::matrix L = mat::zero(n, n);
+  for (size_t i = 0; i < n; ++i)
+    L(i, i) = full.values[i];
+  if (worst > 1e-9 || maxDifference(A * full.vectors, full.vectors * L) > 1e-9)
+    std::cerr << "Eigenvalues disagree or eigenvectors are off\n";
+}
+
+void
+benchSvd(size_t n)
+{
+  mat::matrix A = randomMatrix(n, n, 1);
+  std::vector<elem_t> values;
+  mat::svd_decomposition<> full, low;
+
+  // Flops of the bidiagonal reduction
+  double flops = 8.0 * n * n * n / 3;
+  report("singular values", n, flops, seconds([&] { values = mat::singularValues(A); }));
+  report("svd (full)", n, flops, seconds([&] { full = mat::svd(A); }));
+
+  // Rank 10 plus noise, where the randomized SVD is meant to be used
+  mat::matrix L = randomMatrix(n, 10, 2);
+  mat::matrix R = randomMatrix(10, n, 3);
+  mat::matrix C = L * R + A * elem_t(1e-6);
+  report("svd (randomized k=10)", n, flops, seconds([&] { low = mat::randomizedSvd(C, 10); }));
+
+  elem_t worst = 0;
+  for (size_t i = 0; i < n; ++i)
+    worst = std::max(worst, std::abs(values[i] - full.values[i]));
+  std::vector<elem_t> exact = mat::singularValues(C);
+  for (size_t i = 0; i < 10; ++i)
+    worst = std::max(worst, std::abs(low.values[i] - exact[i]) / exact[0]);
+  if (worst > 1e-9)
+    std::cerr << "Singular values disagree\n";
+}
+
+void
+benchModular(size_t n)
+{
+  mat::matrix X = randomMatrix(n, n, 1) * elem_t(1 << 30);
+  mat::matrix Y = randomMatrix(n, n, 2) * elem_t(1 << 30);
+  double flops = 2.0 * n * n * n;
+
+  // A prime whose products fit the double GEMM directly, and one that
+  // needs split operands
+  for (std::uint32_t p : { 65521u, 2147483647u })
+  {
+    std::string name = p == 65521u ? "65521" : "2^31-1";
+    mat::modular_matrix A(X, p), B(Y, p), C, inverse;
+    std::uint32_t det = 0;
+    report("multiply (mod " + name + ")", n, flops, seconds([&] { C = A * B; }));
+    report("det (mod " + name + ")", n, flops / 3, seconds([&] { det = mat::determinant(A); }));
+    report("inverse (mod " + name + ")", n, flops, seconds([&] { inverse = mat::inverse(A); }));
+
+    mat::modular_matrix I = A * inverse;
+    bool identity = true;
+    for (size_t i = 0; i < n; ++i)
+      for (size_t j = 0; j < n; ++j)
+        identity = identity && I(i, j) == (i == j);
+    if (det != 0 && !identity)
+      std::cerr << "Modular inverse is wrong\n";
+  }
+}
+
+void
+benchStructured(size_t n)
+{
+  mat::matrix M = randomMatrix(n, n, 1);
+  mat::matrix A = M * mat::transpose(M) + mat::identity(n) * n;
+  mat::symmetric_matrix<> S(A);
+  mat::triangular_matrix<> L;
+
+  report("cholesky (packed)", n, n * n * n / 3.0, seconds([&] { L = mat::cholesky(S); }));
+  if (maxDifference(L.dense(), mat::cholesky(A)) > 1e-9)
+    std::cerr << "Packed Cholesky disagrees\n";
+
+  // Eight diagonals either side; flops are those of the banded LU
+  const size_t band = 8;
+  mat::banded_matrix<> D(A, band, band);
+  mat::matrix B = randomMatrix(n, 1, 2);
+  mat::matrix X, Y;
+  double flops = 2.0 * n * band * (2 * band + 1);
+  report("banded solve", n, flops, seconds([&] { X = mat::solve(D, B); }));
+  report("banded solve (dense LU)", n, flops, seconds([&] {
+    Y = mat::lu_factorization(D.dense()).solve(B);
+  }));
+  if (maxDifference(X, Y) > 1e-9)
+    std::cerr << "Banded solves disagree\n";
+}
+
+void
+benchRowOperations(size_t n)
+{
+  mat::matrix A = randomMatrix(n, n, 1);
+  mat::matrix B = randomMatrix(n, n, 2);
+  mat::matrix C(A), D(A);
+  double flops = 2.0 * n * n;
+
+  // Branchy element loops, as addRows and operator+= used to be
+  report("add_rows + += (scalar)", n, flops, seconds([&] {
+    for (size_t i = 1; i < n; ++i)
+      for (size_t j = 0; j < n; ++j)
+      {
+        if (mat::almostEqual(C(i, j), -0.5 * C(i - 1, j)))
+          C(i, j) = 0;
+        else
+          C(i, j) += 0.5 * C(i - 1, j);
+      }
+    for (size_t i = 0; i < n; ++i)
+      for (size_t j = 0; j < n; ++j)
+        C(i, j) += B(i, j);
+  }));
+  report("add_rows + += (" + std::string(mat::simdLevel()) + ")", n, flops, seconds([&] {
+    for (size_t i = 1; i < n; ++i)
+      D.addRows(i - 1, i, 0.5);
+    D += B;
+  }));
+  if (maxDifference(C, D) != 0)
+    std::cerr << "SIMD row operations differ from scalar loops\n";
+}
+
+// Many small transforms and inverses, as in a geometry pipeline. The
+// fixed-size version never allocates.
+template <size_t N>
+void
+benchFixed(size_t count)
+{
+  mat::matrix A = randomMatrix(N, N, 1) + mat::identity(N) * N;
+  mat::fixed_matrix<N, N> F;
+  for (size_t i = 0; i < N * N; ++i)
+    F[i] = A[i];
+
+  mat::matrix B(A), D(N, N, 0);
+  mat::fixed_matrix<N, N> G;
+  double flops = count * 5.0 * N * N * N;
+
+  report("transform (matrix)", N, flops, seconds([&] {
+    for (size_t i = 0; i < count; ++i)
+    {
+      B(0, 0) = A(0, 0) + i * 1e-9;
+      D += mat::inverse(B * B) * B;
+    }
+  }));
+  report("transform (fixed)", N, flops, seconds([&] {
+    for (size_t i = 0; i < count; ++i)
+    {
+      F(0, 0) = A(0, 0) + i * 1e-9;
+      G += mat::inverse(F * F) * F;
+    }
+  }));
+
+  mat::matrix E(N, N);
+  for (size_t i = 0; i < N * N; ++i)
+    E[i] = G[i];
+  if (maxDifference(D, E) > 1e-6 * count)
+    std::cerr << "fixed_matrix results differ from matrix\n";
+}
+
+void
+benchTranspose(size_t n)
+{
+  mat::matrix A = randomMatrix(n, n, 1);
+  mat::matrix B(n, n), C(n, n);
+  double bytes = 2.0 * n * n * sizeof(elem_t);
+
+  // Column-strided writes, as transpose used to be
+  report("transpose (naive)", n, bytes, seconds([&] {
+    for (size_t i = 0; i < n; ++i)
+      for (size_t j = 0; j < n; ++j)
+        B(j, i) = A(i, j);
+  }), "GB/s");
+  report("transpose (blocked)", n, bytes, seconds([&] { C = mat::transpose(A); }), "GB/s");
+  report("transpose (in place)", n, bytes, seconds([&] { A.transposeInPlace(); }), "GB/s");
+  if (maxDifference(A, B) != 0 || maxDifference(C, B) != 0)
+    std::cerr << "Transposes disagree\n";
+}
+
+void
+benchSparse(size_t n, double density)
+{
+  std::mt19937 gen(n);
+  std::uniform_real_distribution<elem_t> dist(-1, 1);
+  std::bernoulli_distribution keep(density);
+
+  mat::matrix A(n, n, elem_t(0));
+  for (elem_t& elem : A)
+    if (keep(gen))
+      elem = dist(gen);
+  mat::sparse_matrix<> S(A);
+  mat::matrix x = randomMatrix(n, 1, 2);
+
+  // Flops count only the stored entries for both, so the dense rows show
+  // how much time goes into multiplying zeros
+  mat::matrix y, z;
+  double spmv = 2.0 * S.nonZeros();
+  report("matrix-vector (dense)", n, spmv, seconds([&] { y = A * x; }));
+  report("matrix-vector (sparse)", n, spmv, seconds([&] { z = S * x; }));
+  if (maxDifference(y, z) > 1e-9)
+    std::cerr << "Sparse matrix-vector product disagrees\n";
+
+  mat::sparse_matrix<> P;
+  double spgemm = 0;
+  for (size_t k : S.columns())
+    spgemm += 2.0 * (S.rowStart()[k + 1] - S.rowStart()[k]);
+  if (n <= 2048)
+    report("product (dense)", n, spgemm, seconds([&] { y = A * A; }));
+  report("product (sparse)", n, spgemm, seconds([&] { P = S * S; }));
+  if (n <= 2048 && maxDifference(y, P.dense()) > 1e-9)
+    std::cerr << "Sparse product disagrees\n";
+}
+
+void
+benchBatch(size_t n, size_t count)
+{
+  std::vector<mat::matrix> A, B, C(count);
+  mat::matrix_batch<> batchA(count, n, n), batchB(count, n, n), batchC;
+  for (size_t b = 0; b < count; ++b)
+  {
+    A.push_back(randomMatrix(n, n, b) + mat::identity(n) * n);
+    B.push_back(randomMatrix(n, n, b + count));
+    batchA.set(b, A[b]);
+    batchB.set(b, B[b]);
+  }
+
+  double flops = 2.0 * n * n * n * count;
+  report("batch multiply (loop)", n, flops, seconds([&] {
+    for (size_t b = 0; b < count; ++b)
+      C[b] = A[b] * B[b];
+  }));
+  report("batch multiply", n, flops, seconds([&] { batchC = batchA * batchB; }));
+  if (maxDifference(batchC.get(count - 1), C[count - 1]) > 1e-9)
+    std::cerr << "Batched multiply disagrees\n";
+
+  std::vector<elem_t> det(count);
+  report("batch det (loop)", n, flops / 3, seconds([&] {
+    for (size_t b = 0; b < count; ++b)
+      det[b] = mat::determinant(A[b]);
+  }));
+  report("batch det", n, flops / 3, seconds([&] { det = mat::determinant(batchA); }));
+
+  report("batch inverse (loop)", n, flops, seconds([&] {
+    for (size_t b = 0; b < count; ++b)
+      C[b] = mat::inverse(A[b]);
+  }));
+  report("batch inverse", n, flops, seconds([&] { batchC = mat::inverse(batchA); }));
+  if (maxDifference(batchC.get(0), C[0]) > 1e-9)
+    std::cerr << "Batched inverse disagrees\n";
+}
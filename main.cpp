@@ -14,6 +14,7 @@
 #include <random>
 #include <stack>
 #include <cctype>
+#include <optional>
 
 /**********************************************************************/
 // Local includes
@@ -24,10 +25,15 @@
 using tokenlist_t = std::vector<std::string>;
 using tokenstack_t = std::stack<std::string>;
 using matmap_t = std::unordered_map<std::string, mat::matrix>;
+using sparsemap_t = std::unordered_map<std::string, mat::sparse_matrix<>>;
 
 /**********************************************************************/
 // Global variables
 matmap_t g_matrices;
+// Matrices moved into sparse storage with the sparse command
+sparsemap_t g_sparse;
+// Set by evaluate when an expression's result is sparse
+std::optional<mat::sparse_matrix<>> g_sparseResult;
 
 /**********************************************************************/
 // Global constants
@@ -40,6 +46,7 @@ const std::unordered_map<char, int> g_operatorPrecedence
   {'+', 1},
   {'-', 1},
   {'*', 2},
+  {'\\', 2},
   {'^', 3}
 };
 
@@ -84,11 +91,19 @@ identity(const tokenlist_t& tokens);
 mat::matrix
 zero(const tokenlist_t& tokens);
 
-/// \brief Computes the mod of each number in the given matrix.
-/// \param tokens contains name of matrix to mod and number to mod by
-/// \return matrix with all values modulo some integer
+/// \brief Computes the mod of each number in the given matrix, or evaluates
+///   a command or expression exactly in the integers modulo a number.
+///   Entries are rounded to integers first.
+/// \param tokens contains name of matrix to mod and number to mod by, or the
+///   number followed by inverse, determinant, rank, row_echelon,
+///   reduced_row_echelon or solve and its matrices, or by an expression
+///   using +, -, *, \ and ^
+/// \return matrix with all values modulo some integer (rank is not reduced)
+/// \note The number must be below 2^31, and prime for elimination.
 /// 
 /// \note mod <name> <number>
+/// \note mod <number> <command>
+/// \note mod <number> <expression>
 mat::matrix
 mod(const tokenlist_t& tokens);
 
@@ -146,6 +161,60 @@ augment(const tokenlist_t& tokens);
 mat::matrix
 minorMatrix(const tokenlist_t& tokens);
 
+/// \brief Copy a block out of a matrix
+/// \param tokens contains name of matrix, top-left corner and block size
+/// \return rows x cols block starting at (row, col)
+///
+/// \note block <matrix> <row> <col> <rows> <cols>
+mat::matrix
+block(const tokenlist_t& tokens);
+
+/// \brief Solves AX = B without forming the inverse of A. The same
+///   solution is given by the expression A \ B. A non-square A gives
+///   the least-squares solution.
+/// \param tokens contains names of coefficient matrix and right-hand sides
+/// \return X with AX = B, or B if A is singular or sizes differ
+///
+/// \note solve <matrix> <rhs>
+mat::matrix
+solve(const tokenlist_t& tokens);
+
+/// \brief Eigenvalues of a symmetric matrix, whose lower triangle is read.
+/// \param tokens contains name of matrix and optional count of largest
+///   eigenvalues wanted
+/// \return Column of all eigenvalues in ascending order, or of the k
+///   largest in descending order, or empty matrix if not square
+///
+/// \note eigenvalues <matrix> [<k>]
+mat::matrix
+eigenvalues(const tokenlist_t& tokens);
+
+/// \brief Eigenvectors of a symmetric matrix, whose lower triangle is read.
+/// \param tokens contains name of matrix and optional count of largest
+///   eigenpairs wanted
+/// \return Eigenvectors as columns, in the order eigenvalues gives their
+///   values, or empty matrix if not square
+///
+/// \note eigenvectors <matrix> [<k>]
+mat::matrix
+eigenvectors(const tokenlist_t& tokens);
+
+/// \brief Singular values of a matrix.
+/// \param tokens contains name of matrix
+/// \return Column of singular values in descending order
+///
+/// \note singular_values <matrix>
+mat::matrix
+singularValues(const tokenlist_t& tokens);
+
+/// \brief Moore-Penrose pseudo-inverse of a matrix, by its SVD.
+/// \param tokens contains name of matrix
+/// \return Pseudo-inverse, the inverse when the matrix is invertible
+///
+/// \note pseudo_inverse <matrix>
+mat::matrix
+pseudoInverse(const tokenlist_t& tokens);
+
 mat::matrix
 determinant(const tokenlist_t& tokens);
 
@@ -178,11 +247,41 @@ multiplyRow(const tokenlist_t& tokens);
 void
 equalExpression(const tokenlist_t& tokens);
 
+/// \brief Moves a matrix into compressed sparse row storage. Products
+///   involving it skip its zeros; other operators see its dense form.
+/// \param tokens contains name of matrix to convert
+///
+/// \note sparse <matrix>
+void
+sparse(const tokenlist_t& tokens);
+
+/// \brief Moves a sparse matrix back into dense storage.
+/// \param tokens contains name of matrix to convert
+///
+/// \note dense <matrix>
+void
+dense(const tokenlist_t& tokens);
+
+/// \brief Sets or prints the number of threads used by parallel kernels.
+/// \param tokens contains optional thread count
+///
+/// \note threads [<count>]
+void
+threads(const tokenlist_t& tokens);
+
+/// \brief Turns Strassen-Winograd multiplication on or off, or sets the
+///   size below which it hands products to the conventional kernel.
+///   Prints the crossover, 0 when off, if no argument is given.
+/// \param tokens contains on, off or a crossover size
+/// \note Faster for large products, but only normwise accurate.
+///
+/// \note strassen [on|off|<crossover>]
+void
+strassen(const tokenlist_t& tokens);
+
 /**********************************************************************/
 // Helper function declarations
 
-long
-euclidMod(long a, long b);
 void
 repl(std::istream& input);
 
@@ -219,12 +318,31 @@ tokenizeMath(tokenlist_t tokens);
 bool
 isNumber(const std::string& token);
 
+bool
+isCount(const std::string& token);
+
 bool
 foundMatrix(const std::string& name);
 
+mat::matrix
+solveOrFit(const mat::matrix& A, const mat::matrix& B);
+
+bool
+foundSparse(const std::string& name);
+
+bool
+sparseOp(const std::string& resName, const std::string& a, const std::string& b, char op);
+
 void
 doOp(tokenstack_t& eval, tokenlist_t& results, std::string a, std::string b, const std::string& opStr);
 
+mat::matrix
+modEvaluate(const tokenlist_t& tokens, unsigned long modulus);
+
+mat::modular_matrix
+modOperand(const std::string& token, unsigned long modulus,
+           const std::unordered_map<std::string, mat::modular_matrix>& results);
+
 void
 help();
 
@@ -258,6 +376,7 @@ repl(std::istream& input)
 {
   bool isCin = (&input) == (&std::cin);
   g_matrices = matmap_t();
+  g_sparse = sparsemap_t();
   
   std::string line;
   if (isCin)
@@ -287,8 +406,15 @@ repl(std::istream& input)
 mat::matrix
 doCommand(const tokenlist_t& tokens)
 {
+  // A sparse result left by a command whose value nobody used must not
+  // be picked up by a later print or assignment
+  g_sparseResult.reset();
+
   if (tokens[0] == "reset")
+  {
     g_matrices = matmap_t();
+    g_sparse = sparsemap_t();
+  }
   else if (tokens[0] == "print")
     printMatrix(tokens);
   else if (tokens[0] == "transpose")
@@ -315,8 +441,20 @@ doCommand(const tokenlist_t& tokens)
     return augment(tokens);
   else if (tokens[0] == "minor")
     return minorMatrix(tokens);
+  else if (tokens[0] == "block")
+    return block(tokens);
   else if (tokens[0] == "cholesky")
     return cholesky(tokens);
+  else if (tokens[0] == "solve")
+    return solve(tokens);
+  else if (tokens[0] == "eigenvalues")
+    return eigenvalues(tokens);
+  else if (tokens[0] == "eigenvectors")
+    return eigenvectors(tokens);
+  else if (tokens[0] == "singular_values")
+    return singularValues(tokens);
+  else if (tokens[0] == "pseudo_inverse")
+    return pseudoInverse(tokens);
   else if (tokens[0] == "determinant" || tokens[0] == "det")
     return determinant(tokens);
   else if (tokens[0] == "adjugate" || tokens[0] == "adj")
@@ -327,9 +465,17 @@ doCommand(const tokenlist_t& tokens)
     printNewline();
   else if (tokens[0] == "mod")
     return mod(tokens);
+  else if (tokens[0] == "threads")
+    threads(tokens);
+  else if (tokens[0] == "strassen")
+    strassen(tokens);
+  else if (tokens[0] == "sparse")
+    sparse(tokens);
+  else if (tokens[0] == "dense")
+    dense(tokens);
   else if (tokens.size() > 1 && tokens[1] == "=")
     equalExpression(tokens);
-  else if (g_matrices.find(tokens[0]) != g_matrices.end() || isNumber(tokens[0]) || tokens[0][0] == '(' || tokens[0][0] == '-')
+  else if (g_matrices.find(tokens[0]) != g_matrices.end() || g_sparse.find(tokens[0]) != g_sparse.end() || isNumber(tokens[0]) || tokens[0][0] == '(' || tokens[0][0] == '-')
     return evaluate(tokens);
   else
     printError("Command does not exist.");
@@ -347,7 +493,13 @@ void
 printMatrix(const tokenlist_t& tokens)
 {
   auto result = doCommand(tokenlist_t(tokens.begin() + 1, tokens.end()));
-  std::cout << result;
+  if (g_sparseResult)
+  {
+    std::cout << *g_sparseResult;
+    g_sparseResult.reset();
+  }
+  else
+    std::cout << result;
 }
 
 void
@@ -366,10 +518,12 @@ transpose(const tokenlist_t& tokens)
   }
 
   std::string name = tokens[1];
-  if (foundMatrix(name))
+  if (foundSparse(name))
+    g_sparseResult = mat::transpose(g_sparse.at(name));
+  else if (foundMatrix(name))
     return mat::transpose(g_matrices.at(name));
-  else
-    return mat::matrix();
+
+  return mat::matrix();
 }
 
 mat::matrix
@@ -465,6 +619,156 @@ minorMatrix(const tokenlist_t& tokens)
   return mat::matrix();
 }
 
+mat::matrix
+block(const tokenlist_t& tokens)
+{
+  if (tokens.size() != 6)
+  {
+    printUsage("block <matrix> <row> <col> <rows> <cols>");
+    return mat::matrix();
+  }
+
+  std::string name = tokens[1];
+  if (!foundMatrix(name))
+  {
+    printError("Matrix not found");
+    return mat::matrix();
+  }
+
+  const mat::matrix& A = g_matrices.at(name);
+  size_t row = std::stoul(tokens[2]);
+  size_t col = std::stoul(tokens[3]);
+  size_t rows = std::stoul(tokens[4]);
+  size_t cols = std::stoul(tokens[5]);
+  if (row + rows > A.rows() || col + cols > A.cols())
+  {
+    printError("Block out of range");
+    return mat::matrix();
+  }
+
+  return A.block(row, col, rows, cols);
+}
+
+mat::matrix
+solve(const tokenlist_t& tokens)
+{
+  if (tokens.size() != 3)
+  {
+    printUsage("solve <matrix> <rhs>");
+    return mat::matrix();
+  }
+
+  std::string name1 = tokens[1];
+  std::string name2 = tokens[2];
+  if (foundMatrix(name1) && foundMatrix(name2))
+    return solveOrFit(g_matrices.at(name1), g_matrices.at(name2));
+  else
+    printError("Not all matrices found");
+
+  return mat::matrix();
+}
+
+// Square systems are solved exactly, others in the least-squares sense
+mat::matrix
+solveOrFit(const mat::matrix& A, const mat::matrix& B)
+{
+  if (A.rows() == A.cols())
+    return mat::solve(A, B);
+  return mat::leastSquares(A, B);
+}
+
+mat::matrix
+eigenvalues(const tokenlist_t& tokens)
+{
+  if (tokens.size() != 2 && tokens.size() != 3)
+  {
+    printUsage("eigenvalues <matrix> [<k>]");
+    return mat::matrix();
+  }
+
+  std::string name = tokens[1];
+  if (!foundMatrix(name))
+    return mat::matrix();
+
+  if (tokens.size() == 3 && !isCount(tokens[2]))
+  {
+    printUsage("eigenvalues <matrix> [<k>]");
+    return mat::matrix();
+  }
+
+  const mat::matrix& A = g_matrices.at(name);
+  std::vector<elem_t> values;
+  if (tokens.size() == 3)
+    values = mat::symmetricEigen(A, std::stoul(tokens[2])).values;
+  else
+    values = mat::symmetricEigenvalues(A);
+
+  mat::matrix result(values.size(), 1);
+  for (size_t i = 0; i < values.size(); ++i)
+    result(i, 0) = values[i];
+  return result;
+}
+
+mat::matrix
+eigenvectors(const tokenlist_t& tokens)
+{
+  if (tokens.size() != 2 && tokens.size() != 3)
+  {
+    printUsage("eigenvectors <matrix> [<k>]");
+    return mat::matrix();
+  }
+
+  std::string name = tokens[1];
+  if (!foundMatrix(name))
+    return mat::matrix();
+
+  if (tokens.size() == 3 && !isCount(tokens[2]))
+  {
+    printUsage("eigenvectors <matrix> [<k>]");
+    return mat::matrix();
+  }
+
+  const mat::matrix& A = g_matrices.at(name);
+  if (tokens.size() == 3)
+    return mat::symmetricEigen(A, std::stoul(tokens[2])).vectors;
+  return mat::symmetricEigen(A).vectors;
+}
+
+mat::matrix
+singularValues(const tokenlist_t& tokens)
+{
+  if (tokens.size() != 2)
+  {
+    printUsage("singular_values <matrix>");
+    return mat::matrix();
+  }
+
+  std::string name = tokens[1];
+  if (!foundMatrix(name))
+    return mat::matrix();
+
+  std::vector<elem_t> values = mat::singularValues(g_matrices.at(name));
+  mat::matrix result(values.size(), 1);
+  for (size_t i = 0; i < values.size(); ++i)
+    result(i, 0) = values[i];
+  return result;
+}
+
+mat::matrix
+pseudoInverse(const tokenlist_t& tokens)
+{
+  if (tokens.size() != 2)
+  {
+    printUsage("pseudo_inverse <matrix>");
+    return mat::matrix();
+  }
+
+  std::string name = tokens[1];
+  if (foundMatrix(name))
+    return mat::pseudoInverse(g_matrices.at(name));
+  return mat::matrix();
+}
+
 mat::matrix
 determinant(const tokenlist_t& tokens)
 {
@@ -636,35 +940,270 @@ cholesky(const tokenlist_t& tokens)
 mat::matrix
 mod(const tokenlist_t& tokens)
 {
-  if (tokens.size() != 3)
+  if (tokens.size() < 3)
   {
     printUsage("mod <name> <number>");
+    printUsage("mod <number> <expression>");
+    return mat::matrix();
+  }
+
+  // mod <name> <number> reduces a stored matrix
+  if (tokens.size() == 3 && !isNumber(tokens[1]) && isNumber(tokens[2]))
+  {
+    std::string name = tokens[1];
+    if (!foundMatrix(name))
+    {
+      printError("Matrix " + name + " not found");
+      return mat::matrix();
+    }
+
+    // Checked before narrowing, so a huge modulus cannot wrap into range
+    unsigned long long modulus = isCount(tokens[2]) ? std::stoull(tokens[2]) : 0;
+    if (modulus < 2 || modulus >= (1ull << 31))
+    {
+      printError("Modulus must be between 2 and 2^31 - 1");
+      return mat::matrix();
+    }
+    return mat::modular_matrix(g_matrices.at(name), modulus).toMatrix();
+  }
+
+  if (!isNumber(tokens[1]))
+  {
+    printUsage("mod <number> <expression>");
     return mat::matrix();
   }
 
+  unsigned long modulus = isCount(tokens[1]) ? std::stoul(tokens[1]) : 0;
+  if (modulus < 2 || modulus >= (1ul << 31))
+  {
+    printError("Modulus must be between 2 and 2^31 - 1");
+    return mat::matrix();
+  }
+
+  return modEvaluate(tokenlist_t(tokens.begin() + 2, tokens.end()), modulus);
+}
+
+// Evaluates a command or expression over the integers modulo modulus.
+// Matrices are reduced once up front, so every step is exact.
+mat::matrix
+modEvaluate(const tokenlist_t& tokens, unsigned long modulus)
+{
+  std::unordered_map<std::string, mat::modular_matrix> results;
+  const std::string& command = tokens[0];
+  if (command == "inverse" || command == "determinant" || command == "det" || command == "rank"
+      || command == "row_echelon" || command == "re" || command == "reduced_row_echelon" || command == "rre")
+  {
+    if (tokens.size() != 2)
+    {
+      printUsage("mod <number> " + command + " <matrix>");
+      return mat::matrix();
+    }
+
+    mat::modular_matrix A = modOperand(tokens[1], modulus, results);
+    if (A.rows() == 0)
+      return mat::matrix();
+    if (command == "inverse")
+      return mat::inverse(A).toMatrix();
+    if (command == "row_echelon" || command == "re")
+      return mat::rowEchelon(std::move(A)).toMatrix();
+    if (command == "reduced_row_echelon" || command == "rre")
+      return mat::reducedRowEchelon(std::move(A)).toMatrix();
+
+    mat::matrix result(1, 1);
+    if (command == "rank")
+      result(0, 0) = mat::rank(std::move(A));
+    else
+      result(0, 0) = mat::determinant(std::move(A));
+    return result;
+  }
+  else if (command == "solve")
+  {
+    if (tokens.size() != 3)
+    {
+      printUsage("mod <number> solve <matrix> <rhs>");
+      return mat::matrix();
+    }
+
+    mat::modular_matrix A = modOperand(tokens[1], modulus, results);
+    mat::modular_matrix B = modOperand(tokens[2], modulus, results);
+    if (A.rows() == 0 || B.rows() == 0)
+      return mat::matrix();
+    return mat::solve(A, B).toMatrix();
+  }
+
+  // Expressions: intermediate results are kept under generated names,
+  // numbers stay tokens so they can scale or raise a matrix
+  tokenlist_t postfix = toPostfix(tokens);
+  tokenstack_t eval;
+  for (const auto& token : postfix)
+  {
+    if (!isOperator(token))
+    {
+      eval.push(token);
+      continue;
+    }
+
+    if (eval.size() < 2)
+    {
+      printError("Evaluation error");
+      return mat::matrix();
+    }
+    std::string b = eval.top();
+    eval.pop();
+    std::string a = eval.top();
+    eval.pop();
+
+    char op = token[0];
+    std::string name = "__mod" + std::to_string(results.size());
+    if (op == '^' && isNumber(b))
+    {
+      // A negative exponent would wrap to a huge power in std::stoul
+      if (!isCount(b))
+      {
+        printError("Exponent must be a non-negative integer");
+        return mat::matrix();
+      }
+      results[name] = modOperand(a, modulus, results) ^ std::stoul(b);
+    }
+    else if (op == '*' && isNumber(b))
+      results[name] = modOperand(a, modulus, results) * std::stoll(b);
+    else if (op == '*' && isNumber(a))
+      results[name] = std::stoll(a) * modOperand(b, modulus, results);
+    else
+    {
+      mat::modular_matrix A = modOperand(a, modulus, results);
+      mat::modular_matrix B = modOperand(b, modulus, results);
+      if (A.rows() == 0 || B.rows() == 0)
+        return mat::matrix();
+
+      if (op == '+')
+        results[name] = A + B;
+      else if (op == '-')
+        results[name] = A - B;
+      else if (op == '*')
+        results[name] = A * B;
+      else if (op == '\\')
+        results[name] = mat::solve(A, B);
+      else
+      {
+        printError("Evaluation error");
+        return mat::matrix();
+      }
+    }
+
+    if (results[name].rows() == 0)
+      return mat::matrix();
+    eval.push(name);
+  }
+
+  if (eval.size() != 1)
+  {
+    printError("Evaluation error");
+    return mat::matrix();
+  }
+  return modOperand(eval.top(), modulus, results).toMatrix();
+}
+
+// A stored matrix, intermediate result, negated name or number, reduced
+// modulo modulus; empty if none of those
+mat::modular_matrix
+modOperand(const std::string& token, unsigned long modulus,
+           const std::unordered_map<std::string, mat::modular_matrix>& results)
+{
+  if (results.find(token) != results.end())
+    return results.at(token);
+  if (isNumber(token))
+  {
+    mat::modular_matrix number(1, 1, modulus);
+    number.set(0, 0, std::stoll(token));
+    return number;
+  }
+  if (token.size() > 1 && token[0] == '-')
+  {
+    mat::modular_matrix A = modOperand(token.substr(1), modulus, results);
+    return A.rows() == 0 ? A : -A;
+  }
+  if (foundMatrix(token))
+    return mat::modular_matrix(g_matrices.at(token), modulus);
+  if (foundSparse(token))
+    return mat::modular_matrix(g_sparse.at(token).dense(), modulus);
+
+  printError("Matrix " + token + " not found");
+  return mat::modular_matrix();
+}
+
+void
+threads(const tokenlist_t& tokens)
+{
+  if (tokens.size() > 2)
+  {
+    printUsage("threads [<count>]");
+    return;
+  }
+
+  if (tokens.size() == 2)
+    mat::setNumThreads(std::stoul(tokens[1]));
+  else
+    std::cout << mat::getNumThreads() << '\n';
+}
+
+void
+strassen(const tokenlist_t& tokens)
+{
+  if (tokens.size() > 2)
+  {
+    printUsage("strassen [on|off|<crossover>]");
+    return;
+  }
+
+  if (tokens.size() == 1)
+    std::cout << mat::strassenCrossover() << '\n';
+  else if (tokens[1] == "on")
+    mat::setStrassenCrossover();
+  else if (tokens[1] == "off")
+    mat::setStrassenCrossover(0);
+  else if (isNumber(tokens[1]))
+    mat::setStrassenCrossover(std::stoul(tokens[1]));
+  else
+    printUsage("strassen [on|off|<crossover>]");
+}
+
+void
+sparse(const tokenlist_t& tokens)
+{
+  if (tokens.size() != 2)
+  {
+    printUsage("sparse <matrix>");
+    return;
+  }
+
   std::string name = tokens[1];
-  unsigned long num = std::stoul(tokens[2]);
-  
-  mat::matrix modMatrix(g_matrices[name].rows(), g_matrices[name].cols());
   if (foundMatrix(name))
   {
-    auto ptr = g_matrices[name].begin();
-    for (auto& elem : modMatrix)
-      elem = (double) (euclidMod((long) *(ptr++), num));
-    return modMatrix;
+    g_sparse[name] = mat::sparse_matrix<>(g_matrices.at(name));
+    g_matrices.erase(name);
   }
-
-  return mat::matrix();
+  else if (!foundSparse(name))
+    printError("Matrix " + name + " not found");
 }
 
-// TODO make this more efficient
-long
-euclidMod(long a, long b)
+void
+dense(const tokenlist_t& tokens)
 {
-  while (a < 0) 
-    a += b;
+  if (tokens.size() != 2)
+  {
+    printUsage("dense <matrix>");
+    return;
+  }
 
-  return a % b;
+  std::string name = tokens[1];
+  if (foundSparse(name))
+  {
+    g_matrices[name] = g_sparse.at(name).dense();
+    g_sparse.erase(name);
+  }
+  else if (!foundMatrix(name))
+    printError("Matrix " + name + " not found");
 }
 
 void
@@ -726,13 +1265,23 @@ equalExpression(const tokenlist_t& tokens)
       else
         *(it++) = std::stod(num);
     }
-    g_matrices[name] = A;
+    g_matrices[name] = std::move(A);
+    g_sparse.erase(name);
   }
   else
   {
     mat::matrix res = doCommand(tokenlist_t(tokens.begin() + 2, tokens.end()));
-    if (res != mat::matrix())
-      g_matrices[name] = res;
+    if (g_sparseResult)
+    {
+      g_sparse[name] = std::move(*g_sparseResult);
+      g_sparseResult.reset();
+      g_matrices.erase(name);
+    }
+    else if (res != mat::matrix())
+    {
+      g_matrices[name] = std::move(res);
+      g_sparse.erase(name);
+    }
   }
 }
 
@@ -761,6 +1310,11 @@ evaluate(const tokenlist_t& tokens)
 {
   if (tokens.size() == 1 && tokens[0][0] == '-' && foundMatrix(tokens[0].substr(1)))
     return -g_matrices[tokens[0].substr(1)];
+  if (tokens.size() == 1 && tokens[0][0] == '-' && foundSparse(tokens[0].substr(1)))
+  {
+    g_sparseResult = -1.0 * g_sparse[tokens[0].substr(1)];
+    return mat::matrix();
+  }
 
   tokenlist_t postfix = toPostfix(tokens);
   tokenstack_t eval;
@@ -783,11 +1337,38 @@ evaluate(const tokenlist_t& tokens)
     if (eval.top() == "__error")
     {
       printError("Evaluation error");
+      for (const auto& name : results)
+      {
+        g_matrices.erase(name);
+        g_sparse.erase(name);
+      }
       return mat::matrix();
     }
   }
 
-  return g_matrices[eval.top()];
+  // Intermediate results are only needed while evaluating, so the final
+  // one is moved out rather than copied and all of them are dropped
+  mat::matrix result;
+  bool temporary = std::find(results.begin(), results.end(), eval.top()) != results.end();
+  if (foundSparse(eval.top()))
+  {
+    if (temporary)
+      g_sparseResult = std::move(g_sparse[eval.top()]);
+    else
+      g_sparseResult = g_sparse[eval.top()];
+  }
+  else if (temporary)
+    result = std::move(g_matrices[eval.top()]);
+  else
+    result = g_matrices[eval.top()];
+
+  for (const auto& name : results)
+  {
+    g_matrices.erase(name);
+    g_sparse.erase(name);
+  }
+
+  return result;
 }
 
 tokenlist_t
@@ -877,16 +1458,36 @@ doOp(tokenstack_t& eval, tokenlist_t& results, std::string a, std::string b, con
   {
     negatedA = true;
     a = a.substr(1);
-    g_matrices[a] = -g_matrices[a];
+    g_matrices[a] *= -1;
+  }
+  else if (a[0] == '-' && a.size() > 1 && foundSparse(a.substr(1)))
+  {
+    negatedA = true;
+    a = a.substr(1);
+    g_sparse[a] *= -1;
   }
   if (b[0] == '-' && b.size() > 1 && foundMatrix(b.substr(1)))
   {
     negatedB = true;
     b = b.substr(1);
-    g_matrices[b] = -g_matrices[b];
+    g_matrices[b] *= -1;
   }
+  else if (b[0] == '-' && b.size() > 1 && foundSparse(b.substr(1)))
+  {
+    negatedB = true;
+    b = b.substr(1);
+    g_sparse[b] *= -1;
+  }
+
+  results.push_back(resName);
 
-  if (foundMatrix(a) && foundMatrix(b))
+  if (foundSparse(a) || foundSparse(b))
+  {
+    error = !sparseOp(resName, a, b, op);
+    if (!error)
+      eval.push(resName);
+  }
+  else if (foundMatrix(a) && foundMatrix(b))
   {
     if (op == '+')
       g_matrices[resName] = g_matrices[a] + g_matrices[b];
@@ -894,6 +1495,8 @@ doOp(tokenstack_t& eval, tokenlist_t& results, std::string a, std::string b, con
       g_matrices[resName] = g_matrices[a] - g_matrices[b];
     else if (op == '*')
       g_matrices[resName] = g_matrices[a] * g_matrices[b];
+    else if (op == '\\')
+      g_matrices[resName] = solveOrFit(g_matrices[a], g_matrices[b]);
     else
       error = true;
     
@@ -931,10 +1534,57 @@ doOp(tokenstack_t& eval, tokenlist_t& results, std::string a, std::string b, con
     eval.push("__error");
   }
 
-  if (negatedA)
-    g_matrices[a] = -g_matrices[a];
-  if (negatedB)
-    g_matrices[b] = -g_matrices[b];
+  if (negatedA && foundSparse(a))
+    g_sparse[a] *= -1;
+  else if (negatedA)
+    g_matrices[a] *= -1;
+  if (negatedB && foundSparse(b))
+    g_sparse[b] *= -1;
+  else if (negatedB)
+    g_matrices[b] *= -1;
+}
+
+bool
+sparseOp(const std::string& resName, const std::string& a, const std::string& b, char op)
+{
+  bool sparseA = foundSparse(a);
+  bool sparseB = foundSparse(b);
+
+  // Products keep sparse operands sparse; a product of two sparse
+  // matrices stays sparse, anything mixed with a dense matrix is dense
+  if (op == '*')
+  {
+    if (sparseA && sparseB)
+      g_sparse[resName] = g_sparse[a] * g_sparse[b];
+    else if (sparseA && foundMatrix(b))
+      g_matrices[resName] = g_sparse[a] * g_matrices[b];
+    else if (sparseB && foundMatrix(a))
+      g_matrices[resName] = g_matrices[a] * g_sparse[b];
+    else if (sparseA && isNumber(b))
+      g_sparse[resName] = g_sparse[a] * std::stod(b);
+    else if (sparseB && isNumber(a))
+      g_sparse[resName] = std::stod(a) * g_sparse[b];
+    else
+      return false;
+    return true;
+  }
+
+  // Everything else works on the dense form
+  auto dense = [](const std::string& name) {
+    return foundSparse(name) ? g_sparse.at(name).dense() : g_matrices.at(name);
+  };
+
+  if (op == '^' && sparseA && isNumber(b))
+    g_matrices[resName] = dense(a) ^ std::stoul(b);
+  else if (op == '+' && (sparseA || foundMatrix(a)) && (sparseB || foundMatrix(b)))
+    g_matrices[resName] = dense(a) + dense(b);
+  else if (op == '-' && (sparseA || foundMatrix(a)) && (sparseB || foundMatrix(b)))
+    g_matrices[resName] = dense(a) - dense(b);
+  else if (op == '\\' && (sparseA || foundMatrix(a)) && (sparseB || foundMatrix(b)))
+    g_matrices[resName] = solveOrFit(dense(a), dense(b));
+  else
+    return false;
+  return true;
 }
 
 void
@@ -956,6 +1606,13 @@ foundMatrix(const std::string& name)
     && (g_matrices.find(name) != g_matrices.end());
 }
 
+bool
+foundSparse(const std::string& name)
+{
+  return (name.substr(0, 2) != "__" || name.find("result") != std::string::npos)
+    && (g_sparse.find(name) != g_sparse.end());
+}
+
 bool
 isOperator(const std::string& token)
 {
@@ -989,3 +1646,11 @@ isNumber(const std::string& token)
   }
   return true;
 }
+
+// A non-negative integer small enough for std::stoul
+bool
+isCount(const std::string& token)
+{
+  return !token.empty() && token.size() <= 18 && isNumber(token)
+         && token.find_first_of("-.") == std::string::npos;
+}
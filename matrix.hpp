@@ -13,517 +13,9656 @@
 #include <iterator>
 #include <limits>
 #include <cmath>
+#include <complex>
 #include <tuple>
 #include <algorithm>
+#include <vector>
+#include <cstddef>
+#include <cstdlib>
+#include <cstdint>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <string>
+#include <new>
+#include <initializer_list>
+#include <memory>
+#include <memory_resource>
+#include <random>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 /**********************************************************************/
 typedef double elem_t;
 
 namespace mat
 {
-  class matrix
+  /**********************************************************************/
+  // Thread pool
+  //
+  // One library-owned pool runs every parallel kernel. Its size comes
+  // from MATRIX_NUM_THREADS when set, otherwise from the hardware, and
+  // can be changed at runtime with setNumThreads. The calling thread
+  // takes part in each job, so a pool of n threads owns n - 1 workers.
+  namespace detail
   {
-  public:
-    // type aliases
-    using iterator = elem_t*;
-    using const_iterator = const elem_t*;
+    class thread_pool
+    {
+    public:
+      static thread_pool&
+      instance()
+      {
+        static thread_pool pool(defaultSize());
+        return pool;
+      }
 
-    // default ctor
-    matrix()
-      : m_rows(0),
-        m_cols(0),
-        m_size(0),
-        m_matrix(nullptr)
+      ~thread_pool()
+      {
+        stop();
+      }
+
+      size_t
+      size() const
+      {
+        return m_threads;
+      }
+
+      void
+      resize(size_t threads)
+      {
+        std::lock_guard<std::mutex> submit(m_submit);
+        stop();
+        start(std::max<size_t>(threads, 1));
+      }
+
+      // Runs body(0) ... body(count - 1) across the pool and returns once
+      // all have finished. Nested calls, and calls made while another
+      // thread owns the pool, run serially on the caller.
+      void
+      parallelFor(size_t count, const std::function<void(size_t)>& body)
+      {
+        // m_workers is only read under the submit lock, which resize holds
+        // while it replaces them
+        std::unique_lock<std::mutex> submit(m_submit, std::defer_lock);
+        if (count > 1 && !t_inPool && submit.try_lock() && m_workers.empty())
+          submit.unlock();
+
+        if (!submit.owns_lock())
+        {
+          for (size_t i = 0; i < count; ++i)
+            body(i);
+          return;
+        }
+
+        {
+          std::lock_guard<std::mutex> lock(m_mutex);
+          m_body = &body;
+          m_count = count;
+          m_next = 0;
+          m_busy = m_workers.size();
+          ++m_generation;
+        }
+        m_wake.notify_all();
+
+        runJob();
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_done.wait(lock, [this] { return m_busy == 0; });
+        m_body = nullptr;
+      }
+
+    private:
+      std::vector<std::thread> m_workers;
+      // Workers plus the caller, readable without the submit lock
+      std::atomic<size_t> m_threads{1};
+      std::mutex m_submit;
+      std::mutex m_mutex;
+      std::condition_variable m_wake;
+      std::condition_variable m_done;
+
+      const std::function<void(size_t)>* m_body = nullptr;
+      size_t m_count = 0;
+      std::atomic<size_t> m_next{0};
+      size_t m_busy = 0;
+      size_t m_generation = 0;
+      bool m_stopping = false;
+
+      static inline thread_local bool t_inPool = false;
+
+      explicit thread_pool(size_t threads)
+      {
+        start(threads);
+      }
+
+      static size_t
+      defaultSize()
+      {
+        const char* env = std::getenv("MATRIX_NUM_THREADS");
+        if (env != nullptr)
+        {
+          long threads = std::strtol(env, nullptr, 10);
+          if (threads > 0)
+            return threads;
+        }
+
+        return std::max(std::thread::hardware_concurrency(), 1u);
+      }
+
+      void
+      start(size_t threads)
+      {
+        m_stopping = false;
+        size_t generation = m_generation;
+        for (size_t i = 1; i < threads; ++i)
+          m_workers.emplace_back([this, generation] { workerLoop(generation); });
+        m_threads = m_workers.size() + 1;
+      }
+
+      void
+      stop()
+      {
+        {
+          std::lock_guard<std::mutex> lock(m_mutex);
+          m_stopping = true;
+        }
+        m_wake.notify_all();
+        for (auto& worker : m_workers)
+          worker.join();
+        m_workers.clear();
+      }
+
+      void
+      workerLoop(size_t seen)
+      {
+        while (true)
+        {
+          std::unique_lock<std::mutex> lock(m_mutex);
+          m_wake.wait(lock, [&] { return m_stopping || m_generation != seen; });
+          if (m_stopping)
+            return;
+          seen = m_generation;
+          lock.unlock();
+
+          runJob();
+
+          lock.lock();
+          if (--m_busy == 0)
+            m_done.notify_one();
+        }
+      }
+
+      void
+      runJob()
+      {
+        t_inPool = true;
+        for (size_t i = m_next++; i < m_count; i = m_next++)
+          (*m_body)(i);
+        t_inPool = false;
+      }
+    };
+
+    // Below this much work (multiply-adds, or elements for streaming
+    // kernels) waking the thread pool costs more than it saves
+    constexpr size_t ROW_PARALLEL = 1 << 16;
+
+    // Calls body(first, last) for contiguous row ranges covering
+    // [0, rows), spread across the thread pool when work is large
+    template <typename F>
+    void
+    forRowRanges(size_t rows, size_t work, F body)
     {
+      thread_pool& pool = thread_pool::instance();
+      if (work < ROW_PARALLEL || pool.size() == 1 || rows < 2)
+      {
+        body(size_t(0), rows);
+        return;
+      }
+
+      size_t chunks = std::min(rows, 4 * pool.size());
+      size_t chunk = (rows + chunks - 1) / chunks;
+      pool.parallelFor((rows + chunk - 1) / chunk, [&](size_t c) {
+        body(c * chunk, std::min(rows, (c + 1) * chunk));
+      });
     }
+  } // namespace detail
 
-    // size ctor
-    matrix(size_t rows, size_t cols)
-      : m_rows(rows),
-        m_cols(cols),
-        m_size(rows * cols),
-        m_matrix(new elem_t[m_size])
+  // Sets the number of threads (including the caller) used by parallel
+  // kernels
+  void
+  setNumThreads(size_t threads)
+  {
+    detail::thread_pool::instance().resize(threads);
+  }
+
+  size_t
+  getNumThreads()
+  {
+    return detail::thread_pool::instance().size();
+  }
+
+  /**********************************************************************/
+  // SIMD kernels
+  //
+  // Element-wise primitives behind the in-place operators and row
+  // operations, with SSE2, AVX2 and AVX-512 versions compiled through
+  // target attributes so one portable build carries all of them. The
+  // widest one the CPU supports is picked on first use, or the one named
+  // by MATRIX_SIMD (scalar, sse2, avx2, avx512). Every version performs
+  // the same IEEE operations in the same order as the scalar loops (no
+  // FMA contraction), so results are bit-identical across them.
+  namespace detail
+  {
+    // Whether row additions snap results within epsilon of zero to zero
+    inline bool g_snapToZero = true;
+
+    // Real type behind an element type: its magnitudes and tolerances
+    template <typename T>
+    struct real_type
+    {
+      using type = T;
+    };
+
+    template <typename T>
+    struct real_type<std::complex<T>>
+    {
+      using type = T;
+    };
+
+    template <typename T>
+    using real_t = typename real_type<T>::type;
+
+    template <typename T>
+    struct simd_kernels
+    {
+      const char* name;
+      // x += y
+      void (*add)(size_t n, T* x, const T* y);
+      // x -= y
+      void (*sub)(size_t n, T* x, const T* y);
+      // x *= k, leaving zeros untouched
+      void (*scale)(size_t n, T* x, T k);
+      // x += k * y, optionally snapping near-zero results to zero
+      void (*axpy)(size_t n, T* x, const T* y, T k, bool snap);
+      // x = value
+      void (*fill)(size_t n, T* x, T value);
+      // dst = src^T for a rows x cols tile; lds and ldd are row strides
+      void (*transpose)(size_t rows, size_t cols, const T* src, size_t lds,
+                        T* dst, size_t ldd);
+    };
+
+    template <typename T>
+    void
+    addScalar(size_t n, T* x, const T* y)
     {
+      for (size_t i = 0; i < n; ++i)
+        x[i] += y[i];
     }
 
-    // size ctor
-    matrix(size_t rows, size_t cols, elem_t init)
-      : m_rows(rows),
-        m_cols(cols),
-        m_size(rows * cols),
-        m_matrix(new elem_t[m_size])
+    template <typename T>
+    void
+    subScalar(size_t n, T* x, const T* y)
     {
-      for (auto& elem : *this)
-        elem = init;
+      for (size_t i = 0; i < n; ++i)
+        x[i] -= y[i];
     }
 
-    // copy ctor
-    matrix(const matrix& m)
-      : m_rows(m.rows()),
-        m_cols(m.cols()),
-        m_size(m.size()),
-        m_matrix(new elem_t[m_size])
+    template <typename T>
+    void
+    scaleScalar(size_t n, T* x, T k)
     {
-      if (this != &m)
-        std::copy(m.begin(), m.end(), begin());
+      for (size_t i = 0; i < n; ++i)
+        if (x[i] != T(0))
+          x[i] *= k;
     }
 
-    // dtor
-    ~matrix()
+    template <typename T>
+    void
+    axpyScalar(size_t n, T* x, const T* y, T k, bool snap)
     {
-      if (m_matrix != nullptr)
-        delete[] m_matrix;
+      const real_t<T> eps = std::numeric_limits<real_t<T>>::epsilon();
+      for (size_t i = 0; i < n; ++i)
+      {
+        T product = k * y[i];
+        T sum = x[i] + product;
+        x[i] = snap && std::abs(sum) <= eps ? T(0) : sum;
+      }
     }
 
-    matrix&
-    operator=(const matrix& m)
+    template <typename T>
+    void
+    fillScalar(size_t n, T* x, T value)
     {
-      if (this != &m)
+      for (size_t i = 0; i < n; ++i)
+        x[i] = value;
+    }
+
+    template <typename T>
+    void
+    transposeScalar(size_t rows, size_t cols, const T* src, size_t lds, T* dst, size_t ldd)
+    {
+      for (size_t i = 0; i < rows; ++i)
+        for (size_t j = 0; j < cols; ++j)
+          dst[j * ldd + i] = src[i * lds + j];
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    __attribute__((target("sse2"))) void
+    addSse2(size_t n, double* x, const double* y)
+    {
+      size_t i = 0;
+      for ( ; i + 2 <= n; i += 2)
+        _mm_storeu_pd(x + i, _mm_add_pd(_mm_loadu_pd(x + i), _mm_loadu_pd(y + i)));
+      addScalar(n - i, x + i, y + i);
+    }
+
+    __attribute__((target("sse2"))) void
+    subSse2(size_t n, double* x, const double* y)
+    {
+      size_t i = 0;
+      for ( ; i + 2 <= n; i += 2)
+        _mm_storeu_pd(x + i, _mm_sub_pd(_mm_loadu_pd(x + i), _mm_loadu_pd(y + i)));
+      subScalar(n - i, x + i, y + i);
+    }
+
+    __attribute__((target("sse2"))) void
+    scaleSse2(size_t n, double* x, double k)
+    {
+      const __m128d zero = _mm_setzero_pd();
+      const __m128d factor = _mm_set1_pd(k);
+      size_t i = 0;
+      for ( ; i + 2 <= n; i += 2)
       {
-        if (m_matrix != nullptr)
-          delete[] m_matrix;
-        m_matrix = new elem_t[m.rows() * m.cols()];
+        __m128d v = _mm_loadu_pd(x + i);
+        __m128d nonzero = _mm_cmpneq_pd(v, zero);
+        __m128d scaled = _mm_mul_pd(v, factor);
+        _mm_storeu_pd(x + i, _mm_or_pd(_mm_and_pd(nonzero, scaled), _mm_andnot_pd(nonzero, v)));
+      }
+      scaleScalar(n - i, x + i, k);
+    }
 
-        std::copy(m.begin(), m.end(), begin());
-        m_size = m.size();
-        m_rows = m.rows();
-        m_cols = m.cols();
+    __attribute__((target("sse2"))) void
+    axpySse2(size_t n, double* x, const double* y, double k, bool snap)
+    {
+      const __m128d factor = _mm_set1_pd(k);
+      const __m128d eps = _mm_set1_pd(std::numeric_limits<double>::epsilon());
+      const __m128d sign = _mm_set1_pd(-0.0);
+      size_t i = 0;
+      for ( ; i + 2 <= n; i += 2)
+      {
+        __m128d sum = _mm_add_pd(_mm_loadu_pd(x + i), _mm_mul_pd(factor, _mm_loadu_pd(y + i)));
+        if (snap)
+          sum = _mm_andnot_pd(_mm_cmple_pd(_mm_andnot_pd(sign, sum), eps), sum);
+        _mm_storeu_pd(x + i, sum);
       }
+      axpyScalar(n - i, x + i, y + i, k, snap);
+    }
 
-      return *this;
+    __attribute__((target("sse2"))) void
+    fillSse2(size_t n, double* x, double value)
+    {
+      const __m128d v = _mm_set1_pd(value);
+      size_t i = 0;
+      for ( ; i + 2 <= n; i += 2)
+        _mm_storeu_pd(x + i, v);
+      fillScalar(n - i, x + i, value);
     }
 
-    size_t
-    rows()
+    __attribute__((target("avx2"))) void
+    addAvx2(size_t n, double* x, const double* y)
     {
-      return m_rows;
+      size_t i = 0;
+      for ( ; i + 4 <= n; i += 4)
+        _mm256_storeu_pd(x + i, _mm256_add_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i)));
+      addScalar(n - i, x + i, y + i);
     }
 
-    size_t
-    rows() const
+    __attribute__((target("avx2"))) void
+    subAvx2(size_t n, double* x, const double* y)
     {
-      return m_rows;
+      size_t i = 0;
+      for ( ; i + 4 <= n; i += 4)
+        _mm256_storeu_pd(x + i, _mm256_sub_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i)));
+      subScalar(n - i, x + i, y + i);
     }
 
-    size_t
-    cols()
+    __attribute__((target("avx2"))) void
+    scaleAvx2(size_t n, double* x, double k)
     {
-      return m_cols;
+      const __m256d zero = _mm256_setzero_pd();
+      const __m256d factor = _mm256_set1_pd(k);
+      size_t i = 0;
+      for ( ; i + 4 <= n; i += 4)
+      {
+        __m256d v = _mm256_loadu_pd(x + i);
+        __m256d nonzero = _mm256_cmp_pd(v, zero, _CMP_NEQ_UQ);
+        _mm256_storeu_pd(x + i, _mm256_blendv_pd(v, _mm256_mul_pd(v, factor), nonzero));
+      }
+      scaleScalar(n - i, x + i, k);
     }
 
-    size_t
-    cols() const
+    __attribute__((target("avx2"))) void
+    axpyAvx2(size_t n, double* x, const double* y, double k, bool snap)
     {
-      return m_cols;
+      const __m256d factor = _mm256_set1_pd(k);
+      const __m256d eps = _mm256_set1_pd(std::numeric_limits<double>::epsilon());
+      const __m256d sign = _mm256_set1_pd(-0.0);
+      size_t i = 0;
+      for ( ; i + 4 <= n; i += 4)
+      {
+        __m256d sum = _mm256_add_pd(_mm256_loadu_pd(x + i),
+                                    _mm256_mul_pd(factor, _mm256_loadu_pd(y + i)));
+        if (snap)
+          sum = _mm256_andnot_pd(_mm256_cmp_pd(_mm256_andnot_pd(sign, sum), eps, _CMP_LE_OQ), sum);
+        _mm256_storeu_pd(x + i, sum);
+      }
+      axpyScalar(n - i, x + i, y + i, k, snap);
     }
 
-    size_t
-    size()
+    __attribute__((target("avx2"))) void
+    fillAvx2(size_t n, double* x, double value)
     {
-      return m_size;
+      const __m256d v = _mm256_set1_pd(value);
+      size_t i = 0;
+      for ( ; i + 4 <= n; i += 4)
+        _mm256_storeu_pd(x + i, v);
+      fillScalar(n - i, x + i, value);
     }
 
-    size_t
-    size() const
+    // AVX-512 handles the last partial vector with a masked load and
+    // store instead of a scalar tail
+    __attribute__((target("avx512f"))) void
+    addAvx512(size_t n, double* x, const double* y)
     {
-      return m_size;
+      for (size_t i = 0; i < n; i += 8)
+      {
+        __mmask8 m = n - i >= 8 ? 0xff : (1u << (n - i)) - 1;
+        __m512d v = _mm512_add_pd(_mm512_maskz_loadu_pd(m, x + i), _mm512_maskz_loadu_pd(m, y + i));
+        _mm512_mask_storeu_pd(x + i, m, v);
+      }
     }
 
-    iterator
-    begin()
+    __attribute__((target("avx512f"))) void
+    subAvx512(size_t n, double* x, const double* y)
     {
-      return m_matrix;
+      for (size_t i = 0; i < n; i += 8)
+      {
+        __mmask8 m = n - i >= 8 ? 0xff : (1u << (n - i)) - 1;
+        __m512d v = _mm512_sub_pd(_mm512_maskz_loadu_pd(m, x + i), _mm512_maskz_loadu_pd(m, y + i));
+        _mm512_mask_storeu_pd(x + i, m, v);
+      }
     }
 
-    const_iterator
-    begin() const
+    __attribute__((target("avx512f"))) void
+    scaleAvx512(size_t n, double* x, double k)
     {
-      return m_matrix;
+      const __m512d zero = _mm512_setzero_pd();
+      const __m512d factor = _mm512_set1_pd(k);
+      for (size_t i = 0; i < n; i += 8)
+      {
+        __mmask8 m = n - i >= 8 ? 0xff : (1u << (n - i)) - 1;
+        __m512d v = _mm512_maskz_loadu_pd(m, x + i);
+        __mmask8 nonzero = _mm512_mask_cmp_pd_mask(m, v, zero, _CMP_NEQ_UQ);
+        _mm512_mask_storeu_pd(x + i, nonzero, _mm512_mul_pd(v, factor));
+      }
     }
 
-    iterator
-    end()
+    __attribute__((target("avx512f"))) void
+    axpyAvx512(size_t n, double* x, const double* y, double k, bool snap)
     {
-      return m_matrix + m_size;
+      const __m512d zero = _mm512_setzero_pd();
+      const __m512d factor = _mm512_set1_pd(k);
+      const __m512d eps = _mm512_set1_pd(std::numeric_limits<double>::epsilon());
+      // Explicit rounding keeps the compiler from fusing these into an FMA
+      constexpr int rounding = _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC;
+      for (size_t i = 0; i < n; i += 8)
+      {
+        __mmask8 m = n - i >= 8 ? 0xff : (1u << (n - i)) - 1;
+        __m512d product = _mm512_maskz_mul_round_pd(m, factor, _mm512_maskz_loadu_pd(m, y + i), rounding);
+        __m512d sum = _mm512_maskz_add_round_pd(m, _mm512_maskz_loadu_pd(m, x + i), product, rounding);
+        if (snap)
+          sum = _mm512_mask_mov_pd(sum, _mm512_cmp_pd_mask(_mm512_abs_pd(sum), eps, _CMP_LE_OQ), zero);
+        _mm512_mask_storeu_pd(x + i, m, sum);
+      }
     }
 
-    const_iterator
-    end() const
+    __attribute__((target("avx512f"))) void
+    fillAvx512(size_t n, double* x, double value)
     {
-      return m_matrix + m_size;
+      const __m512d v = _mm512_set1_pd(value);
+      for (size_t i = 0; i < n; i += 8)
+      {
+        __mmask8 m = n - i >= 8 ? 0xff : (1u << (n - i)) - 1;
+        _mm512_mask_storeu_pd(x + i, m, v);
+      }
     }
 
-    void
-    swapRows(size_t r1, size_t r2)
+    // Single-precision versions process twice the lanes per vector
+    __attribute__((target("sse2"))) void
+    addSse2F(size_t n, float* x, const float* y)
     {
-      if (r1 >= m_rows || r2 >= m_rows)
-        return;			 
-      for (size_t j = 0; j < m_cols; ++j)
-        std::swap((*this)(r1, j), (*this)(r2, j));
+      size_t i = 0;
+      for ( ; i + 4 <= n; i += 4)
+        _mm_storeu_ps(x + i, _mm_add_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(y + i)));
+      addScalar(n - i, x + i, y + i);
     }
 
-    // Adds scalar * r1 to r2, changing the values in r2
-    void
-    addRows(size_t r1, size_t r2, elem_t scalar = 1)
+    __attribute__((target("sse2"))) void
+    subSse2F(size_t n, float* x, const float* y)
+    {
+      size_t i = 0;
+      for ( ; i + 4 <= n; i += 4)
+        _mm_storeu_ps(x + i, _mm_sub_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(y + i)));
+      subScalar(n - i, x + i, y + i);
+    }
+
+    __attribute__((target("sse2"))) void
+    scaleSse2F(size_t n, float* x, float k)
+    {
+      const __m128 zero = _mm_setzero_ps();
+      const __m128 factor = _mm_set1_ps(k);
+      size_t i = 0;
+      for ( ; i + 4 <= n; i += 4)
+      {
+        __m128 v = _mm_loadu_ps(x + i);
+        __m128 nonzero = _mm_cmpneq_ps(v, zero);
+        __m128 scaled = _mm_mul_ps(v, factor);
+        _mm_storeu_ps(x + i, _mm_or_ps(_mm_and_ps(nonzero, scaled), _mm_andnot_ps(nonzero, v)));
+      }
+      scaleScalar(n - i, x + i, k);
+    }
+
+    __attribute__((target("sse2"))) void
+    axpySse2F(size_t n, float* x, const float* y, float k, bool snap)
+    {
+      const __m128 factor = _mm_set1_ps(k);
+      const __m128 eps = _mm_set1_ps(std::numeric_limits<float>::epsilon());
+      const __m128 sign = _mm_set1_ps(-0.0f);
+      size_t i = 0;
+      for ( ; i + 4 <= n; i += 4)
+      {
+        __m128 sum = _mm_add_ps(_mm_loadu_ps(x + i), _mm_mul_ps(factor, _mm_loadu_ps(y + i)));
+        if (snap)
+          sum = _mm_andnot_ps(_mm_cmple_ps(_mm_andnot_ps(sign, sum), eps), sum);
+        _mm_storeu_ps(x + i, sum);
+      }
+      axpyScalar(n - i, x + i, y + i, k, snap);
+    }
+
+    __attribute__((target("sse2"))) void
+    fillSse2F(size_t n, float* x, float value)
+    {
+      const __m128 v = _mm_set1_ps(value);
+      size_t i = 0;
+      for ( ; i + 4 <= n; i += 4)
+        _mm_storeu_ps(x + i, v);
+      fillScalar(n - i, x + i, value);
+    }
+
+    __attribute__((target("avx2"))) void
+    addAvx2F(size_t n, float* x, const float* y)
+    {
+      size_t i = 0;
+      for ( ; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(x + i, _mm256_add_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i)));
+      addScalar(n - i, x + i, y + i);
+    }
+
+    __attribute__((target("avx2"))) void
+    subAvx2F(size_t n, float* x, const float* y)
+    {
+      size_t i = 0;
+      for ( ; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(x + i, _mm256_sub_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i)));
+      subScalar(n - i, x + i, y + i);
+    }
+
+    __attribute__((target("avx2"))) void
+    scaleAvx2F(size_t n, float* x, float k)
+    {
+      const __m256 zero = _mm256_setzero_ps();
+      const __m256 factor = _mm256_set1_ps(k);
+      size_t i = 0;
+      for ( ; i + 8 <= n; i += 8)
+      {
+        __m256 v = _mm256_loadu_ps(x + i);
+        __m256 nonzero = _mm256_cmp_ps(v, zero, _CMP_NEQ_UQ);
+        _mm256_storeu_ps(x + i, _mm256_blendv_ps(v, _mm256_mul_ps(v, factor), nonzero));
+      }
+      scaleScalar(n - i, x + i, k);
+    }
+
+    __attribute__((target("avx2"))) void
+    axpyAvx2F(size_t n, float* x, const float* y, float k, bool snap)
+    {
+      const __m256 factor = _mm256_set1_ps(k);
+      const __m256 eps = _mm256_set1_ps(std::numeric_limits<float>::epsilon());
+      const __m256 sign = _mm256_set1_ps(-0.0f);
+      size_t i = 0;
+      for ( ; i + 8 <= n; i += 8)
+      {
+        __m256 sum = _mm256_add_ps(_mm256_loadu_ps(x + i),
+                                   _mm256_mul_ps(factor, _mm256_loadu_ps(y + i)));
+        if (snap)
+          sum = _mm256_andnot_ps(_mm256_cmp_ps(_mm256_andnot_ps(sign, sum), eps, _CMP_LE_OQ), sum);
+        _mm256_storeu_ps(x + i, sum);
+      }
+      axpyScalar(n - i, x + i, y + i, k, snap);
+    }
+
+    __attribute__((target("avx2"))) void
+    fillAvx2F(size_t n, float* x, float value)
+    {
+      const __m256 v = _mm256_set1_ps(value);
+      size_t i = 0;
+      for ( ; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(x + i, v);
+      fillScalar(n - i, x + i, value);
+    }
+
+    __attribute__((target("avx512f"))) void
+    addAvx512F(size_t n, float* x, const float* y)
+    {
+      for (size_t i = 0; i < n; i += 16)
+      {
+        __mmask16 m = n - i >= 16 ? 0xffff : (1u << (n - i)) - 1;
+        __m512 v = _mm512_add_ps(_mm512_maskz_loadu_ps(m, x + i), _mm512_maskz_loadu_ps(m, y + i));
+        _mm512_mask_storeu_ps(x + i, m, v);
+      }
+    }
+
+    __attribute__((target("avx512f"))) void
+    subAvx512F(size_t n, float* x, const float* y)
+    {
+      for (size_t i = 0; i < n; i += 16)
+      {
+        __mmask16 m = n - i >= 16 ? 0xffff : (1u << (n - i)) - 1;
+        __m512 v = _mm512_sub_ps(_mm512_maskz_loadu_ps(m, x + i), _mm512_maskz_loadu_ps(m, y + i));
+        _mm512_mask_storeu_ps(x + i, m, v);
+      }
+    }
+
+    __attribute__((target("avx512f"))) void
+    scaleAvx512F(size_t n, float* x, float k)
+    {
+      const __m512 zero = _mm512_setzero_ps();
+      const __m512 factor = _mm512_set1_ps(k);
+      for (size_t i = 0; i < n; i += 16)
+      {
+        __mmask16 m = n - i >= 16 ? 0xffff : (1u << (n - i)) - 1;
+        __m512 v = _mm512_maskz_loadu_ps(m, x + i);
+        __mmask16 nonzero = _mm512_mask_cmp_ps_mask(m, v, zero, _CMP_NEQ_UQ);
+        _mm512_mask_storeu_ps(x + i, nonzero, _mm512_mul_ps(v, factor));
+      }
+    }
+
+    __attribute__((target("avx512f"))) void
+    axpyAvx512F(size_t n, float* x, const float* y, float k, bool snap)
+    {
+      const __m512 zero = _mm512_setzero_ps();
+      const __m512 factor = _mm512_set1_ps(k);
+      const __m512 eps = _mm512_set1_ps(std::numeric_limits<float>::epsilon());
+      // Explicit rounding keeps the compiler from fusing these into an FMA
+      constexpr int rounding = _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC;
+      for (size_t i = 0; i < n; i += 16)
+      {
+        __mmask16 m = n - i >= 16 ? 0xffff : (1u << (n - i)) - 1;
+        __m512 product = _mm512_maskz_mul_round_ps(m, factor, _mm512_maskz_loadu_ps(m, y + i), rounding);
+        __m512 sum = _mm512_maskz_add_round_ps(m, _mm512_maskz_loadu_ps(m, x + i), product, rounding);
+        if (snap)
+          sum = _mm512_mask_mov_ps(sum, _mm512_cmp_ps_mask(_mm512_abs_ps(sum), eps, _CMP_LE_OQ), zero);
+        _mm512_mask_storeu_ps(x + i, m, sum);
+      }
+    }
+
+    __attribute__((target("avx512f"))) void
+    fillAvx512F(size_t n, float* x, float value)
+    {
+      const __m512 v = _mm512_set1_ps(value);
+      for (size_t i = 0; i < n; i += 16)
+      {
+        __mmask16 m = n - i >= 16 ? 0xffff : (1u << (n - i)) - 1;
+        _mm512_mask_storeu_ps(x + i, m, v);
+      }
+    }
+
+    // Micro-transposes: each loads a square of rows into registers,
+    // shuffles them into columns and stores those as rows of dst. The
+    // ragged right and bottom edges fall back to the scalar loop.
+    __attribute__((target("sse2"))) void
+    transposeSse2(size_t rows, size_t cols, const double* src, size_t lds,
+                  double* dst, size_t ldd)
+    {
+      size_t rows2 = rows & ~size_t(1);
+      size_t cols2 = cols & ~size_t(1);
+      for (size_t i = 0; i < rows2; i += 2)
+        for (size_t j = 0; j < cols2; j += 2)
+        {
+          __m128d r0 = _mm_loadu_pd(src + i * lds + j);
+          __m128d r1 = _mm_loadu_pd(src + (i + 1) * lds + j);
+          _mm_storeu_pd(dst + j * ldd + i, _mm_unpacklo_pd(r0, r1));
+          _mm_storeu_pd(dst + (j + 1) * ldd + i, _mm_unpackhi_pd(r0, r1));
+        }
+      transposeScalar(rows2, cols - cols2, src + cols2, lds, dst + cols2 * ldd, ldd);
+      transposeScalar(rows - rows2, cols, src + rows2 * lds, lds, dst + rows2, ldd);
+    }
+
+    __attribute__((target("avx2"))) void
+    transposeAvx2(size_t rows, size_t cols, const double* src, size_t lds,
+                  double* dst, size_t ldd)
+    {
+      size_t rows4 = rows & ~size_t(3);
+      size_t cols4 = cols & ~size_t(3);
+      for (size_t i = 0; i < rows4; i += 4)
+        for (size_t j = 0; j < cols4; j += 4)
+        {
+          const double* s = src + i * lds + j;
+          __m256d r0 = _mm256_loadu_pd(s);
+          __m256d r1 = _mm256_loadu_pd(s + lds);
+          __m256d r2 = _mm256_loadu_pd(s + 2 * lds);
+          __m256d r3 = _mm256_loadu_pd(s + 3 * lds);
+          __m256d t0 = _mm256_unpacklo_pd(r0, r1);
+          __m256d t1 = _mm256_unpackhi_pd(r0, r1);
+          __m256d t2 = _mm256_unpacklo_pd(r2, r3);
+          __m256d t3 = _mm256_unpackhi_pd(r2, r3);
+          double* d = dst + j * ldd + i;
+          _mm256_storeu_pd(d, _mm256_permute2f128_pd(t0, t2, 0x20));
+          _mm256_storeu_pd(d + ldd, _mm256_permute2f128_pd(t1, t3, 0x20));
+          _mm256_storeu_pd(d + 2 * ldd, _mm256_permute2f128_pd(t0, t2, 0x31));
+          _mm256_storeu_pd(d + 3 * ldd, _mm256_permute2f128_pd(t1, t3, 0x31));
+        }
+      transposeScalar(rows4, cols - cols4, src + cols4, lds, dst + cols4 * ldd, ldd);
+      transposeScalar(rows - rows4, cols, src + rows4 * lds, lds, dst + rows4, ldd);
+    }
+
+    __attribute__((target("sse2"))) void
+    transposeSse2F(size_t rows, size_t cols, const float* src, size_t lds,
+                   float* dst, size_t ldd)
+    {
+      size_t rows4 = rows & ~size_t(3);
+      size_t cols4 = cols & ~size_t(3);
+      for (size_t i = 0; i < rows4; i += 4)
+        for (size_t j = 0; j < cols4; j += 4)
+        {
+          const float* s = src + i * lds + j;
+          __m128 r0 = _mm_loadu_ps(s);
+          __m128 r1 = _mm_loadu_ps(s + lds);
+          __m128 r2 = _mm_loadu_ps(s + 2 * lds);
+          __m128 r3 = _mm_loadu_ps(s + 3 * lds);
+          _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+          float* d = dst + j * ldd + i;
+          _mm_storeu_ps(d, r0);
+          _mm_storeu_ps(d + ldd, r1);
+          _mm_storeu_ps(d + 2 * ldd, r2);
+          _mm_storeu_ps(d + 3 * ldd, r3);
+        }
+      transposeScalar(rows4, cols - cols4, src + cols4, lds, dst + cols4 * ldd, ldd);
+      transposeScalar(rows - rows4, cols, src + rows4 * lds, lds, dst + rows4, ldd);
+    }
+
+    __attribute__((target("avx2"))) void
+    transposeAvx2F(size_t rows, size_t cols, const float* src, size_t lds,
+                   float* dst, size_t ldd)
+    {
+      size_t rows8 = rows & ~size_t(7);
+      size_t cols8 = cols & ~size_t(7);
+      for (size_t i = 0; i < rows8; i += 8)
+        for (size_t j = 0; j < cols8; j += 8)
+        {
+          const float* s = src + i * lds + j;
+          __m256 r[8];
+          for (size_t k = 0; k < 8; ++k)
+            r[k] = _mm256_loadu_ps(s + k * lds);
+
+          __m256 t[8];
+          for (size_t k = 0; k < 8; k += 2)
+          {
+            t[k] = _mm256_unpacklo_ps(r[k], r[k + 1]);
+            t[k + 1] = _mm256_unpackhi_ps(r[k], r[k + 1]);
+          }
+
+          __m256 u[8];
+          for (size_t k = 0; k < 8; k += 4)
+          {
+            u[k] = _mm256_shuffle_ps(t[k], t[k + 2], _MM_SHUFFLE(1, 0, 1, 0));
+            u[k + 1] = _mm256_shuffle_ps(t[k], t[k + 2], _MM_SHUFFLE(3, 2, 3, 2));
+            u[k + 2] = _mm256_shuffle_ps(t[k + 1], t[k + 3], _MM_SHUFFLE(1, 0, 1, 0));
+            u[k + 3] = _mm256_shuffle_ps(t[k + 1], t[k + 3], _MM_SHUFFLE(3, 2, 3, 2));
+          }
+
+          float* d = dst + j * ldd + i;
+          for (size_t k = 0; k < 4; ++k)
+          {
+            _mm256_storeu_ps(d + k * ldd, _mm256_permute2f128_ps(u[k], u[k + 4], 0x20));
+            _mm256_storeu_ps(d + (k + 4) * ldd, _mm256_permute2f128_ps(u[k], u[k + 4], 0x31));
+          }
+        }
+      transposeScalar(rows8, cols - cols8, src + cols8, lds, dst + cols8 * ldd, ldd);
+      transposeScalar(rows - rows8, cols, src + rows8 * lds, lds, dst + rows8, ldd);
+    }
+#endif
+
+    // Picks the widest kernel set the CPU supports, or the one named by
+    // MATRIX_SIMD
+    template <typename T>
+    simd_kernels<T>
+    pickKernels(const simd_kernels<T>& scalar, const simd_kernels<T>& sse2,
+                const simd_kernels<T>& avx2, const simd_kernels<T>& avx512)
+    {
+#if defined(__x86_64__) || defined(__i386__)
+      __builtin_cpu_init();
+      bool hasSse2 = __builtin_cpu_supports("sse2");
+      bool hasAvx2 = __builtin_cpu_supports("avx2");
+      bool hasAvx512 = __builtin_cpu_supports("avx512f");
+
+      const char* env = std::getenv("MATRIX_SIMD");
+      std::string requested = env != nullptr ? env : "";
+      if (requested == "scalar")
+        return scalar;
+      if (requested == "sse2" && hasSse2)
+        return sse2;
+      if (requested == "avx2" && hasAvx2)
+        return avx2;
+
+      if (hasAvx512 && (requested.empty() || requested == "avx512"))
+        return avx512;
+      if (hasAvx2)
+        return avx2;
+      if (hasSse2)
+        return sse2;
+#endif
+      return scalar;
+    }
+
+    // Element types without hand-written kernels (integers, complex) use
+    // the scalar loops, which the compiler vectorizes where it can
+    template <typename T>
+    simd_kernels<T>
+    selectKernels()
+    {
+      return { "scalar", addScalar<T>, subScalar<T>, scaleScalar<T>, axpyScalar<T>, fillScalar<T>,
+               transposeScalar<T> };
+    }
+
+    template <>
+    simd_kernels<double>
+    selectKernels<double>()
+    {
+      const simd_kernels<double> scalar { "scalar", addScalar, subScalar, scaleScalar, axpyScalar, fillScalar,
+                                        transposeScalar };
+#if defined(__x86_64__) || defined(__i386__)
+      const simd_kernels<double> sse2 { "sse2", addSse2, subSse2, scaleSse2, axpySse2, fillSse2,
+                                        transposeSse2 };
+      const simd_kernels<double> avx2 { "avx2", addAvx2, subAvx2, scaleAvx2, axpyAvx2, fillAvx2,
+                                        transposeAvx2 };
+      // AVX-512 reuses the AVX2 micro-transpose, whose rows already span
+      // a full cache line of the destination
+      const simd_kernels<double> avx512 { "avx512", addAvx512, subAvx512, scaleAvx512, axpyAvx512,
+                                          fillAvx512, transposeAvx2 };
+      return pickKernels(scalar, sse2, avx2, avx512);
+#else
+      return scalar;
+#endif
+    }
+
+    template <>
+    simd_kernels<float>
+    selectKernels<float>()
+    {
+      const simd_kernels<float> scalar { "scalar", addScalar, subScalar, scaleScalar, axpyScalar, fillScalar,
+                                        transposeScalar };
+#if defined(__x86_64__) || defined(__i386__)
+      const simd_kernels<float> sse2 { "sse2", addSse2F, subSse2F, scaleSse2F, axpySse2F, fillSse2F,
+                                       transposeSse2F };
+      const simd_kernels<float> avx2 { "avx2", addAvx2F, subAvx2F, scaleAvx2F, axpyAvx2F, fillAvx2F,
+                                       transposeAvx2F };
+      const simd_kernels<float> avx512 { "avx512", addAvx512F, subAvx512F, scaleAvx512F, axpyAvx512F,
+                                         fillAvx512F, transposeAvx2F };
+      return pickKernels(scalar, sse2, avx2, avx512);
+#else
+      return scalar;
+#endif
+    }
+
+    template <typename T>
+    const simd_kernels<T>&
+    simd()
+    {
+      static const simd_kernels<T> kernels = selectKernels<T>();
+      return kernels;
+    }
+  } // namespace detail
+
+  // Name of the element-wise kernel set chosen for this CPU
+  const char*
+  simdLevel()
+  {
+    return detail::simd<elem_t>().name;
+  }
+
+  // Row additions snap results within epsilon of zero to exactly zero
+  // unless this is turned off
+  void
+  setZeroSnapping(bool enabled)
+  {
+    detail::g_snapToZero = enabled;
+  }
+
+  bool
+  zeroSnapping()
+  {
+    return detail::g_snapToZero;
+  }
+
+  /**********************************************************************/
+  // GEMM kernels
+  //
+  // C += alpha * A * B for row-major C with leading dimension ldc. A and
+  // B are addressed through a row and a column stride each, so a
+  // transposed operand costs nothing but a swap of its strides. Large
+  // products are split into KC x NC panels of B (sized for L3) and
+  // MC x KC blocks of A (sized for L2), both packed into contiguous
+  // micro-panels so the MR x NR register kernel streams through them
+  // with unit stride while one NR-wide sliver of B stays in L1.
+  //
+  // The register kernel follows the element-wise kernel choice. AVX2 and
+  // AVX-512 hosts get FMA kernels with tiles sized to fill their 16 or 32
+  // vector registers with accumulators: 6 rows by two vectors of B for
+  // AVX2, 12 rows by two vectors for AVX-512. Other hosts and element
+  // types use a generic 4 x 8 loop. FMA rounds once per multiply-add, so
+  // products can differ in the last bits between levels.
+  namespace detail
+  {
+    // Register tile of the generic kernel
+    constexpr size_t GEMM_MR = 4;
+    constexpr size_t GEMM_NR = 8;
+    constexpr size_t GEMM_KC = 256;
+    constexpr size_t GEMM_MC = 128;
+    constexpr size_t GEMM_NC = 4096;
+
+    // Below this many multiply-adds packing costs more than it saves
+    constexpr size_t GEMM_SMALL = 48 * 48 * 48;
+
+    // Below this many multiply-adds waking the thread pool costs more
+    // than it saves
+    constexpr size_t GEMM_PARALLEL = 128 * 128 * 128;
+
+    // Copies a kc x nc block of B into width-wide row-major slivers,
+    // zero-padding the last sliver
+    template <typename T>
+    void
+    packB(size_t kc, size_t nc, const T* B, size_t rsb, size_t csb, T* buffer, size_t width)
+    {
+      for (size_t j = 0; j < nc; j += width)
+      {
+        size_t nr = std::min(width, nc - j);
+        for (size_t p = 0; p < kc; ++p)
+        {
+          const T* row = B + p * rsb + j * csb;
+          size_t jj = 0;
+          if (csb == 1)
+            for ( ; jj < nr; ++jj)
+              buffer[jj] = row[jj];
+          else
+            for ( ; jj < nr; ++jj)
+              buffer[jj] = row[jj * csb];
+          for ( ; jj < width; ++jj)
+            buffer[jj] = T(0);
+          buffer += width;
+        }
+      }
+    }
+
+    // Copies alpha times an mc x kc block of A into height-tall
+    // column-major slivers, zero-padding the last sliver
+    template <typename T>
+    void
+    packA(size_t mc, size_t kc, const T* A, size_t rsa, size_t csa, T* buffer, T alpha,
+          size_t height)
+    {
+      for (size_t i = 0; i < mc; i += height)
+      {
+        size_t mr = std::min(height, mc - i);
+        for (size_t p = 0; p < kc; ++p)
+        {
+          size_t ii = 0;
+          for ( ; ii < mr; ++ii)
+            buffer[ii] = alpha * A[(i + ii) * rsa + p * csa];
+          for ( ; ii < height; ++ii)
+            buffer[ii] = T(0);
+          buffer += height;
+        }
+      }
+    }
+
+    // Adds the mr x nr corner of a row-major tile with rows NR long to C
+    template <size_t NR, typename T>
+    void
+    addCorner(const T* tile, T* C, size_t ldc, size_t mr, size_t nr)
+    {
+      for (size_t i = 0; i < mr; ++i)
+        for (size_t j = 0; j < nr; ++j)
+          C[i * ldc + j] += tile[i * NR + j];
+    }
+
+    // MR x NR register block: accumulates kc rank-1 updates, then adds
+    // the mr x nr valid corner into C
+    template <typename T>
+    void
+    microKernel(size_t kc, const T* a, const T* b, T* C, size_t ldc,
+                size_t mr, size_t nr)
+    {
+      T acc[GEMM_MR][GEMM_NR] = {};
+      for (size_t p = 0; p < kc; ++p)
+      {
+        for (size_t i = 0; i < GEMM_MR; ++i)
+        {
+          T ai = a[i];
+          for (size_t j = 0; j < GEMM_NR; ++j)
+            acc[i][j] += ai * b[j];
+        }
+        a += GEMM_MR;
+        b += GEMM_NR;
+      }
+
+      if (mr == GEMM_MR && nr == GEMM_NR)
+      {
+        for (size_t i = 0; i < GEMM_MR; ++i)
+          for (size_t j = 0; j < GEMM_NR; ++j)
+            C[i * ldc + j] += acc[i][j];
+      }
+      else
+        addCorner<GEMM_NR>(&acc[0][0], C, ldc, mr, nr);
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    // The loops over tile rows are unrolled by pragma: GCC keeps an array
+    // of accumulators in registers only if every index is constant by the
+    // time it places the array.
+
+    // 6 x 8 doubles: 12 accumulators, two vectors of B and a broadcast
+    // of A in the 16 ymm registers
+    __attribute__((target("avx2,fma"))) void
+    microKernelAvx2(size_t kc, const double* a, const double* b, double* C, size_t ldc,
+                    size_t mr, size_t nr)
+    {
+      __m256d c[6][2];
+      #pragma GCC unroll 6
+      for (size_t i = 0; i < 6; ++i)
+        c[i][0] = c[i][1] = _mm256_setzero_pd();
+      for (size_t p = 0; p < kc; ++p)
+      {
+        __m256d b0 = _mm256_loadu_pd(b);
+        __m256d b1 = _mm256_loadu_pd(b + 4);
+        #pragma GCC unroll 6
+        for (size_t i = 0; i < 6; ++i)
+        {
+          __m256d ai = _mm256_broadcast_sd(a + i);
+          c[i][0] = _mm256_fmadd_pd(ai, b0, c[i][0]);
+          c[i][1] = _mm256_fmadd_pd(ai, b1, c[i][1]);
+        }
+        a += 6;
+        b += 8;
+      }
+
+      if (mr == 6 && nr == 8)
+      {
+        #pragma GCC unroll 6
+        for (size_t i = 0; i < 6; ++i)
+        {
+          double* ci = C + i * ldc;
+          _mm256_storeu_pd(ci, _mm256_add_pd(_mm256_loadu_pd(ci), c[i][0]));
+          _mm256_storeu_pd(ci + 4, _mm256_add_pd(_mm256_loadu_pd(ci + 4), c[i][1]));
+        }
+        return;
+      }
+
+      double tile[6 * 8];
+      #pragma GCC unroll 6
+      for (size_t i = 0; i < 6; ++i)
+      {
+        _mm256_storeu_pd(tile + i * 8, c[i][0]);
+        _mm256_storeu_pd(tile + i * 8 + 4, c[i][1]);
+      }
+      addCorner<8>(tile, C, ldc, mr, nr);
+    }
+
+    // 6 x 16 floats, laid out as the double kernel
+    __attribute__((target("avx2,fma"))) void
+    microKernelAvx2F(size_t kc, const float* a, const float* b, float* C, size_t ldc,
+                     size_t mr, size_t nr)
+    {
+      __m256 c[6][2];
+      #pragma GCC unroll 6
+      for (size_t i = 0; i < 6; ++i)
+        c[i][0] = c[i][1] = _mm256_setzero_ps();
+      for (size_t p = 0; p < kc; ++p)
+      {
+        __m256 b0 = _mm256_loadu_ps(b);
+        __m256 b1 = _mm256_loadu_ps(b + 8);
+        #pragma GCC unroll 6
+        for (size_t i = 0; i < 6; ++i)
+        {
+          __m256 ai = _mm256_broadcast_ss(a + i);
+          c[i][0] = _mm256_fmadd_ps(ai, b0, c[i][0]);
+          c[i][1] = _mm256_fmadd_ps(ai, b1, c[i][1]);
+        }
+        a += 6;
+        b += 16;
+      }
+
+      if (mr == 6 && nr == 16)
+      {
+        #pragma GCC unroll 6
+        for (size_t i = 0; i < 6; ++i)
+        {
+          float* ci = C + i * ldc;
+          _mm256_storeu_ps(ci, _mm256_add_ps(_mm256_loadu_ps(ci), c[i][0]));
+          _mm256_storeu_ps(ci + 8, _mm256_add_ps(_mm256_loadu_ps(ci + 8), c[i][1]));
+        }
+        return;
+      }
+
+      float tile[6 * 16];
+      #pragma GCC unroll 6
+      for (size_t i = 0; i < 6; ++i)
+      {
+        _mm256_storeu_ps(tile + i * 16, c[i][0]);
+        _mm256_storeu_ps(tile + i * 16 + 8, c[i][1]);
+      }
+      addCorner<16>(tile, C, ldc, mr, nr);
+    }
+
+    // 12 x 16 doubles: 24 accumulators, two vectors of B and a broadcast
+    // of A in the 32 zmm registers
+    __attribute__((target("avx512f"))) void
+    microKernelAvx512(size_t kc, const double* a, const double* b, double* C, size_t ldc,
+                      size_t mr, size_t nr)
+    {
+      __m512d c[12][2];
+      #pragma GCC unroll 12
+      for (size_t i = 0; i < 12; ++i)
+        c[i][0] = c[i][1] = _mm512_setzero_pd();
+      for (size_t p = 0; p < kc; ++p)
+      {
+        __m512d b0 = _mm512_loadu_pd(b);
+        __m512d b1 = _mm512_loadu_pd(b + 8);
+        #pragma GCC unroll 12
+        for (size_t i = 0; i < 12; ++i)
+        {
+          __m512d ai = _mm512_set1_pd(a[i]);
+          c[i][0] = _mm512_fmadd_pd(ai, b0, c[i][0]);
+          c[i][1] = _mm512_fmadd_pd(ai, b1, c[i][1]);
+        }
+        a += 12;
+        b += 16;
+      }
+
+      if (mr == 12 && nr == 16)
+      {
+        #pragma GCC unroll 12
+        for (size_t i = 0; i < 12; ++i)
+        {
+          double* ci = C + i * ldc;
+          _mm512_storeu_pd(ci, _mm512_add_pd(_mm512_loadu_pd(ci), c[i][0]));
+          _mm512_storeu_pd(ci + 8, _mm512_add_pd(_mm512_loadu_pd(ci + 8), c[i][1]));
+        }
+        return;
+      }
+
+      double tile[12 * 16];
+      #pragma GCC unroll 12
+      for (size_t i = 0; i < 12; ++i)
+      {
+        _mm512_storeu_pd(tile + i * 16, c[i][0]);
+        _mm512_storeu_pd(tile + i * 16 + 8, c[i][1]);
+      }
+      addCorner<16>(tile, C, ldc, mr, nr);
+    }
+
+    // 12 x 32 floats, laid out as the double kernel
+    __attribute__((target("avx512f"))) void
+    microKernelAvx512F(size_t kc, const float* a, const float* b, float* C, size_t ldc,
+                       size_t mr, size_t nr)
+    {
+      __m512 c[12][2];
+      #pragma GCC unroll 12
+      for (size_t i = 0; i < 12; ++i)
+        c[i][0] = c[i][1] = _mm512_setzero_ps();
+      for (size_t p = 0; p < kc; ++p)
+      {
+        __m512 b0 = _mm512_loadu_ps(b);
+        __m512 b1 = _mm512_loadu_ps(b + 16);
+        #pragma GCC unroll 12
+        for (size_t i = 0; i < 12; ++i)
+        {
+          __m512 ai = _mm512_set1_ps(a[i]);
+          c[i][0] = _mm512_fmadd_ps(ai, b0, c[i][0]);
+          c[i][1] = _mm512_fmadd_ps(ai, b1, c[i][1]);
+        }
+        a += 12;
+        b += 32;
+      }
+
+      if (mr == 12 && nr == 32)
+      {
+        #pragma GCC unroll 12
+        for (size_t i = 0; i < 12; ++i)
+        {
+          float* ci = C + i * ldc;
+          _mm512_storeu_ps(ci, _mm512_add_ps(_mm512_loadu_ps(ci), c[i][0]));
+          _mm512_storeu_ps(ci + 16, _mm512_add_ps(_mm512_loadu_ps(ci + 16), c[i][1]));
+        }
+        return;
+      }
+
+      float tile[12 * 32];
+      #pragma GCC unroll 12
+      for (size_t i = 0; i < 12; ++i)
+      {
+        _mm512_storeu_ps(tile + i * 32, c[i][0]);
+        _mm512_storeu_ps(tile + i * 32 + 16, c[i][1]);
+      }
+      addCorner<32>(tile, C, ldc, mr, nr);
+    }
+#endif
+
+    template <typename T>
+    struct gemm_kernel
+    {
+      // Register tile
+      size_t mr;
+      size_t nr;
+      // C += the product of an mr-tall packed sliver of A and an nr-wide
+      // packed sliver of B, both kc long, written to the valid corner
+      void (*multiply)(size_t kc, const T* a, const T* b, T* C, size_t ldc,
+                       size_t mr, size_t nr);
+    };
+
+    // Follows the element-wise kernel choice, so MATRIX_SIMD applies here
+    // too
+    template <typename T>
+    const gemm_kernel<T>&
+    gemmKernel()
+    {
+      static const gemm_kernel<T> kernel = [] {
+#if defined(__x86_64__) || defined(__i386__)
+        std::string level = simd<T>().name;
+        bool hasFma = __builtin_cpu_supports("fma");
+        if constexpr (std::is_same_v<T, double>)
+        {
+          if (level == "avx512")
+            return gemm_kernel<T> { 12, 16, microKernelAvx512 };
+          if (level == "avx2" && hasFma)
+            return gemm_kernel<T> { 6, 8, microKernelAvx2 };
+        }
+        else if constexpr (std::is_same_v<T, float>)
+        {
+          if (level == "avx512")
+            return gemm_kernel<T> { 12, 32, microKernelAvx512F };
+          if (level == "avx2" && hasFma)
+            return gemm_kernel<T> { 6, 16, microKernelAvx2F };
+        }
+#endif
+        return gemm_kernel<T> { GEMM_MR, GEMM_NR, microKernel<T> };
+      }();
+      return kernel;
+    }
+
+    // Multiplies a packed mc x kc block of A with a packed kc x nc panel
+    // of B into C
+    template <typename T>
+    void
+    macroKernel(const gemm_kernel<T>& kernel, size_t mc, size_t nc, size_t kc,
+                const T* packedA, const T* packedB, T* C, size_t ldc)
+    {
+      for (size_t j = 0; j < nc; j += kernel.nr)
+      {
+        size_t nr = std::min(kernel.nr, nc - j);
+        for (size_t i = 0; i < mc; i += kernel.mr)
+        {
+          size_t mr = std::min(kernel.mr, mc - i);
+          kernel.multiply(kc, packedA + i * kc, packedB + j * kc,
+                          C + i * ldc + j, ldc, mr, nr);
+        }
+      }
+    }
+
+    // Unpacked i-k-j loop for products too small to amortize packing
+    template <typename T>
+    void
+    gemmSmall(size_t M, size_t N, size_t K, const T* A, size_t rsa, size_t csa,
+              const T* B, size_t rsb, size_t csb, T* C, size_t ldc, T alpha)
+    {
+      for (size_t i = 0; i < M; ++i)
+        for (size_t k = 0; k < K; ++k)
+        {
+          T aik = alpha * A[i * rsa + k * csa];
+          const T* b = B + k * rsb;
+          T* c = C + i * ldc;
+          if (csb == 1)
+            for (size_t j = 0; j < N; ++j)
+              c[j] += aik * b[j];
+          else
+            for (size_t j = 0; j < N; ++j)
+              c[j] += aik * b[j * csb];
+        }
+    }
+
+    // Rounds n up to a multiple of step
+    inline size_t
+    roundUp(size_t n, size_t step)
+    {
+      return (n + step - 1) / step * step;
+    }
+
+    // Single-threaded C += alpha * A * B where A is M x K, B is K x N and
+    // C is M x N
+    template <typename T>
+    void
+    gemmSerial(size_t M, size_t N, size_t K, const T* A, size_t rsa, size_t csa,
+               const T* B, size_t rsb, size_t csb, T* C, size_t ldc, T alpha)
+    {
+      if (M == 0 || N == 0 || K == 0)
+        return;
+      if (M * N * K <= GEMM_SMALL)
+      {
+        gemmSmall(M, N, K, A, rsa, csa, B, rsb, csb, C, ldc, alpha);
+        return;
+      }
+
+      const gemm_kernel<T>& kernel = gemmKernel<T>();
+      // MC rounded down to whole slivers of A
+      size_t mcBlock = GEMM_MC / kernel.mr * kernel.mr;
+      thread_local std::vector<T> packedA;
+      thread_local std::vector<T> packedB;
+      size_t mcMax = std::min(mcBlock, roundUp(M, kernel.mr));
+      size_t ncMax = std::min(GEMM_NC, roundUp(N, kernel.nr));
+      size_t kcMax = std::min(GEMM_KC, K);
+      if (packedA.size() < mcMax * kcMax)
+        packedA.resize(mcMax * kcMax);
+      if (packedB.size() < kcMax * ncMax)
+        packedB.resize(kcMax * ncMax);
+
+      for (size_t jc = 0; jc < N; jc += GEMM_NC)
+      {
+        size_t nc = std::min(GEMM_NC, N - jc);
+        for (size_t pc = 0; pc < K; pc += GEMM_KC)
+        {
+          size_t kc = std::min(GEMM_KC, K - pc);
+          packB(kc, nc, B + pc * rsb + jc * csb, rsb, csb, packedB.data(), kernel.nr);
+          for (size_t ic = 0; ic < M; ic += mcBlock)
+          {
+            size_t mc = std::min(mcBlock, M - ic);
+            packA(mc, kc, A + ic * rsa + pc * csa, rsa, csa, packedA.data(), alpha, kernel.mr);
+            macroKernel(kernel, mc, nc, kc, packedA.data(), packedB.data(),
+                        C + ic * ldc + jc, ldc);
+          }
+        }
+      }
+    }
+
+    // C += alpha * A * B across the thread pool. Each KC x NC panel of B
+    // is packed once, by all threads, and shared; the panel's part of C
+    // is then split into independent tiles that pack their own block of
+    // A. Tiles are MC rows tall (narrower when there are fewer row blocks
+    // than threads) and wide enough to give each thread about four tiles,
+    // so uneven tiles still balance.
+    template <typename T>
+    void
+    gemmStrided(size_t M, size_t N, size_t K, const T* A, size_t rsa, size_t csa,
+                const T* B, size_t rsb, size_t csb, T* C, size_t ldc, T alpha)
+    {
+      thread_pool& pool = thread_pool::instance();
+      size_t threads = pool.size();
+      if (threads == 1 || M * N * K < GEMM_PARALLEL)
+      {
+        gemmSerial(M, N, K, A, rsa, csa, B, rsb, csb, C, ldc, alpha);
+        return;
+      }
+
+      const gemm_kernel<T>& kernel = gemmKernel<T>();
+      size_t tileM = GEMM_MC / kernel.mr * kernel.mr;
+      if ((M + tileM - 1) / tileM < threads)
+        tileM = roundUp((M + threads - 1) / threads, kernel.mr);
+      size_t rowTiles = (M + tileM - 1) / tileM;
+
+      size_t ncMax = std::min(GEMM_NC, roundUp(N, kernel.nr));
+      std::vector<T> packedB(std::min(GEMM_KC, K) * ncMax);
+      for (size_t jc = 0; jc < N; jc += GEMM_NC)
+      {
+        size_t nc = std::min(GEMM_NC, N - jc);
+        size_t slivers = (nc + kernel.nr - 1) / kernel.nr;
+        size_t colTiles = std::max<size_t>(1, (4 * threads + rowTiles - 1) / rowTiles);
+        colTiles = std::min(colTiles, slivers);
+        size_t tileN = roundUp((nc + colTiles - 1) / colTiles, kernel.nr);
+        colTiles = (nc + tileN - 1) / tileN;
+        size_t packWidth = (slivers + threads - 1) / threads * kernel.nr;
+
+        for (size_t pc = 0; pc < K; pc += GEMM_KC)
+        {
+          size_t kc = std::min(GEMM_KC, K - pc);
+          pool.parallelFor((nc + packWidth - 1) / packWidth, [&](size_t part) {
+            size_t j = part * packWidth;
+            packB(kc, std::min(packWidth, nc - j), B + pc * rsb + (jc + j) * csb, rsb, csb,
+                  packedB.data() + j * kc, kernel.nr);
+          });
+
+          pool.parallelFor(rowTiles * colTiles, [&](size_t tile) {
+            thread_local std::vector<T> packedA;
+            size_t i = (tile / colTiles) * tileM;
+            size_t j = (tile % colTiles) * tileN;
+            size_t mc = std::min(tileM, M - i);
+            if (packedA.size() < tileM * kc)
+              packedA.resize(tileM * kc);
+            packA(mc, kc, A + i * rsa + pc * csa, rsa, csa, packedA.data(), alpha, kernel.mr);
+            macroKernel(kernel, mc, std::min(tileN, nc - j), kc, packedA.data(),
+                        packedB.data() + j * kc, C + i * ldc + jc + j, ldc);
+          });
+        }
+      }
+    }
+
+    // C += alpha * A * B for row-major A, B and C
+    template <typename T>
+    void
+    gemm(size_t M, size_t N, size_t K, const T* A, size_t lda,
+         const T* B, size_t ldb, T* C, size_t ldc, T alpha = T(1))
+    {
+      gemmStrided(M, N, K, A, lda, size_t(1), B, ldb, size_t(1), C, ldc, alpha);
+    }
+  } // namespace detail
+
+  /**********************************************************************/
+  // Matrix-vector kernels
+  //
+  // Level-2 operations read every element of A once and do one or two
+  // flops with it, so they run at memory bandwidth, not at GEMM's compute
+  // rate. Packing would only add traffic. Each kernel walks A's rows
+  // contiguously and gives every thread its own rows. The transposed
+  // product sums rows, so each fixed block of rows sums into its own
+  // partial and the partials are added afterwards in block order.
+  // Outputs are caller-provided, so a loop that calls these allocates
+  // nothing unless it runs across the thread pool.
+  namespace detail
+  {
+    // Four running sums so the loop is not one long dependency chain
+    template <typename T>
+    T
+    dot(size_t n, const T* x, const T* y)
+    {
+      T s0 = T(0), s1 = T(0), s2 = T(0), s3 = T(0);
+      size_t i = 0;
+      for (; i + 4 <= n; i += 4)
+      {
+        s0 += x[i] * y[i];
+        s1 += x[i + 1] * y[i + 1];
+        s2 += x[i + 2] * y[i + 2];
+        s3 += x[i + 3] * y[i + 3];
+      }
+      for (; i < n; ++i)
+        s0 += x[i] * y[i];
+      return (s0 + s1) + (s2 + s3);
+    }
+
+    // Elements per partial sum of a parallel dot product, fixed so the
+    // result does not depend on the thread count
+    constexpr size_t DOT_BLOCK = 4096;
+
+    template <typename T>
+    T
+    parallelDot(size_t n, const T* x, const T* y)
+    {
+      if (n < ROW_PARALLEL || thread_pool::instance().size() == 1)
+        return dot(n, x, y);
+
+      size_t blocks = (n + DOT_BLOCK - 1) / DOT_BLOCK;
+      std::vector<T> partial(blocks);
+      forRowRanges(blocks, n, [&](size_t first, size_t last) {
+        for (size_t b = first; b < last; ++b)
+        {
+          size_t start = b * DOT_BLOCK;
+          partial[b] = dot(std::min(DOT_BLOCK, n - start), x + start, y + start);
+        }
+      });
+
+      T sum = 0;
+      for (T p : partial)
+        sum += p;
+      return sum;
+    }
+
+    // y = alpha A x + beta y for M x N row-major A
+    template <typename T>
+    void
+    gemv(size_t M, size_t N, const T* A, size_t lda, const T* x, T* y, T alpha, T beta)
+    {
+      forRowRanges(M, M * N, [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; ++i)
+        {
+          T sum = alpha * dot(N, A + i * lda, x);
+          y[i] = beta == T(0) ? sum : sum + beta * y[i];
+        }
+      });
+    }
+
+    // Rows per partial sum of a transposed product, fixed like DOT_BLOCK
+    // so the result does not depend on the thread count
+    constexpr size_t GEMV_BLOCK = 256;
+
+    // y = alpha A^T x + beta y for M x N row-major A. Each block of rows
+    // sums into its own partial, and the partials are added into y in
+    // block order, whether the blocks run serially or across threads.
+    template <typename T>
+    void
+    gemvTransposed(size_t M, size_t N, const T* A, size_t lda, const T* x, T* y, T alpha, T beta)
+    {
+      if (beta == T(0))
+        std::fill_n(y, N, T(0));
+      else if (beta != T(1))
+        simd<T>().scale(N, y, beta);
+
+      size_t blocks = (M + GEMV_BLOCK - 1) / GEMV_BLOCK;
+      auto sumBlock = [&](size_t b, T* part) {
+        std::fill_n(part, N, T(0));
+        for (size_t i = b * GEMV_BLOCK; i < std::min(M, (b + 1) * GEMV_BLOCK); ++i)
+          simd<T>().axpy(N, part, A + i * lda, alpha * x[i], false);
+      };
+
+      if (M * N < ROW_PARALLEL || thread_pool::instance().size() == 1 || blocks == 1)
+      {
+        // Reused across calls, so loops over small products do not
+        // allocate
+        thread_local std::vector<T> part;
+        if (part.size() < N)
+          part.resize(N);
+        for (size_t b = 0; b < blocks; ++b)
+        {
+          sumBlock(b, part.data());
+          simd<T>().axpy(N, y, part.data(), T(1), false);
+        }
+        return;
+      }
+
+      std::vector<T> partial(blocks * N);
+      forRowRanges(blocks, M * N, [&](size_t first, size_t last) {
+        for (size_t b = first; b < last; ++b)
+          sumBlock(b, partial.data() + b * N);
+      });
+      for (size_t b = 0; b < blocks; ++b)
+        simd<T>().axpy(N, y, partial.data() + b * N, T(1), false);
+    }
+
+    // A += alpha x y^T for M x N row-major A
+    template <typename T>
+    void
+    ger(size_t M, size_t N, T* A, size_t lda, const T* x, const T* y, T alpha)
+    {
+      forRowRanges(M, M * N, [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; ++i)
+          simd<T>().axpy(N, A + i * lda, y, alpha * x[i], false);
+      });
+    }
+
+    // y += alpha x
+    template <typename T>
+    void
+    axpy(size_t n, T alpha, const T* x, T* y)
+    {
+      forRowRanges(n, n, [&](size_t first, size_t last) {
+        simd<T>().axpy(last - first, y + first, x + first, alpha, false);
+      });
+    }
+  } // namespace detail
+
+  /**********************************************************************/
+  // Strassen-Winograd multiplication
+  //
+  // Winograd's form of Strassen's recursion does a product of halves
+  // with 7 multiplications and 15 additions instead of 8 and 4, so n x n
+  // costs O(n^2.81). It is opt-in: setStrassenCrossover(n) sends matrix
+  // products whose dimensions are all at least n through it, and each
+  // level recurses until a dimension falls below n, where the blocked
+  // GEMM above takes over. Odd dimensions are peeled: the even part
+  // recurses and the last row, column or rank-1 term is a GEMM.
+  // Rectangular shapes halve every dimension alike. The scratch for
+  // every level is sized up front and allocated once per product; the
+  // levels below share what their parent leaves free, since the seven
+  // products run one after another (each one spread across the thread
+  // pool by GEMM).
+  //
+  // Accuracy: the error bound is normwise only,
+  //   |C - C'| <= c (n / n0)^log2(18) eps |A| |B|
+  // with n0 the crossover, against n eps |A| |B| elementwise for the
+  // conventional product. Results are not bit-identical to operator*
+  // with it off, and entries of C much smaller than |A| |B| can lose
+  // most of their digits. The bound grows with every level, so keep the
+  // crossover large; the factorizations in this file always
+  // use the conventional kernel.
+  namespace detail
+  {
+    // Crossover used when Strassen is turned on without one
+    constexpr size_t STRASSEN_CROSSOVER = 512;
+
+    // 0 while products use the conventional kernel only
+    inline size_t g_strassenCrossover = 0;
+
+    // X = Y + Z, or Y - Z, for rows x cols blocks; X may be Y or Z
+    template <typename T>
+    void
+    combineBlocks(size_t rows, size_t cols, T* X, size_t ldx, const T* Y, size_t ldy,
+                  const T* Z, size_t ldz, bool subtract)
+    {
+      for (size_t i = 0; i < rows; ++i)
+      {
+        T* x = X + i * ldx;
+        const T* y = Y + i * ldy;
+        const T* z = Z + i * ldz;
+        if (x == z)
+        {
+          // x = y - x as -(x - y)
+          if (subtract)
+          {
+            simd<T>().sub(cols, x, y);
+            simd<T>().scale(cols, x, T(-1));
+          }
+          else
+            simd<T>().add(cols, x, y);
+          continue;
+        }
+
+        if (x != y)
+          std::copy_n(y, cols, x);
+        if (subtract)
+          simd<T>().sub(cols, x, z);
+        else
+          simd<T>().add(cols, x, z);
+      }
+    }
+
+    // Elements of scratch a Strassen product of this shape needs
+    inline size_t
+    strassenWorkspace(size_t M, size_t N, size_t K, size_t crossover)
+    {
+      if (std::min({ M, N, K }) < std::max<size_t>(crossover, 2))
+        return 0;
+      size_t m = M / 2, n = N / 2, k = K / 2;
+      return m * k + k * n + m * n + strassenWorkspace(m, n, k, crossover);
+    }
+
+    // C = A * B, overwriting C, by Strassen-Winograd down to crossover
+    template <typename T>
+    void
+    strassen(size_t M, size_t N, size_t K, const T* A, size_t lda, const T* B, size_t ldb,
+             T* C, size_t ldc, size_t crossover, T* work)
+    {
+      if (std::min({ M, N, K }) < std::max<size_t>(crossover, 2))
+      {
+        for (size_t i = 0; i < M; ++i)
+          std::fill_n(C + i * ldc, N, T(0));
+        gemm(M, N, K, A, lda, B, ldb, C, ldc);
+        return;
+      }
+
+      size_t m = M / 2, n = N / 2, k = K / 2;
+      const T *A11 = A, *A12 = A + k, *A21 = A + m * lda, *A22 = A21 + k;
+      const T *B11 = B, *B12 = B + n, *B21 = B + k * ldb, *B22 = B21 + n;
+      T *C11 = C, *C12 = C + n, *C21 = C + m * ldc, *C22 = C21 + n;
+      T* S = work;
+      T* U = S + m * k;
+      T* X = U + k * n;
+      T* rest = X + m * n;
+
+      // The schedule of Douglas et al.'s DGEFMM: the seven products
+      // land in C's quadrants and X, so one level needs just S, U and X
+      combineBlocks(m, k, S, k, A11, lda, A21, lda, true);
+      combineBlocks(k, n, U, n, B22, ldb, B12, ldb, true);
+      strassen(m, n, k, S, k, U, n, C21, ldc, crossover, rest);
+      combineBlocks(m, k, S, k, A21, lda, A22, lda, false);
+      combineBlocks(k, n, U, n, B12, ldb, B11, ldb, true);
+      strassen(m, n, k, S, k, U, n, C22, ldc, crossover, rest);
+      combineBlocks(m, k, S, k, S, k, A11, lda, true);
+      combineBlocks(k, n, U, n, B22, ldb, U, n, true);
+      strassen(m, n, k, S, k, U, n, C12, ldc, crossover, rest);
+      combineBlocks(m, k, S, k, A12, lda, S, k, true);
+      strassen(m, n, k, S, k, B22, ldb, C11, ldc, crossover, rest);
+      strassen(m, n, k, A11, lda, B11, ldb, X, n, crossover, rest);
+
+      combineBlocks(m, n, C12, ldc, C12, ldc, X, n, false);
+      combineBlocks(m, n, C21, ldc, C21, ldc, C12, ldc, false);
+      combineBlocks(m, n, C12, ldc, C12, ldc, C22, ldc, false);
+      combineBlocks(m, n, C22, ldc, C22, ldc, C21, ldc, false);
+      combineBlocks(m, n, C12, ldc, C12, ldc, C11, ldc, false);
+      combineBlocks(k, n, U, n, U, n, B21, ldb, true);
+      strassen(m, n, k, A22, lda, U, n, C11, ldc, crossover, rest);
+      combineBlocks(m, n, C21, ldc, C21, ldc, C11, ldc, true);
+      strassen(m, n, k, A12, lda, B21, ldb, C11, ldc, crossover, rest);
+      combineBlocks(m, n, C11, ldc, C11, ldc, X, n, false);
+
+      // Peeled odd row, column and inner index
+      if (K > 2 * k)
+        gemmStrided(2 * m, 2 * n, size_t(1), A + 2 * k, lda, size_t(1), B + 2 * k * ldb, ldb, size_t(1),
+                    C, ldc, T(1));
+      if (N > 2 * n)
+      {
+        for (size_t i = 0; i < 2 * m; ++i)
+          C[i * ldc + 2 * n] = T(0);
+        gemm(2 * m, size_t(1), K, A, lda, B + 2 * n, ldb, C + 2 * n, ldc);
+      }
+      if (M > 2 * m)
+      {
+        std::fill_n(C + 2 * m * ldc, N, T(0));
+        gemm(size_t(1), N, K, A + 2 * m * lda, lda, B, ldb, C + 2 * m * ldc, ldc);
+      }
+    }
+
+    // C = A * B, overwriting C. A single-column B or single-row A goes
+    // to the matrix-vector kernels; otherwise Strassen-Winograd when it
+    // is on and the product is large enough, else the conventional GEMM.
+    template <typename T>
+    void
+    product(size_t M, size_t N, size_t K, const T* A, size_t lda, const T* B, size_t ldb,
+            T* C, size_t ldc, size_t crossover = g_strassenCrossover)
+    {
+      if (N == 1 && ldb == 1 && ldc == 1 && K > 0)
+      {
+        gemv(M, K, A, lda, B, C, T(1), T(0));
+        return;
+      }
+      if (M == 1 && K > 0)
+      {
+        gemvTransposed(K, N, B, ldb, A, C, T(1), T(0));
+        return;
+      }
+
+      if (crossover == 0 || std::min({ M, N, K }) < std::max<size_t>(crossover, 2))
+      {
+        for (size_t i = 0; i < M; ++i)
+          std::fill_n(C + i * ldc, N, T(0));
+        gemm(M, N, K, A, lda, B, ldb, C, ldc);
+        return;
+      }
+
+      std::vector<T> work(strassenWorkspace(M, N, K, crossover));
+      strassen(M, N, K, A, lda, B, ldb, C, ldc, crossover, work.data());
+    }
+  } // namespace detail
+
+  // Matrix products with every dimension at least crossover go through
+  // Strassen-Winograd (see above for the accuracy cost). It is off until
+  // this is called; 0 turns it off again.
+  void
+  setStrassenCrossover(size_t crossover = detail::STRASSEN_CROSSOVER)
+  {
+    detail::g_strassenCrossover = crossover;
+  }
+
+  size_t
+  strassenCrossover()
+  {
+    return detail::g_strassenCrossover;
+  }
+
+  /**********************************************************************/
+  // Transpose kernels
+  //
+  // A plain transpose reads rows and writes columns, so one side of the
+  // copy strides through memory and misses cache and TLB on every
+  // element once a matrix outgrows them. Here the larger dimension is
+  // halved recursively until a tile fits in L1 on both sides, which
+  // keeps the access pattern cache-friendly at every level without
+  // tuning, and each tile goes through the SIMD micro-transposes. Square
+  // matrices transpose in place by swapping tiles across the diagonal;
+  // rectangular ones follow the cycles of the index permutation, which
+  // needs one bit per element instead of a second buffer.
+  namespace detail
+  {
+    constexpr size_t TRANSPOSE_TILE = 32;
+
+    // Below this many elements waking the thread pool costs more than
+    // it saves
+    constexpr size_t TRANSPOSE_PARALLEL = 1 << 20;
+
+    // Source rows handed to one thread at a time
+    constexpr size_t TRANSPOSE_BAND = 256;
+
+    template <typename T>
+    void
+    transposeRecursive(size_t rows, size_t cols, const T* src, size_t lds, T* dst, size_t ldd)
+    {
+      if (rows <= TRANSPOSE_TILE && cols <= TRANSPOSE_TILE)
+      {
+        simd<T>().transpose(rows, cols, src, lds, dst, ldd);
+        return;
+      }
+
+      // Splits stay multiples of 8 so micro-tiles never straddle them
+      if (rows >= cols)
+      {
+        size_t half = (rows / 2 + 7) & ~size_t(7);
+        transposeRecursive(half, cols, src, lds, dst, ldd);
+        transposeRecursive(rows - half, cols, src + half * lds, lds, dst + half, ldd);
+      }
+      else
+      {
+        size_t half = (cols / 2 + 7) & ~size_t(7);
+        transposeRecursive(rows, half, src, lds, dst, ldd);
+        transposeRecursive(rows, cols - half, src + half, lds, dst + half * ldd, ldd);
+      }
+    }
+
+    // dst = src^T for a rows x cols src, split into bands of source rows
+    // across the thread pool when large
+    template <typename T>
+    void
+    transposeStrided(size_t rows, size_t cols, const T* src, size_t lds, T* dst, size_t ldd)
+    {
+      if (rows * cols < TRANSPOSE_PARALLEL)
+      {
+        transposeRecursive(rows, cols, src, lds, dst, ldd);
+        return;
+      }
+
+      thread_pool::instance().parallelFor((rows + TRANSPOSE_BAND - 1) / TRANSPOSE_BAND,
+        [&](size_t band) {
+          size_t first = band * TRANSPOSE_BAND;
+          transposeRecursive(std::min(TRANSPOSE_BAND, rows - first), cols,
+                             src + first * lds, lds, dst + first, ldd);
+        });
+    }
+
+    // Swaps each off-diagonal tile with the transpose of its mirror
+    // through a stack buffer, and transposes diagonal tiles by swaps
+    template <typename T>
+    void
+    transposeSquareInPlace(size_t n, T* A)
+    {
+      size_t tiles = (n + TRANSPOSE_TILE - 1) / TRANSPOSE_TILE;
+      auto tileRow = [&](size_t ti) {
+        size_t i = ti * TRANSPOSE_TILE;
+        size_t h = std::min(TRANSPOSE_TILE, n - i);
+        for (size_t r = i; r < i + h; ++r)
+          for (size_t c = r + 1; c < i + h; ++c)
+            std::swap(A[r * n + c], A[c * n + r]);
+
+        T buffer[TRANSPOSE_TILE * TRANSPOSE_TILE];
+        for (size_t j = i + TRANSPOSE_TILE; j < n; j += TRANSPOSE_TILE)
+        {
+          size_t w = std::min(TRANSPOSE_TILE, n - j);
+          T* upper = A + i * n + j;
+          T* lower = A + j * n + i;
+          simd<T>().transpose(h, w, upper, n, buffer, TRANSPOSE_TILE);
+          simd<T>().transpose(w, h, lower, n, upper, n);
+          for (size_t r = 0; r < w; ++r)
+            std::copy(buffer + r * TRANSPOSE_TILE, buffer + r * TRANSPOSE_TILE + h, lower + r * n);
+        }
+      };
+
+      if (n * n < TRANSPOSE_PARALLEL)
+        for (size_t ti = 0; ti < tiles; ++ti)
+          tileRow(ti);
+      else
+        thread_pool::instance().parallelFor(tiles, tileRow);
+    }
+
+    // Element (i, j) of a rows x cols matrix moves to (j, i) of the
+    // cols x rows result, i.e. linear index i * cols + j goes to
+    // j * rows + i. Every cycle of that permutation is rotated once.
+    template <typename T>
+    void
+    transposeCycles(size_t rows, size_t cols, T* A)
+    {
+      size_t n = rows * cols;
+      std::vector<bool> moved(n);
+      for (size_t start = 1; start + 1 < n; ++start)
+      {
+        if (moved[start])
+          continue;
+
+        T carry = A[start];
+        size_t k = start;
+        do
+        {
+          size_t next = (k % cols) * rows + k / cols;
+          std::swap(carry, A[next]);
+          moved[next] = true;
+          k = next;
+        } while (k != start);
+      }
+    }
+  } // namespace detail
+
+  /**********************************************************************/
+  // Storage
+  //
+  // Matrix buffers come from a std::pmr::memory_resource, 64-byte
+  // aligned so rows start on a cache line and a full AVX-512 vector. By
+  // default that is the library's size-class pool: freed buffers are
+  // kept on per-class free lists (four classes per power of two, so at
+  // most a quarter of a block is padding) and handed back out to the
+  // next matrix of a similar size, which keeps steady-state workloads
+  // like the interpreter's temporaries off malloc entirely. Any other
+  // resource, such as a std::pmr::monotonic_buffer_resource arena, can
+  // be plugged in per matrix or as the default.
+  namespace detail
+  {
+    constexpr size_t STORAGE_ALIGNMENT = 64;
+
+    class pool_resource : public std::pmr::memory_resource
+    {
+    public:
+      // Free blocks beyond this many bytes go back to the system
+      static constexpr size_t POOL_LIMIT = size_t(1) << 30;
+
+      ~pool_resource()
+      {
+        release();
+      }
+
+      // Returns every cached block to the system
+      void
+      release()
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (size_t index = 0; index < CLASSES; ++index)
+        {
+          for (void* block : m_free[index])
+            ::operator delete(block, std::align_val_t(STORAGE_ALIGNMENT));
+          m_free[index].clear();
+        }
+        m_cached = 0;
+      }
+
+      size_t
+      cachedBytes()
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_cached;
+      }
+
+    protected:
+      void*
+      do_allocate(size_t bytes, size_t alignment) override
+      {
+        if (alignment > STORAGE_ALIGNMENT)
+          return ::operator new(bytes, std::align_val_t(alignment));
+
+        size_t classBytes;
+        size_t index = sizeClass(bytes, classBytes);
+        {
+          std::lock_guard<std::mutex> lock(m_mutex);
+          if (!m_free[index].empty())
+          {
+            void* block = m_free[index].back();
+            m_free[index].pop_back();
+            m_cached -= classBytes;
+            return block;
+          }
+        }
+
+        return ::operator new(classBytes, std::align_val_t(STORAGE_ALIGNMENT));
+      }
+
+      void
+      do_deallocate(void* block, size_t bytes, size_t alignment) override
+      {
+        if (alignment > STORAGE_ALIGNMENT)
+        {
+          ::operator delete(block, std::align_val_t(alignment));
+          return;
+        }
+
+        size_t classBytes;
+        size_t index = sizeClass(bytes, classBytes);
+        {
+          std::lock_guard<std::mutex> lock(m_mutex);
+          if (m_cached + classBytes <= POOL_LIMIT)
+          {
+            m_free[index].push_back(block);
+            m_cached += classBytes;
+            return;
+          }
+        }
+
+        ::operator delete(block, std::align_val_t(STORAGE_ALIGNMENT));
+      }
+
+      bool
+      do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+      {
+        return this == &other;
+      }
+
+    private:
+      static constexpr size_t CLASSES = 4 * 64;
+
+      std::vector<void*> m_free[CLASSES];
+      std::mutex m_mutex;
+      size_t m_cached = 0;
+
+      // Rounds bytes in (2^k, 2^(k + 1)] up to the next multiple of
+      // 2^(k - 2) and returns that class's free-list index
+      static size_t
+      sizeClass(size_t bytes, size_t& classBytes)
+      {
+        if (bytes <= STORAGE_ALIGNMENT)
+        {
+          classBytes = STORAGE_ALIGNMENT;
+          return 0;
+        }
+
+        int k = std::numeric_limits<unsigned long long>::digits - 1 - __builtin_clzll(bytes - 1);
+        size_t step = size_t(1) << (k - 2);
+        classBytes = (bytes + step - 1) / step * step;
+        return (k - 6) * 4 + (classBytes / step - 5) + 1;
+      }
+    };
+
+    inline std::pmr::memory_resource* g_defaultStorage = nullptr;
+  } // namespace detail
+
+  // The library's pool. It is never destroyed, so matrices with static
+  // storage duration can still hand their buffers back during exit.
+  detail::pool_resource*
+  poolStorage()
+  {
+    static detail::pool_resource* pool = new detail::pool_resource;
+    return pool;
+  }
+
+  // Resource used by matrices constructed without one
+  std::pmr::memory_resource*
+  defaultStorage()
+  {
+    if (detail::g_defaultStorage == nullptr)
+      return poolStorage();
+    return detail::g_defaultStorage;
+  }
+
+  // Passing nullptr restores the pool
+  void
+  setDefaultStorage(std::pmr::memory_resource* storage)
+  {
+    detail::g_defaultStorage = storage;
+  }
+
+  // Returns the pool's cached blocks to the system
+  void
+  releaseStorage()
+  {
+    poolStorage()->release();
+  }
+
+  /**********************************************************************/
+  // Expression templates
+  //
+  // +, -, unary minus and scalar * on matrices build a lightweight tree
+  // of nodes instead of a temporary matrix per operator. The tree is
+  // evaluated element by element in a single loop when it is assigned to
+  // (or used to construct) a matrix, so A + B - 2 * C reads each operand
+  // once and writes the result once. Lvalue operands are held by
+  // reference and temporaries by value, so a tree never outlives what it
+  // refers to within one full expression.
+  template <typename T>
+  class basic_matrix;
+
+  template <typename T>
+  class basic_matrix_view;
+
+  template <typename E>
+  class expr
+  {
+  public:
+    const E&
+    self() const
+    {
+      return static_cast<const E&>(*this);
+    }
+  };
+
+  namespace detail
+  {
+    template <typename T>
+    using is_expr = std::is_base_of<expr<std::decay_t<T>>, std::decay_t<T>>;
+
+    template <typename T>
+    using expr_operand = std::conditional_t<std::is_lvalue_reference<T>::value,
+                                            const std::decay_t<T>&,
+                                            std::decay_t<T>>;
+
+    // Leaves (matrices) always have a consistent shape; nodes check
+    // their children
+    template <typename T>
+    bool
+    exprValid(const basic_matrix<T>&)
+    {
+      return true;
+    }
+
+    template <typename E>
+    bool
+    exprValid(const E& e)
+    {
+      return e.valid();
+    }
+
+    template <typename T>
+    T
+    exprFallback(const basic_matrix<T>& A, size_t i);
+
+    template <typename E>
+    typename E::value_type
+    exprFallback(const E& e, size_t i)
+    {
+      return e.fallback(i);
+    }
+
+    struct add_op
+    {
+      template <typename T>
+      static T
+      apply(T a, T b)
+      {
+        return a + b;
+      }
+    };
+
+    struct sub_op
+    {
+      template <typename T>
+      static T
+      apply(T a, T b)
+      {
+        return a - b;
+      }
+    };
+  } // namespace detail
+
+  // Element-wise L op R. Operands of different shapes evaluate to L, as
+  // the in-place operators leave the left matrix unchanged in that case.
+  template <typename L, typename R, typename Op>
+  class binary_expr : public expr<binary_expr<L, R, Op>>
+  {
+  public:
+    using value_type = typename std::decay_t<L>::value_type;
+
+    static_assert(std::is_same_v<value_type, typename std::decay_t<R>::value_type>,
+                  "Operands must share an element type");
+
+    template <typename A, typename B>
+    binary_expr(A&& lhs, B&& rhs)
+      : m_lhs(std::forward<A>(lhs)),
+        m_rhs(std::forward<B>(rhs))
+    {
+    }
+
+    size_t
+    rows() const
+    {
+      return m_lhs.rows();
+    }
+
+    size_t
+    cols() const
+    {
+      return m_lhs.cols();
+    }
+
+    bool
+    compatible() const
+    {
+      return m_lhs.rows() == m_rhs.rows() && m_lhs.cols() == m_rhs.cols();
+    }
+
+    bool
+    valid() const
+    {
+      return compatible() && detail::exprValid(m_lhs) && detail::exprValid(m_rhs);
+    }
+
+    value_type
+    operator[](size_t i) const
+    {
+      return Op::apply(m_lhs[i], m_rhs[i]);
+    }
+
+    value_type
+    fallback(size_t i) const
+    {
+      if (!compatible())
+        return detail::exprFallback(m_lhs, i);
+      return Op::apply(detail::exprFallback(m_lhs, i), detail::exprFallback(m_rhs, i));
+    }
+
+  private:
+    L m_lhs;
+    R m_rhs;
+  };
+
+  // k * E. Adding zero turns the -0 that k < 0 produces from a zero
+  // element back into 0, matching scalar operator*=, which leaves zeros
+  // untouched.
+  template <typename E>
+  class scaled_expr : public expr<scaled_expr<E>>
+  {
+  public:
+    using value_type = typename std::decay_t<E>::value_type;
+
+    template <typename A>
+    scaled_expr(A&& operand, value_type k)
+      : m_operand(std::forward<A>(operand)),
+        m_k(k)
+    {
+    }
+
+    size_t
+    rows() const
+    {
+      return m_operand.rows();
+    }
+
+    size_t
+    cols() const
+    {
+      return m_operand.cols();
+    }
+
+    bool
+    valid() const
+    {
+      return detail::exprValid(m_operand);
+    }
+
+    value_type
+    operator[](size_t i) const
+    {
+      return m_operand[i] * m_k + value_type(0);
+    }
+
+    value_type
+    fallback(size_t i) const
+    {
+      return detail::exprFallback(m_operand, i) * m_k + value_type(0);
+    }
+
+  private:
+    E m_operand;
+    value_type m_k;
+  };
+
+  // C = A * B, reusing C's buffer when it already has the product's shape
+  template <typename T>
+  void
+  multiply(const basic_matrix<T>& A, const basic_matrix<T>& B, basic_matrix<T>& C);
+
+  template <typename T>
+  class basic_matrix : public expr<basic_matrix<T>>
+  {
+  public:
+    // type aliases
+    using value_type = T;
+    using iterator = T*;
+    using const_iterator = const T*;
+
+    // default ctor
+    basic_matrix()
+      : m_rows(0),
+        m_cols(0),
+        m_size(0),
+        m_storage(defaultStorage()),
+        m_matrix(nullptr)
+    {
+    }
+
+    // size ctor
+    basic_matrix(size_t rows, size_t cols)
+      : m_rows(rows),
+        m_cols(cols),
+        m_size(rows * cols),
+        m_storage(defaultStorage()),
+        m_matrix(allocate(m_size))
+    {
+    }
+
+    // size ctor
+    basic_matrix(size_t rows, size_t cols, T init)
+      : basic_matrix(rows, cols)
+    {
+      detail::simd<T>().fill(m_size, m_matrix, init);
+    }
+
+    // size ctor with explicit storage
+    basic_matrix(std::allocator_arg_t, std::pmr::memory_resource* storage,
+           size_t rows, size_t cols)
+      : m_rows(rows),
+        m_cols(cols),
+        m_size(rows * cols),
+        m_storage(storage),
+        m_matrix(allocate(m_size))
+    {
+    }
+
+    // size ctor with explicit storage
+    basic_matrix(std::allocator_arg_t, std::pmr::memory_resource* storage,
+           size_t rows, size_t cols, T init)
+      : basic_matrix(std::allocator_arg, storage, rows, cols)
+    {
+      detail::simd<T>().fill(m_size, m_matrix, init);
+    }
+
+    // copy ctor, which like the std::pmr containers draws from the
+    // default storage rather than the source's
+    basic_matrix(const basic_matrix& m)
+      : m_rows(m.rows()),
+        m_cols(m.cols()),
+        m_size(m.size()),
+        m_storage(defaultStorage()),
+        m_matrix(allocate(m_size))
+    {
+      if (this != &m)
+        std::copy(m.begin(), m.end(), begin());
+    }
+
+    // expression ctor
+    template <typename E>
+    basic_matrix(const expr<E>& e)
+      : m_rows(e.self().rows()),
+        m_cols(e.self().cols()),
+        m_size(m_rows * m_cols),
+        m_storage(defaultStorage()),
+        m_matrix(allocate(m_size))
+    {
+      assign(e.self());
+    }
+
+    // move ctor
+    basic_matrix(basic_matrix&& m) noexcept
+      : m_rows(m.m_rows),
+        m_cols(m.m_cols),
+        m_size(m.m_size),
+        m_storage(m.m_storage),
+        m_matrix(m.m_matrix)
+    {
+      m.m_rows = 0;
+      m.m_cols = 0;
+      m.m_size = 0;
+      m.m_matrix = nullptr;
+    }
+
+    // dtor
+    ~basic_matrix()
+    {
+      deallocate();
+    }
+
+    // Reuses the current buffer when it already holds m.size() elements
+    basic_matrix&
+    operator=(const basic_matrix& m)
+    {
+      if (this != &m)
+      {
+        if (m_size != m.size())
+        {
+          deallocate();
+          m_matrix = allocate(m.size());
+        }
+
+        std::copy(m.begin(), m.end(), begin());
+        m_size = m.size();
+        m_rows = m.rows();
+        m_cols = m.cols();
+      }
+
+      return *this;
+    }
+
+    basic_matrix&
+    operator=(basic_matrix&& m) noexcept
+    {
+      if (this != &m)
+      {
+        basic_matrix moved(std::move(m));
+        swap(moved);
+      }
+
+      return *this;
+    }
+
+    template <typename E>
+    basic_matrix&
+    operator=(const expr<E>& e)
+    {
+      // Element-wise expressions may safely alias *this, but only while
+      // its buffer stays in place
+      if (e.self().rows() != m_rows || e.self().cols() != m_cols)
+      {
+        basic_matrix result(e);
+        swap(result);
+      }
+      else
+        assign(e.self());
+
+      return *this;
+    }
+
+    void
+    swap(basic_matrix& other) noexcept
+    {
+      std::swap(m_rows, other.m_rows);
+      std::swap(m_cols, other.m_cols);
+      std::swap(m_size, other.m_size);
+      std::swap(m_storage, other.m_storage);
+      std::swap(m_matrix, other.m_matrix);
+    }
+
+    std::pmr::memory_resource*
+    storage() const
+    {
+      return m_storage;
+    }
+
+    size_t
+    rows()
+    {
+      return m_rows;
+    }
+
+    size_t
+    rows() const
+    {
+      return m_rows;
+    }
+
+    size_t
+    cols()
+    {
+      return m_cols;
+    }
+
+    size_t
+    cols() const
+    {
+      return m_cols;
+    }
+
+    size_t
+    size()
+    {
+      return m_size;
+    }
+
+    size_t
+    size() const
+    {
+      return m_size;
+    }
+
+    iterator
+    begin()
+    {
+      return m_matrix;
+    }
+
+    const_iterator
+    begin() const
+    {
+      return m_matrix;
+    }
+
+    iterator
+    end()
+    {
+      return m_matrix + m_size;
+    }
+
+    const_iterator
+    end() const
+    {
+      return m_matrix + m_size;
+    }
+
+    void
+    swapRows(size_t r1, size_t r2)
+    {
+      if (r1 >= m_rows || r2 >= m_rows)
+        return;			 
+      for (size_t j = 0; j < m_cols; ++j)
+        std::swap((*this)(r1, j), (*this)(r2, j));
+    }
+
+    // Adds scalar * r1 to r2, changing the values in r2
+    void
+    addRows(size_t r1, size_t r2, T scalar = 1)
+    {
+      if (r1 >= m_rows || r2 >= m_rows)
+        return;
+      detail::simd<T>().axpy(m_cols, &(*this)(r2, 0), &(*this)(r1, 0), scalar,
+                             detail::g_snapToZero);
+    }
+
+    void 
+    multiplyRow(size_t r, T scalar)
+    {
+      if (r >= m_rows)
+        return;
+      detail::simd<T>().scale(m_cols, &(*this)(r, 0), scalar);
+    }
+    
+    void
+    zero()
+    {
+      detail::simd<T>().fill(m_size, m_matrix, T(0));
+    }
+
+    // Transposes without a second buffer: square matrices swap tiles
+    // across the diagonal, other shapes follow the permutation's cycles
+    void
+    transposeInPlace()
+    {
+      if (m_rows == m_cols)
+        detail::transposeSquareInPlace(m_rows, m_matrix);
+      else if (m_rows > 1 && m_cols > 1)
+        detail::transposeCycles(m_rows, m_cols, m_matrix);
+      std::swap(m_rows, m_cols);
+    }
+
+    // Views of the whole matrix or part of it; they share this buffer
+    basic_matrix_view<T>
+    view()
+    {
+      return *this;
+    }
+
+    basic_matrix_view<const T>
+    view() const
+    {
+      return *this;
+    }
+
+    basic_matrix_view<T>
+    block(size_t row, size_t col, size_t rows, size_t cols)
+    {
+      return view().block(row, col, rows, cols);
+    }
+
+    basic_matrix_view<const T>
+    block(size_t row, size_t col, size_t rows, size_t cols) const
+    {
+      return view().block(row, col, rows, cols);
+    }
+
+    basic_matrix_view<T>
+    row(size_t r)
+    {
+      return view().row(r);
+    }
+
+    basic_matrix_view<const T>
+    row(size_t r) const
+    {
+      return view().row(r);
+    }
+
+    basic_matrix_view<T>
+    col(size_t c)
+    {
+      return view().col(c);
+    }
+
+    basic_matrix_view<const T>
+    col(size_t c) const
+    {
+      return view().col(c);
+    }
+
+    T&
+    operator()(const size_t& row, const size_t& col)
+    {
+      return m_matrix[(m_cols * row) + col];
+    }
+
+    T
+    operator()(const size_t& row, const size_t& col) const
+    {
+      return m_matrix[(m_cols * row) + col];
+    }
+
+    // row-major linear access
+    T&
+    operator[](size_t i)
+    {
+      return m_matrix[i];
+    }
+
+    T
+    operator[](size_t i) const
+    {
+      return m_matrix[i];
+    }
+
+    // matrix addition
+    basic_matrix&
+    operator+=(const basic_matrix& other)
+    {
+      if (m_rows == other.rows() && m_cols == other.cols())
+        detail::simd<T>().add(m_size, m_matrix, other.m_matrix);
+      else
+        std::cerr << "Incompatible matrices, cannot add";
+      
+
+      return *this;
+    }
+
+    // matrix subtraction
+    basic_matrix&
+    operator-=(const basic_matrix& other)
+    {
+      if (m_rows == other.rows() && m_cols == other.cols())
+        detail::simd<T>().sub(m_size, m_matrix, other.m_matrix);
+
+      return *this;
+    }
+
+    // matrix multiplication
+    basic_matrix&
+    operator*=(const basic_matrix& other)
+    {
+      if (m_cols == other.rows())
+      {
+        basic_matrix result(m_rows, other.cols());
+        detail::product(m_rows, other.cols(), m_cols, m_matrix, m_cols,
+                        other.m_matrix, other.cols(), result.m_matrix, result.cols());
+        *this = std::move(result);
+      }
+      else
+        std::cerr << "Cannot multiply, returning first matrix\n";
+
+      return *this;
+    }
+
+    // Scalar multiplication
+    basic_matrix&
+    operator*=(T k)
+    {
+      detail::simd<T>().scale(m_size, m_matrix, k);
+      return *this;
+    }
+
+    // Left-to-right binary exponentiation: one squaring per bit of k
+    // and one multiply per set bit after the first, ping-ponging
+    // between two buffers allocated up front
+    basic_matrix&
+    operator^=(unsigned long k)
+    {
+      if (m_rows != m_cols)
+      {
+        std::cerr << "Cannot raise non-square matrix to a power, returning matrix\n";
+        return *this;
+      }
+
+      if (k == 0)
+      {
+        for (size_t i = 0; i < m_rows; ++i)
+          for (size_t j = 0; j < m_cols; ++j)
+            (*this)(i, j) = i == j;
+        return *this;
+      }
+
+      if (k == 1)
+        return *this;
+
+      int bit = std::numeric_limits<unsigned long>::digits - 1;
+      while (!((k >> bit) & 1))
+        --bit;
+
+      basic_matrix result(*this);
+      basic_matrix scratch(m_rows, m_cols);
+      for (--bit; bit >= 0; --bit)
+      {
+        multiply(result, result, scratch);
+        result.swap(scratch);
+        if ((k >> bit) & 1)
+        {
+          multiply(result, *this, scratch);
+          result.swap(scratch);
+        }
+      }
+
+      swap(result);
+      return *this;
+    }
+
+    bool
+    isRowEchelonForm() const
+    {
+      size_t prevCol = 0;
+      for (size_t i = 0; i < m_rows; ++i)
+      {
+        for (size_t j = 0; j < m_cols; ++j)
+        {
+          T elem = (*this)(i, j);
+          if (elem == T(1) && j > prevCol)
+          {
+            prevCol = j;
+            break;
+          }
+          else if (elem != T(0))
+            return false;
+        }
+      }
+
+      return true;	 
+    }
+    
+    bool
+    isZeroMatrix() const
+    {
+      for (const auto& elem : *this)
+        if (elem != T(0))
+          return false;
+      return true;
+    }
+
+  private:
+    size_t m_rows;
+    size_t m_cols;
+    size_t m_size;
+
+    std::pmr::memory_resource* m_storage;
+    T* m_matrix;
+
+    T*
+    allocate(size_t size)
+    {
+      if (size == 0)
+        return nullptr;
+      return static_cast<T*>(m_storage->allocate(size * sizeof(T),
+                                                 detail::STORAGE_ALIGNMENT));
+    }
+
+    void
+    deallocate()
+    {
+      if (m_matrix != nullptr)
+        m_storage->deallocate(m_matrix, m_size * sizeof(T), detail::STORAGE_ALIGNMENT);
+      m_matrix = nullptr;
+    }
+
+    // Element-wise expressions over a million elements are split across
+    // the thread pool to use more than one core's memory bandwidth
+    static constexpr size_t EXPR_PARALLEL = 1 << 20;
+    static constexpr size_t EXPR_CHUNK = 1 << 16;
+
+    // Evaluates an expression of this matrix's shape in one fused pass
+    template <typename E>
+    void
+    assign(const E& e)
+    {
+      T* out = m_matrix;
+      bool valid = e.valid();
+      if (!valid)
+        std::cerr << "Incompatible matrices, returning first matrix\n";
+
+      auto evaluate = [&](size_t first, size_t last) {
+        if (valid)
+          for (size_t i = first; i < last; ++i)
+            out[i] = e[i];
+        else
+          for (size_t i = first; i < last; ++i)
+            out[i] = detail::exprFallback(e, i);
+      };
+
+      if (m_size < EXPR_PARALLEL)
+        evaluate(0, m_size);
+      else
+        detail::thread_pool::instance().parallelFor((m_size + EXPR_CHUNK - 1) / EXPR_CHUNK,
+          [&](size_t chunk) {
+            evaluate(chunk * EXPR_CHUNK, std::min(m_size, (chunk + 1) * EXPR_CHUNK));
+          });
+    }
+    
+    bool
+    almostEqual(T a, T b)
+    {
+      detail::real_t<T> diff = std::abs(a - b);
+      return diff <= std::numeric_limits<detail::real_t<T>>::epsilon();
+    }
+  };
+
+  // The library's default element type
+  using matrix = basic_matrix<elem_t>;
+
+  /**********************************************************************/
+  // Matrix views
+  //
+  // A basic_matrix_view is a non-owning window onto row-major storage:
+  // a pointer, a shape and a row stride. Blocks, row ranges, single rows
+  // and single columns of a matrix (or of another view) are all views of
+  // its buffer, so slicing never copies. Views are expression leaves,
+  // so they mix freely with matrices in +, -, scalar * and *, and the
+  // product of two views goes straight to the strided GEMM kernel.
+  // basic_matrix_view<const T> is the read-only form, and a matrix
+  // converts to either implicitly. Assigning to a view writes its
+  // elements rather than rebinding it.
+  template <typename T>
+  class basic_matrix_view : public expr<basic_matrix_view<T>>
+  {
+  public:
+    using value_type = std::remove_const_t<T>;
+    using pointer = T*;
+
+    basic_matrix_view() = default;
+
+    basic_matrix_view(T* data, size_t rows, size_t cols, size_t stride)
+      : m_data(data),
+        m_rows(rows),
+        m_cols(cols),
+        m_stride(stride)
+    {
+    }
+
+    basic_matrix_view(basic_matrix<value_type>& A)
+      : basic_matrix_view(A.begin(), A.rows(), A.cols(), A.cols())
+    {
+    }
+
+    template <typename U = T, typename = std::enable_if_t<std::is_const_v<U>>>
+    basic_matrix_view(const basic_matrix<value_type>& A)
+      : basic_matrix_view(A.begin(), A.rows(), A.cols(), A.cols())
+    {
+    }
+
+    // mutable to read-only
+    template <typename U = T, typename = std::enable_if_t<std::is_const_v<U>>>
+    basic_matrix_view(const basic_matrix_view<value_type>& other)
+      : basic_matrix_view(other.data(), other.rows(), other.cols(), other.stride())
+    {
+    }
+
+    basic_matrix_view(const basic_matrix_view&) = default;
+
+    // Element-wise copy into the viewed block
+    basic_matrix_view&
+    operator=(const basic_matrix_view& other)
+    {
+      if (this != &other)
+        assign(other);
+      return *this;
+    }
+
+    template <typename E>
+    basic_matrix_view&
+    operator=(const expr<E>& e)
+    {
+      assign(e.self());
+      return *this;
+    }
+
+    template <typename E>
+    basic_matrix_view&
+    operator+=(const expr<E>& e)
+    {
+      assign(*this + e.self());
+      return *this;
+    }
+
+    template <typename E>
+    basic_matrix_view&
+    operator-=(const expr<E>& e)
+    {
+      assign(*this - e.self());
+      return *this;
+    }
+
+    // leaves zeros untouched, like basic_matrix
+    basic_matrix_view&
+    operator*=(value_type k)
+    {
+      for (size_t i = 0; i < m_rows; ++i)
+        detail::simd<value_type>().scale(m_cols, m_data + i * m_stride, k);
+      return *this;
+    }
+
+    T*
+    data() const
+    {
+      return m_data;
+    }
+
+    size_t
+    rows() const
+    {
+      return m_rows;
+    }
+
+    size_t
+    cols() const
+    {
+      return m_cols;
+    }
+
+    size_t
+    size() const
+    {
+      return m_rows * m_cols;
+    }
+
+    // distance in elements between the starts of consecutive rows
+    size_t
+    stride() const
+    {
+      return m_stride;
+    }
+
+    T&
+    operator()(size_t row, size_t col) const
+    {
+      return m_data[row * m_stride + col];
+    }
+
+    // linear, row-major access, as on basic_matrix
+    T&
+    operator[](size_t i) const
+    {
+      return (*this)(i / m_cols, i % m_cols);
+    }
+
+    // The rows x cols block whose top-left corner is (row, col)
+    basic_matrix_view
+    block(size_t row, size_t col, size_t rows, size_t cols) const
+    {
+      return { m_data + row * m_stride + col, rows, cols, m_stride };
+    }
+
+    basic_matrix_view
+    rowRange(size_t first, size_t count) const
+    {
+      return block(first, 0, count, m_cols);
+    }
+
+    basic_matrix_view
+    colRange(size_t first, size_t count) const
+    {
+      return block(0, first, m_rows, count);
+    }
+
+    basic_matrix_view
+    row(size_t r) const
+    {
+      return block(r, 0, 1, m_cols);
+    }
+
+    basic_matrix_view
+    col(size_t c) const
+    {
+      return block(0, c, m_rows, 1);
+    }
+
+    void
+    swapRows(size_t r1, size_t r2) const
+    {
+      if (r1 >= m_rows || r2 >= m_rows)
+        return;
+      std::swap_ranges(&(*this)(r1, 0), &(*this)(r1, 0) + m_cols, &(*this)(r2, 0));
+    }
+
+    // Adds scalar * r1 to r2, changing the values in r2
+    void
+    addRows(size_t r1, size_t r2, value_type scalar = 1) const
+    {
+      if (r1 >= m_rows || r2 >= m_rows)
+        return;
+      detail::simd<value_type>().axpy(m_cols, &(*this)(r2, 0), &(*this)(r1, 0), scalar,
+                                      detail::g_snapToZero);
+    }
+
+    void
+    multiplyRow(size_t r, value_type scalar) const
+    {
+      if (r >= m_rows)
+        return;
+      detail::simd<value_type>().scale(m_cols, &(*this)(r, 0), scalar);
+    }
+
+    void
+    zero() const
+    {
+      for (size_t i = 0; i < m_rows; ++i)
+        detail::simd<value_type>().fill(m_cols, m_data + i * m_stride, value_type(0));
+    }
+
+    bool
+    valid() const
+    {
+      return true;
+    }
+
+    value_type
+    fallback(size_t i) const
+    {
+      return (*this)[i];
+    }
+
+  private:
+    T* m_data = nullptr;
+    size_t m_rows = 0;
+    size_t m_cols = 0;
+    size_t m_stride = 0;
+
+    // Row by row, so the inner loop has unit stride. Like basic_matrix,
+    // an expression may alias this view only element for element.
+    template <typename E>
+    void
+    assign(const E& e)
+    {
+      if (e.rows() != m_rows || e.cols() != m_cols || !detail::exprValid(e))
+      {
+        std::cerr << "Incompatible matrices, leaving view unchanged\n";
+        return;
+      }
+
+      for (size_t i = 0; i < m_rows; ++i)
+      {
+        T* out = m_data + i * m_stride;
+        size_t first = i * m_cols;
+        for (size_t j = 0; j < m_cols; ++j)
+          out[j] = e[first + j];
+      }
+    }
+  };
+
+  using matrix_view = basic_matrix_view<elem_t>;
+  using const_matrix_view = basic_matrix_view<const elem_t>;
+
+  // A with row r and column c removed, as a read-only index map over A's
+  // storage: minor row i reads row i + (i >= r), and likewise for columns
+  template <typename T>
+  class minor_view : public expr<minor_view<T>>
+  {
+  public:
+    using value_type = T;
+
+    minor_view(basic_matrix_view<const T> A, size_t r, size_t c)
+      : m_base(A),
+        m_r(r),
+        m_c(c)
+    {
+    }
+
+    size_t
+    rows() const
+    {
+      return m_base.rows() - 1;
+    }
+
+    size_t
+    cols() const
+    {
+      return m_base.cols() - 1;
+    }
+
+    size_t
+    size() const
+    {
+      return rows() * cols();
+    }
+
+    T
+    operator()(size_t row, size_t col) const
+    {
+      return m_base(row + (row >= m_r), col + (col >= m_c));
+    }
+
+    T
+    operator[](size_t i) const
+    {
+      return (*this)(i / cols(), i % cols());
+    }
+
+    bool
+    valid() const
+    {
+      return true;
+    }
+
+    T
+    fallback(size_t i) const
+    {
+      return (*this)[i];
+    }
+
+  private:
+    basic_matrix_view<const T> m_base;
+    size_t m_r;
+    size_t m_c;
+  };
+
+  /**********************************************************************/
+  // Global functions
+
+  template <typename T>
+  bool
+  almostEqual(T a, T b)
+  {
+    detail::real_t<T> diff = std::abs(a - b);
+    return diff <= std::numeric_limits<detail::real_t<T>>::epsilon();
+  }
+  
+  template <typename T>
+  void
+  swap(basic_matrix<T>& A, basic_matrix<T>& B) noexcept
+  {
+    A.swap(B);
+  }
+
+  namespace detail
+  {
+    template <typename T>
+    T
+    exprFallback(const basic_matrix<T>& A, size_t i)
+    {
+      return A[i];
+    }
+  } // namespace detail
+
+  // matrix addition
+  template <typename L, typename R,
+            typename = std::enable_if_t<detail::is_expr<L>::value && detail::is_expr<R>::value>>
+  binary_expr<detail::expr_operand<L>, detail::expr_operand<R>, detail::add_op>
+  operator+(L&& A, R&& B)
+  {
+    return { std::forward<L>(A), std::forward<R>(B) };
+  }
+
+  // matrix subtraction
+  template <typename L, typename R,
+            typename = std::enable_if_t<detail::is_expr<L>::value && detail::is_expr<R>::value>>
+  binary_expr<detail::expr_operand<L>, detail::expr_operand<R>, detail::sub_op>
+  operator-(L&& A, R&& B)
+  {
+    return { std::forward<L>(A), std::forward<R>(B) };
+  }
+
+  template <typename E, typename = std::enable_if_t<detail::is_expr<E>::value>>
+  scaled_expr<detail::expr_operand<E>>
+  operator-(E&& A)
+  {
+    return { std::forward<E>(A), typename std::decay_t<E>::value_type(-1) };
+  }
+
+  template <typename T>
+  void
+  multiply(const basic_matrix<T>& A, const basic_matrix<T>& B, basic_matrix<T>& C)
+  {
+    if (A.cols() != B.rows())
+    {
+      std::cerr << "Cannot multiply, leaving result unchanged\n";
+      return;
+    }
+
+    // C is written while A and B are read, so it must be a separate
+    // buffer of the product's shape
+    if (&C == &A || &C == &B || C.rows() != A.rows() || C.cols() != B.cols())
+    {
+      basic_matrix<T> result(A.rows(), B.cols());
+      multiply(A, B, result);
+      C = std::move(result);
+      return;
+    }
+
+    detail::product(A.rows(), B.cols(), A.cols(), A.begin(), A.cols(),
+                    B.begin(), B.cols(), C.begin(), C.cols());
+  }
+
+  // matrix multiplication
+  template <typename T>
+  basic_matrix<T>
+  operator*(const basic_matrix<T>& A, const basic_matrix<T>& B)
+  {
+    if (A.cols() != B.rows())
+    {
+      std::cerr << "Cannot multiply, returning first matrix\n";
+      return A;
+    }
+
+    basic_matrix<T> result(A.rows(), B.cols());
+    detail::product(A.rows(), B.cols(), A.cols(), A.begin(), A.cols(),
+                    B.begin(), B.cols(), result.begin(), result.cols());
+    return result;
+  }
+
+  namespace detail
+  {
+    // true if the blocks viewed by X and Y share any memory
+    template <typename TX, typename TY>
+    bool
+    overlaps(const basic_matrix_view<TX>& X, const basic_matrix_view<TY>& Y)
+    {
+      if (X.rows() == 0 || X.cols() == 0 || Y.rows() == 0 || Y.cols() == 0)
+        return false;
+      const void* xFirst = X.data();
+      const void* xLast = X.data() + (X.rows() - 1) * X.stride() + X.cols();
+      const void* yFirst = Y.data();
+      const void* yLast = Y.data() + (Y.rows() - 1) * Y.stride() + Y.cols();
+      std::less<const void*> before;
+      return before(xFirst, yLast) && before(yFirst, xLast);
+    }
+  } // namespace detail
+
+  // C = A * B into a C view that already has the product's shape, e.g. a
+  // block of a larger matrix
+  template <typename TA, typename TB, typename T>
+  void
+  multiply(basic_matrix_view<TA> A, basic_matrix_view<TB> B, basic_matrix_view<T> C)
+  {
+    if (A.cols() != B.rows() || C.rows() != A.rows() || C.cols() != B.cols())
+    {
+      std::cerr << "Cannot multiply, leaving result unchanged\n";
+      return;
+    }
+
+    // C is zeroed before A and B are read, so a C sharing memory with
+    // either input gets the product through a temporary
+    if (detail::overlaps(C, A) || detail::overlaps(C, B))
+    {
+      basic_matrix<std::remove_const_t<T>> result(A.rows(), B.cols(), 0);
+      detail::gemmStrided(A.rows(), B.cols(), A.cols(), A.data(), A.stride(), size_t(1),
+                          B.data(), B.stride(), size_t(1), result.begin(), result.cols(),
+                          std::remove_const_t<T>(1));
+      C = result;
+      return;
+    }
+
+    C.zero();
+    detail::gemmStrided(A.rows(), B.cols(), A.cols(), A.data(), A.stride(), size_t(1),
+                        B.data(), B.stride(), size_t(1), C.data(), C.stride(), T(1));
+  }
+
+  namespace detail
+  {
+    template <typename T>
+    struct is_dense : std::false_type
+    {
+    };
+
+    template <typename T>
+    struct is_dense<basic_matrix<T>> : std::true_type
+    {
+    };
+
+    template <typename T>
+    struct is_dense<basic_matrix_view<T>> : std::true_type
+    {
+    };
+
+    // Matrices and views are multiplied where they are; other
+    // expressions are evaluated into a temporary first
+    template <typename E>
+    decltype(auto)
+    denseOperand(const E& e)
+    {
+      if constexpr (is_dense<E>::value)
+        return (e);
+      else
+        return basic_matrix<typename E::value_type>(e);
+    }
+  } // namespace detail
+
+  // Products involving views or element-wise expressions, e.g. (A + B) * C
+  // or A.block(0, 0, k, k) * B
+  template <typename L, typename R,
+            typename = std::enable_if_t<detail::is_expr<L>::value && detail::is_expr<R>::value>>
+  basic_matrix<typename L::value_type>
+  operator*(const L& A, const R& B)
+  {
+    using T = typename L::value_type;
+    const auto& left = detail::denseOperand(A);
+    const auto& right = detail::denseOperand(B);
+    basic_matrix_view<const T> a = left;
+    basic_matrix_view<const T> b = right;
+    if (a.cols() != b.rows())
+    {
+      std::cerr << "Cannot multiply, returning first matrix\n";
+      return basic_matrix<T>(a);
+    }
+
+    basic_matrix<T> result(a.rows(), b.cols(), T(0));
+    multiply(a, b, result.view());
+    return result;
+  }
+
+  // scalar multiplication
+  template <typename E, typename = std::enable_if_t<detail::is_expr<E>::value>>
+  scaled_expr<detail::expr_operand<E>>
+  operator*(typename std::decay_t<E>::value_type k, E&& A)
+  {
+    return { std::forward<E>(A), k };
+  }
+
+  template <typename E, typename = std::enable_if_t<detail::is_expr<E>::value>>
+  scaled_expr<detail::expr_operand<E>>
+  operator*(E&& A, typename std::decay_t<E>::value_type k)
+  {
+    return { std::forward<E>(A), k };
+  }
+
+  template <typename T>
+  basic_matrix<T>
+  operator^(const basic_matrix<T>& A, unsigned long k)
+  {
+    basic_matrix<T> result(A);
+    result ^= k;
+    return result;
+  }
+
+  template <typename T>
+  basic_matrix<T>
+  operator^(basic_matrix<T>&& A, unsigned long k)
+  {
+    A ^= k;
+    return std::move(A);
+  }
+
+  // Computes A^k for every k in exponents. The squarings A, A^2, A^4, ...
+  // are shared: each is formed once and multiplied into every result
+  // whose exponent has that bit set, so the cost is one squaring per bit
+  // of the largest exponent plus one multiply per remaining set bit.
+  template <typename T>
+  std::vector<basic_matrix<T>>
+  powers(const basic_matrix<T>& A, const std::vector<unsigned long>& exponents)
+  {
+    std::vector<basic_matrix<T>> results(exponents.size());
+    if (A.rows() != A.cols())
+    {
+      std::cerr << "Cannot raise non-square matrix to a power\n";
+      return results;
+    }
+
+    unsigned long maxExponent = 0;
+    for (size_t e = 0; e < exponents.size(); ++e)
+    {
+      maxExponent = std::max(maxExponent, exponents[e]);
+      if (exponents[e] == 0)
+        results[e] = A ^ 0;
+    }
+
+    basic_matrix<T> square(A);
+    basic_matrix<T> scratch(A.rows(), A.cols());
+    // remaining is maxExponent >> bit, consumed a bit at a time so no
+    // shift reaches the width of unsigned long
+    unsigned long remaining = maxExponent;
+    for (unsigned long bit = 0; remaining != 0; ++bit, remaining >>= 1)
+    {
+      for (size_t e = 0; e < exponents.size(); ++e)
+      {
+        if (!((exponents[e] >> bit) & 1))
+          continue;
+
+        if (results[e].size() == 0)
+          results[e] = square;
+        else
+        {
+          multiply(results[e], square, scratch);
+          results[e].swap(scratch);
+        }
+      }
+
+      if ((remaining >> 1) != 0)
+      {
+        multiply(square, square, scratch);
+        square.swap(scratch);
+      }
+    }
+
+    return results;
+  }
+
+  template <typename T>
+  std::ostream&
+  operator<<(std::ostream& output, const basic_matrix<T>& A)
+  {
+    output << std::left;
+    for (size_t i = 0; i < A.rows(); ++i)
+    {
+      for (size_t j = 0; j < A.cols(); ++j)
+        output << std::setw(10) << A(i, j) << ' ';
+      output << '\n';
+    }
+
+    return output;
+  }
+
+  template <typename T>
+  std::ostream&
+  operator<<(std::ostream& output, basic_matrix_view<T> A)
+  {
+    output << std::left;
+    for (size_t i = 0; i < A.rows(); ++i)
+    {
+      for (size_t j = 0; j < A.cols(); ++j)
+        output << std::setw(10) << A(i, j) << ' ';
+      output << '\n';
+    }
+
+    return output;
+  }
+  
+  template <typename T>
+  bool
+  operator==(const basic_matrix<T>& A, const basic_matrix<T>& B)
+  {
+    if (A.rows() != B.rows() || A.cols() != B.cols())
+      return false;
+
+    for (size_t i = 0; i < A.rows(); ++i)
+      for (size_t j = 0; j < A.cols(); ++j)
+        if (!almostEqual(A(i, j), B(i, j)))
+          return false;
+
+    return true;
+  }
+
+  template <typename T>
+  bool
+  operator!=(const basic_matrix<T>& A, const basic_matrix<T>& B)
+  {
+    return !(A == B);
+  }
+  
+  // Gaussian elimination
+  template <typename T>
+  basic_matrix<T>
+  rowEchelon(basic_matrix<T> A)
+  {
+    if (A.isRowEchelonForm())
+      return A;
+
+    for (size_t currTopRow = 0; currTopRow < A.rows(); ++currTopRow)
+    {
+      size_t currRow = currTopRow;
+      size_t currCol = 0;
+      
+      bool found = false;
+      for (size_t j = 0; j < A.cols(); ++j)
+      {
+        for (size_t i = currTopRow; i < A.rows(); ++i)
+        {
+          if (A(i, j) != T(0))
+          {
+            found = true;
+            currRow = i;
+            currCol = j;
+            break;
+          }
+        }
+
+        if (found)
+          break;
+      }
+
+      if (!found)
+        return A;
+
+      if (currRow != currTopRow)
+      {
+        A.swapRows(currRow, currTopRow);
+        currRow = currTopRow;
+      }
+
+      T leadingElement = A(currRow, currCol);
+      if (leadingElement != T(1))
+        A.multiplyRow(currRow, T(1) / leadingElement);
+
+      for (size_t i = currRow + 1; i < A.rows(); ++i)
+      {
+        T elem = A(i, currCol);
+        if (elem != T(0))
+          A.addRows(currRow, i, -elem);
+      }
+    }
+
+    return A;
+  }
+
+  // Gauss-Jordan elimination
+  template <typename T>
+  basic_matrix<T>
+  reducedRowEchelon(basic_matrix<T> A)
+  {
+    A = rowEchelon(std::move(A));
+
+    for (size_t currBottomRow = A.rows() - 1; currBottomRow > 0; --currBottomRow)
+    {
+      bool allZeros = true;
+      size_t leadingOne = 0;
+      for (size_t j = 0; j < A.cols(); ++j)
+      {
+        if (A(currBottomRow, j) != T(0))
+        {
+          allZeros = false;
+          leadingOne = j;
+          break;
+        }
+      }
+
+      if (!allZeros)
+        for (size_t i = 0; i < currBottomRow; ++i)
+          A.addRows(currBottomRow, i, -A(i, leadingOne));
+    }
+
+    return A;
+  }
+  
+  template <typename T>
+  basic_matrix<T>
+  transpose(const basic_matrix<T>& A)
+  {
+    basic_matrix<T> transposed(A.cols(), A.rows());
+    detail::transposeStrided(A.rows(), A.cols(), A.begin(), A.cols(),
+                             transposed.begin(), transposed.cols());
+    return transposed;
+  }
+
+  // A square temporary is transposed in its own buffer. Rectangular ones
+  // still get the out-of-place kernel, which is far faster than
+  // following cycles when memory is not the constraint.
+  template <typename T>
+  basic_matrix<T>
+  transpose(basic_matrix<T>&& A)
+  {
+    if (A.rows() != A.cols())
+      return transpose(static_cast<const basic_matrix<T>&>(A));
+
+    A.transposeInPlace();
+    return std::move(A);
+  }
+
+  template <typename T>
+  basic_matrix<std::remove_const_t<T>>
+  transpose(basic_matrix_view<T> A)
+  {
+    basic_matrix<std::remove_const_t<T>> transposed(A.cols(), A.rows());
+    detail::transposeStrided(A.rows(), A.cols(), A.data(), A.stride(),
+                             transposed.begin(), transposed.cols());
+    return transposed;
+  }
+
+  // A without row r and column c, as an index map over A's storage
+  template <typename T>
+  minor_view<T>
+  minorView(const basic_matrix<T>& A, size_t r, size_t c)
+  {
+    return { A, r, c };
+  }
+
+  template <typename T>
+  basic_matrix<T>
+  minorMatrix(const basic_matrix<T>& A, size_t r, size_t c)
+  {
+    if (A.rows() == 1 || A.cols() == 1)
+      return A;
+
+    return basic_matrix<T>(minorView(A, r, c));
+  }
+
+  template <typename T = elem_t>
+  basic_matrix<T>
+  identity(size_t size)
+  {
+    mat::basic_matrix<T> A(size, size);
+    for (size_t i = 0; i < A.rows(); ++i)
+      for (size_t j = 0; j < A.cols(); ++j)
+        A(i, j) = T(i == j);
+
+    return A;
+  }
+
+  template <typename T = elem_t>
+  basic_matrix<T>
+  zero(size_t rows, size_t cols)
+  {
+    return basic_matrix<T>(rows, cols, T(0));
+  }
+  
+  /**********************************************************************/
+  // LU factorization
+  //
+  // PA = LU with partial pivoting, computed in place: the unit lower
+  // triangle L and upper triangle U share one n x n buffer and row
+  // interchanges are kept as a pivot list. Columns are factored in
+  // LU_BLOCK-wide panels; after each panel the trailing submatrix is
+  // updated with one GEMM, so almost all of the O(n^3) work runs in the
+  // blocked, multithreaded kernel. A factorization is reusable for any
+  // number of determinants and solves.
+  template <typename T = elem_t>
+  class lu_factorization
+  {
+    static_assert(!std::is_integral_v<T>,
+                  "LU factorization needs a field type; use mod for integers");
+
+  public:
+    static constexpr size_t LU_BLOCK = 64;
+
+    lu_factorization() = default;
+
+    explicit lu_factorization(const basic_matrix<T>& A)
+      : lu_factorization(basic_matrix<T>(A))
+    {
+    }
+
+    explicit lu_factorization(basic_matrix<T>&& A)
+      : m_lu(std::move(A))
+    {
+      if (m_lu.rows() != m_lu.cols())
+      {
+        std::cerr << "LU factorization requires a square matrix\n";
+        m_lu = basic_matrix<T>();
+        m_singular = true;
+        return;
+      }
+
+      factor();
+    }
+
+    size_t
+    size() const
+    {
+      return m_lu.rows();
+    }
+
+    // True if some pivot vanished relative to its column of A, i.e. if
+    // nullity() > 0
+    bool
+    singular() const
+    {
+      return m_singular;
+    }
+
+    // L below the diagonal (unit diagonal implied) and U on and above it
+    const basic_matrix<T>&
+    factors() const
+    {
+      return m_lu;
+    }
+
+    // Row i of PA is row permutation()[i] of A
+    std::vector<size_t>
+    permutation() const
+    {
+      std::vector<size_t> perm(size());
+      for (size_t i = 0; i < perm.size(); ++i)
+        perm[i] = i;
+      for (size_t i = 0; i < m_pivots.size(); ++i)
+        std::swap(perm[i], perm[m_pivots[i]]);
+      return perm;
+    }
+
+    // Row i was swapped with row pivots()[i] at step i
+    const std::vector<size_t>&
+    pivots() const
+    {
+      return m_pivots;
+    }
+
+    T
+    determinant() const
+    {
+      if (m_singular)
+        return 0;
+
+      T det = m_sign;
+      for (size_t i = 0; i < size(); ++i)
+        det *= m_lu(i, i);
+      return det;
+    }
+
+    // Solves AX = B for every column of B
+    basic_matrix<T>
+    solve(const basic_matrix<T>& B) const
+    {
+      basic_matrix<T> X(B);
+      solveInPlace(X);
+      return X;
+    }
+
+    // Overwrites B with the solution X of AX = B
+    void
+    solveInPlace(basic_matrix<T>& B) const
+    {
+      if (B.rows() != size())
+      {
+        std::cerr << "Right-hand side has the wrong number of rows\n";
+        return;
+      }
+
+      size_t n = size();
+      for (size_t i = 0; i < m_pivots.size(); ++i)
+        if (m_pivots[i] != i)
+          B.swapRows(i, m_pivots[i]);
+
+      // Ly = Pb and then Ux = y, LU_BLOCK rows at a time: each block first
+      // takes the contribution of every solved row through one GEMM, then
+      // finishes with a small substitution
+      for (size_t k = 0; k < n; k += LU_BLOCK)
+      {
+        size_t nb = std::min(LU_BLOCK, n - k);
+        detail::gemm(nb, B.cols(), k, m_lu.begin() + k * n, n, B.begin(), B.cols(),
+                     &B(k, 0), B.cols(), T(-1));
+        substitute(B, k, nb, false);
+      }
+
+      for (size_t end = n; end > 0; )
+      {
+        size_t nb = std::min(LU_BLOCK, end);
+        size_t k = end - nb;
+        detail::gemm(nb, B.cols(), n - end, m_lu.begin() + k * n + end, n, &B(end, 0), B.cols(),
+                     &B(k, 0), B.cols(), T(-1));
+        substitute(B, k, nb, true);
+        end = k;
+      }
+    }
+
+    // Number of pivots that vanished or are negligible next to their
+    // column of A, an estimate of n minus the numerical rank of A
+    size_t
+    nullity() const
+    {
+      return m_nullity;
+    }
+
+  private:
+    basic_matrix<T> m_lu;
+    std::vector<size_t> m_pivots;
+    T m_sign = 1;
+    bool m_singular = false;
+    size_t m_nullity = 0;
+
+    // Forward (unit L) or backward (U) substitution confined to rows
+    // [k, k + nb) of B, whose other contributions are already applied
+    void
+    substitute(basic_matrix<T>& B, size_t k, size_t nb, bool upper) const
+    {
+      size_t m = B.cols();
+      for (size_t step = 0; step < nb; ++step)
+      {
+        size_t i = upper ? k + nb - 1 - step : k + step;
+        T* bi = &B(i, 0);
+        size_t first = upper ? i + 1 : k;
+        size_t last = upper ? k + nb : i;
+        for (size_t r = first; r < last; ++r)
+        {
+          T factor = m_lu(i, r);
+          const T* br = &B(r, 0);
+          for (size_t j = 0; j < m; ++j)
+            bi[j] -= factor * br[j];
+        }
+
+        if (upper)
+        {
+          T d = m_lu(i, i);
+          for (size_t j = 0; j < m; ++j)
+            bi[j] /= d;
+        }
+      }
+    }
+
+    void
+    factor()
+    {
+      size_t n = m_lu.rows();
+      m_pivots.resize(n);
+
+      // Pivots this small next to the largest entry of their own column
+      // count toward the nullity. Being relative per column, the test is
+      // unaffected by how the columns are scaled.
+      std::vector<detail::real_t<T>> tolerance(n, 0);
+      for (size_t i = 0; i < n; ++i)
+        for (size_t j = 0; j < n; ++j)
+          tolerance[j] = std::max<detail::real_t<T>>(tolerance[j], std::abs(m_lu(i, j)));
+      for (auto& t : tolerance)
+        t *= n * std::numeric_limits<detail::real_t<T>>::epsilon();
+
+      for (size_t k = 0; k < n; k += LU_BLOCK)
+      {
+        size_t nb = std::min(LU_BLOCK, n - k);
+        factorPanel(k, nb, tolerance);
+
+        size_t rest = n - k - nb;
+        if (rest == 0)
+          continue;
+
+        // U12 = L11^-1 A12
+        for (size_t i = k + 1; i < k + nb; ++i)
+        {
+          T* ai = &m_lu(i, k + nb);
+          for (size_t r = k; r < i; ++r)
+          {
+            T l = m_lu(i, r);
+            const T* ar = &m_lu(r, k + nb);
+            for (size_t j = 0; j < rest; ++j)
+              ai[j] -= l * ar[j];
+          }
+        }
+
+        // A22 -= L21 U12
+        detail::gemm(rest, rest, nb, &m_lu(k + nb, k), n, &m_lu(k, k + nb), n,
+                     &m_lu(k + nb, k + nb), n, T(-1));
+      }
+    }
+
+    // Unblocked right-looking LU of columns [k, k + nb) for rows k..n-1.
+    // Row swaps are applied to whole rows, which also permutes L to the
+    // left and the not yet updated columns to the right.
+    void
+    factorPanel(size_t k, size_t nb, const std::vector<detail::real_t<T>>& tolerance)
+    {
+      size_t n = m_lu.rows();
+      for (size_t j = k; j < k + nb; ++j)
+      {
+        size_t pivot = j;
+        detail::real_t<T> largest = std::abs(m_lu(j, j));
+        for (size_t i = j + 1; i < n; ++i)
+        {
+          detail::real_t<T> candidate = std::abs(m_lu(i, j));
+          if (candidate > largest)
+          {
+            largest = candidate;
+            pivot = i;
+          }
+        }
+
+        m_pivots[j] = pivot;
+        if (pivot != j)
+        {
+          m_lu.swapRows(j, pivot);
+          m_sign = -m_sign;
+        }
+
+        if (largest <= tolerance[j] || !std::isfinite(largest))
+        {
+          ++m_nullity;
+          m_singular = true;
+        }
+        if (largest == 0 || !std::isfinite(largest))
+        {
+          for (size_t i = j + 1; i < n; ++i)
+            m_lu(i, j) = 0;
+          continue;
+        }
+
+        T inverse = T(1) / m_lu(j, j);
+        const T* aj = &m_lu(j, j + 1);
+        size_t width = k + nb - j - 1;
+        for (size_t i = j + 1; i < n; ++i)
+        {
+          T* ai = &m_lu(i, j);
+          T l = (ai[0] *= inverse);
+          for (size_t c = 0; c < width; ++c)
+            ai[c + 1] -= l * aj[c];
+        }
+      }
+    }
+  };
+
+  template <typename T>
+  T
+  determinant(const basic_matrix<T>& A)
+  {
+    if (A.rows() != A.cols())
+    {
+      std::cerr << "Determinant not defined, returning 0\n";
+      return 0;
+    }
+
+    return lu_factorization(A).determinant();
+  }
+  
+  // Inverse from one pivoted LU factorization; singularity, including a
+  // pivot negligible next to its column, is detected by the factorization
+  // itself rather than by a separate determinant
+  template <typename T>
+  basic_matrix<T>
+  inverse(const basic_matrix<T>& A)
+  {
+    if (A.rows() != A.cols())
+    {
+      std::cerr << "Inverse does not exist.\n";
+      return A;
+    }
+
+    lu_factorization lu(A);
+    if (lu.nullity() > 0)
+    {
+      std::cerr << "Inverse does not exist.\n";
+      return A;
+    }
+
+    basic_matrix<T> inverse = identity<T>(A.rows());
+    lu.solveInPlace(inverse);
+    return inverse;
+  }
+
+  // adj(A) = det(A) A^-1 when A is invertible. A singular A of rank n - 2
+  // or less has every (n - 1)-minor zero, so adj(A) = 0. At rank n - 1,
+  // adj(A) A = A adj(A) = 0 forces adj(A) = c x y^T for null vectors
+  // Ax = 0 and y^T A = 0, and one cofactor fixes c. All cases are O(n^3).
+  template <typename T>
+  basic_matrix<T>
+  adjugate(const basic_matrix<T>& A)
+  {
+    if (A.rows() != A.cols())
+    {
+      std::cerr << "Adjugate not defined, returning matrix\n";
+      return A;
+    }
+
+    size_t n = A.rows();
+    if (n == 1)
+      return basic_matrix<T>(1, 1, 1);
+
+    lu_factorization lu(A);
+    if (lu.nullity() == 0)
+    {
+      basic_matrix<T> adj = identity<T>(n);
+      lu.solveInPlace(adj);
+      adj *= lu.determinant();
+      return adj;
+    }
+
+    if (lu.nullity() > 1)
+      return zero<T>(n, n);
+
+    // Null vector of U, and so of PA = LU, from its single zero pivot
+    auto nullVector = [n](const lu_factorization<T>& f) {
+      const basic_matrix<T>& U = f.factors();
+      size_t j = 0;
+      for (size_t i = 1; i < n; ++i)
+        if (std::abs(U(i, i)) < std::abs(U(j, j)))
+          j = i;
+
+      std::vector<T> x(n, 0);
+      x[j] = 1;
+      for (size_t i = j; i-- > 0; )
+      {
+        T sum = U(i, j);
+        for (size_t r = i + 1; r < j; ++r)
+          sum += U(i, r) * x[r];
+        x[i] = -sum / U(i, i);
+      }
+      return x;
+    };
+
+    std::vector<T> x = nullVector(lu);
+    std::vector<T> y = nullVector(lu_factorization(transpose(A)));
+
+    size_t p = std::max_element(x.begin(), x.end(), [](T a, T b) {
+      return std::abs(a) < std::abs(b); }) - x.begin();
+    size_t q = std::max_element(y.begin(), y.end(), [](T a, T b) {
+      return std::abs(a) < std::abs(b); }) - y.begin();
+
+    // adj(A)(p, q) is the (q, p) cofactor
+    T sign = (p + q) % 2 == 0 ? T(1) : T(-1);
+    T c = sign * determinant(minorMatrix(A, q, p)) / (x[p] * y[q]);
+
+    basic_matrix<T> adj(n, n);
+    for (size_t i = 0; i < n; ++i)
+      for (size_t j = 0; j < n; ++j)
+        adj(i, j) = c * x[i] * y[j];
+    return adj;
+  }
+
+  template <typename T>
+  basic_matrix<T>
+  augment(const basic_matrix<T>& A, const basic_matrix<T>& B)
+  {
+    if (A.rows() != B.rows())
+    {
+      std::cerr << "Number of rows not equal.\n";
+      return A;
+    }
+
+    basic_matrix<T> augmented(A.rows(), A.cols() + B.cols());
+    augmented.block(0, 0, A.rows(), A.cols()) = A;
+    augmented.block(0, A.cols(), B.rows(), B.cols()) = B;
+    return augmented;
+  }
+
+  template <typename T>
+  T
+  rowLength(size_t row, basic_matrix<T> A)
+  {
+    T sum = 0;
+    for (size_t j = 0; j < A.cols(); ++j)
+      sum += A(row, j);
+    return sqrt(sum);
+  }
+
+  /**********************************************************************/
+  // Cholesky factorization
+  //
+  // A = L L^T for symmetric positive definite A, reading only the lower
+  // triangle. Right-looking and blocked: each CHOLESKY_BLOCK-wide column
+  // panel is factored, the rows below it are solved against the new
+  // diagonal block, and the trailing lower triangle is updated with
+  // GEMMs (one per row block, so the upper half is never computed),
+  // spread across the thread pool.
+  namespace detail
+  {
+    constexpr size_t CHOLESKY_BLOCK = 96;
+
+    // Rows of the panel solve handed to one thread at a time
+    constexpr size_t CHOLESKY_ROWS = 64;
+
+    // L(i, c) for c in [k, k + nb), given L(c, r) for c, r in the
+    // diagonal block and L(i, r) for r < c
+    template <typename T>
+    void
+    choleskyRow(basic_matrix<T>& A, size_t i, size_t k, size_t nb)
+    {
+      T* li = &A(i, 0);
+      for (size_t c = k; c < k + nb; ++c)
+      {
+        const T* lc = &A(c, 0);
+        T sum = li[c];
+        for (size_t r = k; r < c; ++r)
+          sum -= li[r] * lc[r];
+        li[c] = sum / lc[c];
+      }
+    }
+  } // namespace detail
+
+  // Overwrites the lower triangle of A with L and zeros the upper
+  // triangle. Returns false, leaving A partly factored, as soon as a
+  // non-positive pivot shows A is not positive definite.
+  template <typename T>
+  bool
+  choleskyInPlace(basic_matrix<T>& A)
+  {
+    static_assert(std::is_floating_point_v<T>,
+                  "Cholesky factorization needs a real floating-point type");
+
+    if (A.rows() != A.cols())
+    {
+      std::cerr << "Cholesky factorization requires a square matrix\n";
+      return false;
+    }
+
+    size_t n = A.rows();
+    detail::thread_pool& pool = detail::thread_pool::instance();
+    for (size_t k = 0; k < n; k += detail::CHOLESKY_BLOCK)
+    {
+      size_t nb = std::min(detail::CHOLESKY_BLOCK, n - k);
+
+      // Diagonal block
+      for (size_t j = k; j < k + nb; ++j)
+      {
+        T* lj = &A(j, 0);
+        T d = lj[j];
+        for (size_t r = k; r < j; ++r)
+          d -= lj[r] * lj[r];
+        if (!(d > 0))
+          return false;
+        lj[j] = std::sqrt(d);
+
+        for (size_t i = j + 1; i < k + nb; ++i)
+        {
+          T* li = &A(i, 0);
+          T sum = li[j];
+          for (size_t r = k; r < j; ++r)
+            sum -= li[r] * lj[r];
+          li[j] = sum / lj[j];
+        }
+      }
+
+      size_t first = k + nb;
+      if (first == n)
+        break;
+
+      // L21 = A21 L11^-T
+      size_t chunks = (n - first + detail::CHOLESKY_ROWS - 1) / detail::CHOLESKY_ROWS;
+      pool.parallelFor(chunks, [&](size_t chunk) {
+        size_t begin = first + chunk * detail::CHOLESKY_ROWS;
+        size_t end = std::min(n, begin + detail::CHOLESKY_ROWS);
+        for (size_t i = begin; i < end; ++i)
+          detail::choleskyRow(A, i, k, nb);
+      });
+
+      // A22 -= L21 L21^T on and below the diagonal, reading L21^T through
+      // swapped strides
+      size_t blocks = (n - first + detail::GEMM_MC - 1) / detail::GEMM_MC;
+      pool.parallelFor(blocks, [&](size_t block) {
+        size_t row = first + block * detail::GEMM_MC;
+        size_t rows = std::min(detail::GEMM_MC, n - row);
+        detail::gemmSerial(rows, row + rows - first, nb,
+                           &A(row, k), n, size_t(1),
+                           &A(first, k), size_t(1), n,
+                           &A(row, first), n, T(-1));
+      });
+    }
+
+    for (size_t i = 0; i < n; ++i)
+      for (size_t j = i + 1; j < n; ++j)
+        A(i, j) = 0;
+
+    return true;
+  }
+
+  // Holds L for repeated solves with the same SPD matrix
+  template <typename T = elem_t>
+  class cholesky_factorization
+  {
+  public:
+    cholesky_factorization() = default;
+
+    explicit cholesky_factorization(const basic_matrix<T>& A)
+      : cholesky_factorization(basic_matrix<T>(A))
+    {
+    }
+
+    explicit cholesky_factorization(basic_matrix<T>&& A)
+      : m_l(std::move(A))
+    {
+      m_positiveDefinite = choleskyInPlace(m_l);
+    }
+
+    size_t
+    size() const
+    {
+      return m_l.rows();
+    }
+
+    bool
+    positiveDefinite() const
+    {
+      return m_positiveDefinite;
+    }
+
+    // Lower triangular L with A = L L^T
+    const basic_matrix<T>&
+    factor() const
+    {
+      return m_l;
+    }
+
+    T
+    determinant() const
+    {
+      if (!m_positiveDefinite)
+        return 0;
+
+      T det = 1;
+      for (size_t i = 0; i < size(); ++i)
+        det *= m_l(i, i) * m_l(i, i);
+      return det;
+    }
+
+    basic_matrix<T>
+    solve(const basic_matrix<T>& B) const
+    {
+      basic_matrix<T> X(B);
+      solveInPlace(X);
+      return X;
+    }
+
+    // Overwrites B with X = A^-1 B via Ly = B then L^T x = y, a block of
+    // rows at a time with the bulk of each block done by GEMM
+    void
+    solveInPlace(basic_matrix<T>& B) const
+    {
+      if (!m_positiveDefinite || B.rows() != size())
+      {
+        std::cerr << "Cannot solve, matrix is not positive definite or sizes differ\n";
+        return;
+      }
+
+      size_t n = size();
+      size_t m = B.cols();
+      const size_t bs = detail::CHOLESKY_BLOCK;
+      for (size_t k = 0; k < n; k += bs)
+      {
+        size_t nb = std::min(bs, n - k);
+        detail::gemm(nb, m, k, m_l.begin() + k * n, n, B.begin(), m,
+                     &B(k, 0), m, T(-1));
+        for (size_t i = k; i < k + nb; ++i)
+        {
+          T* bi = &B(i, 0);
+          for (size_t r = k; r < i; ++r)
+          {
+            T l = m_l(i, r);
+            const T* br = &B(r, 0);
+            for (size_t j = 0; j < m; ++j)
+              bi[j] -= l * br[j];
+          }
+
+          T d = m_l(i, i);
+          for (size_t j = 0; j < m; ++j)
+            bi[j] /= d;
+        }
+      }
+
+      for (size_t end = n; end > 0; )
+      {
+        size_t nb = std::min(bs, end);
+        size_t k = end - nb;
+        detail::gemmStrided(nb, m, n - end, m_l.begin() + end * n + k, size_t(1), n,
+                            B.begin() + end * m, m, size_t(1),
+                            &B(k, 0), m, T(-1));
+        for (size_t i = end; i-- > k; )
+        {
+          T* bi = &B(i, 0);
+          for (size_t r = i + 1; r < end; ++r)
+          {
+            T l = m_l(r, i);
+            const T* br = &B(r, 0);
+            for (size_t j = 0; j < m; ++j)
+              bi[j] -= l * br[j];
+          }
+
+          T d = m_l(i, i);
+          for (size_t j = 0; j < m; ++j)
+            bi[j] /= d;
+        }
+        end = k;
+      }
+    }
+
+  private:
+    basic_matrix<T> m_l;
+    bool m_positiveDefinite = false;
+  };
+
+  // Lower triangular L with A = L L^T, or an empty matrix if A is not
+  // symmetric positive definite
+  template <typename T>
+  basic_matrix<T>
+  cholesky(basic_matrix<T> A)
+  {
+    if (!choleskyInPlace(A))
+    {
+      std::cerr << "Matrix is not positive definite.\n";
+      return basic_matrix<T>();
+    }
+
+    return A;
+  }
+
+  /**********************************************************************/
+  // Fixed-size matrices
+  //
+  // fixed_matrix<R, C> keeps its R x C elements inline, so it never
+  // touches the heap and its shape is part of the type: mismatched
+  // operands are compile errors rather than runtime messages. Every
+  // loop has compile-time bounds and unrolls completely at these sizes,
+  // and determinant and inverse use closed forms up to 4 x 4. The
+  // interface mirrors basic_matrix so generic code can take either.
+  namespace detail
+  {
+    // |x| for pivot selection in constant expressions; the 1-norm is
+    // enough to rank complex pivots
+    template <typename T>
+    constexpr real_t<T>
+    magnitude(const T& x)
+    {
+      if constexpr (std::is_same_v<T, real_t<T>>)
+        return x < T(0) ? -x : x;
+      else
+        return magnitude(x.real()) + magnitude(x.imag());
+    }
+  } // namespace detail
+
+  template <size_t R, size_t C, typename T = elem_t>
+  class fixed_matrix
+  {
+    static_assert(R > 0 && C > 0, "fixed_matrix needs at least one element");
+
+  public:
+    // type aliases
+    using value_type = T;
+    using iterator = T*;
+    using const_iterator = const T*;
+
+    // zero matrix
+    constexpr fixed_matrix()
+      : m_matrix()
+    {
+    }
+
+    // every element set to init
+    constexpr explicit fixed_matrix(T init)
+      : m_matrix()
+    {
+      for (size_t i = 0; i < R * C; ++i)
+        m_matrix[i] = init;
+    }
+
+    // row-major elements; missing trailing elements are zero
+    constexpr fixed_matrix(std::initializer_list<T> elements)
+      : m_matrix()
+    {
+      size_t i = 0;
+      for (auto it = elements.begin(); it != elements.end() && i < R * C; ++it)
+        m_matrix[i++] = *it;
+    }
+
+    static constexpr size_t
+    rows()
+    {
+      return R;
+    }
+
+    static constexpr size_t
+    cols()
+    {
+      return C;
+    }
+
+    static constexpr size_t
+    size()
+    {
+      return R * C;
+    }
+
+    constexpr iterator
+    begin()
+    {
+      return m_matrix;
+    }
+
+    constexpr const_iterator
+    begin() const
+    {
+      return m_matrix;
+    }
+
+    constexpr iterator
+    end()
+    {
+      return m_matrix + R * C;
+    }
+
+    constexpr const_iterator
+    end() const
+    {
+      return m_matrix + R * C;
+    }
+
+    constexpr void
+    swapRows(size_t r1, size_t r2)
+    {
+      for (size_t j = 0; j < C; ++j)
+      {
+        T temp = (*this)(r1, j);
+        (*this)(r1, j) = (*this)(r2, j);
+        (*this)(r2, j) = temp;
+      }
+    }
+
+    // Same snapping rule as basic_matrix::addRows
+    void
+    addRows(size_t r1, size_t r2, T scalar = 1)
+    {
+      detail::axpyScalar(C, &(*this)(r2, 0), &(*this)(r1, 0), scalar,
+                         detail::g_snapToZero);
+    }
+
+    constexpr void
+    multiplyRow(size_t r, T scalar)
+    {
+      for (size_t j = 0; j < C; ++j)
+        if ((*this)(r, j) != T(0))
+          (*this)(r, j) *= scalar;
+    }
+
+    constexpr void
+    zero()
+    {
+      for (size_t i = 0; i < R * C; ++i)
+        m_matrix[i] = T(0);
+    }
+
+    constexpr T&
+    operator()(size_t row, size_t col)
+    {
+      return m_matrix[C * row + col];
+    }
+
+    constexpr const T&
+    operator()(size_t row, size_t col) const
+    {
+      return m_matrix[C * row + col];
+    }
+
+    // linear, row-major access
+    constexpr T&
+    operator[](size_t i)
+    {
+      return m_matrix[i];
+    }
+
+    constexpr const T&
+    operator[](size_t i) const
+    {
+      return m_matrix[i];
+    }
+
+    constexpr fixed_matrix&
+    operator+=(const fixed_matrix& other)
+    {
+      for (size_t i = 0; i < R * C; ++i)
+        m_matrix[i] += other.m_matrix[i];
+      return *this;
+    }
+
+    constexpr fixed_matrix&
+    operator-=(const fixed_matrix& other)
+    {
+      for (size_t i = 0; i < R * C; ++i)
+        m_matrix[i] -= other.m_matrix[i];
+      return *this;
+    }
+
+    // Only a C x C right operand keeps the shape
+    constexpr fixed_matrix&
+    operator*=(const fixed_matrix<C, C, T>& other)
+    {
+      *this = *this * other;
+      return *this;
+    }
+
+    // leaves zeros untouched, like basic_matrix
+    constexpr fixed_matrix&
+    operator*=(T k)
+    {
+      for (size_t i = 0; i < R * C; ++i)
+        if (m_matrix[i] != T(0))
+          m_matrix[i] *= k;
+      return *this;
+    }
+
+    constexpr fixed_matrix&
+    operator^=(unsigned long k)
+    {
+      static_assert(R == C, "Only square matrices can be raised to a power");
+
+      fixed_matrix result;
+      for (size_t i = 0; i < R; ++i)
+        result(i, i) = T(1);
+      fixed_matrix base = *this;
+      for ( ; k > 0; k >>= 1)
+      {
+        if (k & 1)
+          result = result * base;
+        if (k > 1)
+          base = base * base;
+      }
+
+      *this = result;
+      return *this;
+    }
+
+    constexpr bool
+    isZeroMatrix() const
+    {
+      for (size_t i = 0; i < R * C; ++i)
+        if (m_matrix[i] != T(0))
+          return false;
+      return true;
+    }
+
+  private:
+    T m_matrix[R * C];
+  };
+
+  template <size_t N, typename T = elem_t>
+  constexpr fixed_matrix<N, N, T>
+  identity()
+  {
+    fixed_matrix<N, N, T> I;
+    for (size_t i = 0; i < N; ++i)
+      I(i, i) = T(1);
+    return I;
+  }
+
+  template <size_t R, size_t C, typename T = elem_t>
+  constexpr fixed_matrix<R, C, T>
+  zero()
+  {
+    return fixed_matrix<R, C, T>();
+  }
+
+  template <size_t R, size_t C, typename T>
+  constexpr fixed_matrix<R, C, T>
+  operator+(fixed_matrix<R, C, T> A, const fixed_matrix<R, C, T>& B)
+  {
+    return A += B;
+  }
+
+  template <size_t R, size_t C, typename T>
+  constexpr fixed_matrix<R, C, T>
+  operator-(fixed_matrix<R, C, T> A, const fixed_matrix<R, C, T>& B)
+  {
+    return A -= B;
+  }
+
+  template <size_t R, size_t C, typename T>
+  constexpr fixed_matrix<R, C, T>
+  operator-(fixed_matrix<R, C, T> A)
+  {
+    return A *= T(-1);
+  }
+
+  template <size_t R, size_t K, size_t C, typename T>
+  constexpr fixed_matrix<R, C, T>
+  operator*(const fixed_matrix<R, K, T>& A, const fixed_matrix<K, C, T>& B)
+  {
+    fixed_matrix<R, C, T> result;
+    for (size_t i = 0; i < R; ++i)
+      for (size_t k = 0; k < K; ++k)
+      {
+        T aik = A(i, k);
+        for (size_t j = 0; j < C; ++j)
+          result(i, j) += aik * B(k, j);
+      }
+    return result;
+  }
+
+  template <size_t R, size_t C, typename T>
+  constexpr fixed_matrix<R, C, T>
+  operator*(T k, fixed_matrix<R, C, T> A)
+  {
+    return A *= k;
+  }
+
+  template <size_t R, size_t C, typename T>
+  constexpr fixed_matrix<R, C, T>
+  operator*(fixed_matrix<R, C, T> A, T k)
+  {
+    return A *= k;
+  }
+
+  template <size_t R, size_t C, typename T>
+  constexpr fixed_matrix<R, C, T>
+  operator^(fixed_matrix<R, C, T> A, unsigned long k)
+  {
+    return A ^= k;
+  }
+
+  template <size_t R, size_t C, typename T>
+  std::ostream&
+  operator<<(std::ostream& output, const fixed_matrix<R, C, T>& A)
+  {
+    output << std::left;
+    for (size_t i = 0; i < R; ++i)
+    {
+      for (size_t j = 0; j < C; ++j)
+        output << std::setw(10) << A(i, j) << ' ';
+      output << '\n';
+    }
+
+    return output;
+  }
+
+  template <size_t R, size_t C, typename T>
+  bool
+  operator==(const fixed_matrix<R, C, T>& A, const fixed_matrix<R, C, T>& B)
+  {
+    for (size_t i = 0; i < R * C; ++i)
+      if (!almostEqual(A[i], B[i]))
+        return false;
+    return true;
+  }
+
+  template <size_t R, size_t C, typename T>
+  bool
+  operator!=(const fixed_matrix<R, C, T>& A, const fixed_matrix<R, C, T>& B)
+  {
+    return !(A == B);
+  }
+
+  template <size_t R, size_t C, typename T>
+  constexpr fixed_matrix<C, R, T>
+  transpose(const fixed_matrix<R, C, T>& A)
+  {
+    fixed_matrix<C, R, T> transposed;
+    for (size_t i = 0; i < R; ++i)
+      for (size_t j = 0; j < C; ++j)
+        transposed(j, i) = A(i, j);
+    return transposed;
+  }
+
+  namespace detail
+  {
+    // Gaussian elimination with partial pivoting on a copy, for sizes
+    // past the closed forms
+    template <size_t N, typename T>
+    constexpr T
+    eliminationDeterminant(fixed_matrix<N, N, T> A)
+    {
+      T det = T(1);
+      for (size_t j = 0; j < N; ++j)
+      {
+        size_t pivot = j;
+        for (size_t i = j + 1; i < N; ++i)
+          if (magnitude(A(i, j)) > magnitude(A(pivot, j)))
+            pivot = i;
+        if (A(pivot, j) == T(0))
+          return T(0);
+        if (pivot != j)
+        {
+          A.swapRows(pivot, j);
+          det = -det;
+        }
+
+        det *= A(j, j);
+        T inverse = T(1) / A(j, j);
+        for (size_t i = j + 1; i < N; ++i)
+        {
+          T factor = A(i, j) * inverse;
+          for (size_t c = j + 1; c < N; ++c)
+            A(i, c) -= factor * A(j, c);
+        }
+      }
+      return det;
+    }
+
+    // Gauss-Jordan on [A | I]; returns false if a pivot is exactly zero
+    template <size_t N, typename T>
+    constexpr bool
+    eliminationInverse(fixed_matrix<N, N, T> A, fixed_matrix<N, N, T>& inverse)
+    {
+      inverse = identity<N, T>();
+      for (size_t j = 0; j < N; ++j)
+      {
+        size_t pivot = j;
+        for (size_t i = j + 1; i < N; ++i)
+          if (magnitude(A(i, j)) > magnitude(A(pivot, j)))
+            pivot = i;
+        if (A(pivot, j) == T(0))
+          return false;
+        A.swapRows(pivot, j);
+        inverse.swapRows(pivot, j);
+
+        T scale = T(1) / A(j, j);
+        for (size_t c = 0; c < N; ++c)
+        {
+          A(j, c) *= scale;
+          inverse(j, c) *= scale;
+        }
+
+        for (size_t i = 0; i < N; ++i)
+        {
+          if (i == j)
+            continue;
+          T factor = A(i, j);
+          for (size_t c = 0; c < N; ++c)
+          {
+            A(i, c) -= factor * A(j, c);
+            inverse(i, c) -= factor * inverse(j, c);
+          }
+        }
+      }
+      return true;
+    }
+  } // namespace detail
+
+  template <size_t R, size_t C, typename T>
+  constexpr T
+  determinant(const fixed_matrix<R, C, T>& A)
+  {
+    static_assert(R == C, "Determinant not defined for non-square matrices");
+
+    if constexpr (R == 1)
+      return A(0, 0);
+    else if constexpr (R == 2)
+      return A(0, 0) * A(1, 1) - A(0, 1) * A(1, 0);
+    else if constexpr (R == 3)
+      return A(0, 0) * (A(1, 1) * A(2, 2) - A(1, 2) * A(2, 1))
+           - A(0, 1) * (A(1, 0) * A(2, 2) - A(1, 2) * A(2, 0))
+           + A(0, 2) * (A(1, 0) * A(2, 1) - A(1, 1) * A(2, 0));
+    else if constexpr (R == 4)
+    {
+      // 2 x 2 minors of the top two rows (s) and the bottom two (c)
+      T s0 = A(0, 0) * A(1, 1) - A(1, 0) * A(0, 1);
+      T s1 = A(0, 0) * A(1, 2) - A(1, 0) * A(0, 2);
+      T s2 = A(0, 0) * A(1, 3) - A(1, 0) * A(0, 3);
+      T s3 = A(0, 1) * A(1, 2) - A(1, 1) * A(0, 2);
+      T s4 = A(0, 1) * A(1, 3) - A(1, 1) * A(0, 3);
+      T s5 = A(0, 2) * A(1, 3) - A(1, 2) * A(0, 3);
+      T c5 = A(2, 2) * A(3, 3) - A(3, 2) * A(2, 3);
+      T c4 = A(2, 1) * A(3, 3) - A(3, 1) * A(2, 3);
+      T c3 = A(2, 1) * A(3, 2) - A(3, 1) * A(2, 2);
+      T c2 = A(2, 0) * A(3, 3) - A(3, 0) * A(2, 3);
+      T c1 = A(2, 0) * A(3, 2) - A(3, 0) * A(2, 2);
+      T c0 = A(2, 0) * A(3, 1) - A(3, 0) * A(2, 1);
+      return s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0;
+    }
+    else
+    {
+      static_assert(!std::is_integral_v<T>,
+                    "Determinants past 4 x 4 need a field type");
+      return detail::eliminationDeterminant(A);
+    }
+  }
+
+  // Closed-form adjugate / determinant up to 4 x 4. A singular matrix is
+  // reported and returned unchanged, as basic_matrix's inverse does.
+  template <size_t R, size_t C, typename T>
+  constexpr fixed_matrix<R, C, T>
+  inverse(const fixed_matrix<R, C, T>& A)
+  {
+    static_assert(R == C, "Inverse not defined for non-square matrices");
+    static_assert(!std::is_integral_v<T>, "Inverse needs a field type");
+
+    fixed_matrix<R, C, T> inv;
+    if constexpr (R <= 3)
+    {
+      T det = determinant(A);
+      if (det == T(0))
+      {
+        std::cerr << "Inverse does not exist.\n";
+        return A;
+      }
+
+      T invDet = T(1) / det;
+      if constexpr (R == 1)
+        inv(0, 0) = invDet;
+      else if constexpr (R == 2)
+        inv = { A(1, 1) * invDet, -A(0, 1) * invDet,
+                -A(1, 0) * invDet, A(0, 0) * invDet };
+      else
+      {
+        for (size_t i = 0; i < 3; ++i)
+          for (size_t j = 0; j < 3; ++j)
+          {
+            // cofactor (j, i), with the cyclic index trick supplying the sign
+            size_t r1 = (j + 1) % 3, r2 = (j + 2) % 3;
+            size_t c1 = (i + 1) % 3, c2 = (i + 2) % 3;
+            inv(i, j) = (A(r1, c1) * A(r2, c2) - A(r1, c2) * A(r2, c1)) * invDet;
+          }
+      }
+    }
+    else if constexpr (R == 4)
+    {
+      T s0 = A(0, 0) * A(1, 1) - A(1, 0) * A(0, 1);
+      T s1 = A(0, 0) * A(1, 2) - A(1, 0) * A(0, 2);
+      T s2 = A(0, 0) * A(1, 3) - A(1, 0) * A(0, 3);
+      T s3 = A(0, 1) * A(1, 2) - A(1, 1) * A(0, 2);
+      T s4 = A(0, 1) * A(1, 3) - A(1, 1) * A(0, 3);
+      T s5 = A(0, 2) * A(1, 3) - A(1, 2) * A(0, 3);
+      T c5 = A(2, 2) * A(3, 3) - A(3, 2) * A(2, 3);
+      T c4 = A(2, 1) * A(3, 3) - A(3, 1) * A(2, 3);
+      T c3 = A(2, 1) * A(3, 2) - A(3, 1) * A(2, 2);
+      T c2 = A(2, 0) * A(3, 3) - A(3, 0) * A(2, 3);
+      T c1 = A(2, 0) * A(3, 2) - A(3, 0) * A(2, 2);
+      T c0 = A(2, 0) * A(3, 1) - A(3, 0) * A(2, 1);
+      T det = s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0;
+      if (det == T(0))
+      {
+        std::cerr << "Inverse does not exist.\n";
+        return A;
+      }
+
+      T invDet = T(1) / det;
+      inv = { ( A(1, 1) * c5 - A(1, 2) * c4 + A(1, 3) * c3) * invDet,
+              (-A(0, 1) * c5 + A(0, 2) * c4 - A(0, 3) * c3) * invDet,
+              ( A(3, 1) * s5 - A(3, 2) * s4 + A(3, 3) * s3) * invDet,
+              (-A(2, 1) * s5 + A(2, 2) * s4 - A(2, 3) * s3) * invDet,
+              (-A(1, 0) * c5 + A(1, 2) * c2 - A(1, 3) * c1) * invDet,
+              ( A(0, 0) * c5 - A(0, 2) * c2 + A(0, 3) * c1) * invDet,
+              (-A(3, 0) * s5 + A(3, 2) * s2 - A(3, 3) * s1) * invDet,
+              ( A(2, 0) * s5 - A(2, 2) * s2 + A(2, 3) * s1) * invDet,
+              ( A(1, 0) * c4 - A(1, 1) * c2 + A(1, 3) * c0) * invDet,
+              (-A(0, 0) * c4 + A(0, 1) * c2 - A(0, 3) * c0) * invDet,
+              ( A(3, 0) * s4 - A(3, 1) * s2 + A(3, 3) * s0) * invDet,
+              (-A(2, 0) * s4 + A(2, 1) * s2 - A(2, 3) * s0) * invDet,
+              (-A(1, 0) * c3 + A(1, 1) * c1 - A(1, 2) * c0) * invDet,
+              ( A(0, 0) * c3 - A(0, 1) * c1 + A(0, 2) * c0) * invDet,
+              (-A(3, 0) * s3 + A(3, 1) * s1 - A(3, 2) * s0) * invDet,
+              ( A(2, 0) * s3 - A(2, 1) * s1 + A(2, 2) * s0) * invDet };
+    }
+    else if (!detail::eliminationInverse(A, inv))
+    {
+      std::cerr << "Inverse does not exist.\n";
+      return A;
+    }
+
+    return inv;
+  }
+
+  /**********************************************************************/
+  // Vectors
+  //
+  // basic_vector is a dense column with the same aligned storage as a
+  // matrix, kept as an n x 1 basic_matrix so that column() hands it to
+  // anything that takes a matrix without a copy. The level-2 operations
+  // below write into outputs the caller already has, so an iterative
+  // method can run without allocating. A matrix product with a
+  // single-column (or single-row) operand takes the same kernels through
+  // operator*.
+  template <typename T = elem_t>
+  class basic_vector
+  {
+  public:
+    using value_type = T;
+
+    basic_vector() = default;
+
+    explicit basic_vector(size_t n)
+      : m_data(n, 1, T(0))
+    {
+    }
+
+    basic_vector(size_t n, T init)
+      : m_data(n, 1, init)
+    {
+    }
+
+    basic_vector(std::initializer_list<T> values)
+      : m_data(values.size(), 1)
+    {
+      std::copy(values.begin(), values.end(), m_data.begin());
+    }
+
+    // The elements of a single-column or single-row matrix
+    explicit basic_vector(const basic_matrix<T>& A)
+    {
+      if (A.rows() != 1 && A.cols() != 1)
+      {
+        std::cerr << "Cannot make a vector from a matrix with several rows and columns\n";
+        return;
+      }
+
+      m_data = basic_matrix<T>(A.rows() * A.cols(), 1);
+      std::copy(A.begin(), A.begin() + A.rows() * A.cols(), m_data.begin());
+    }
+
+    size_t
+    size() const
+    {
+      return m_data.rows();
+    }
+
+    T&
+    operator[](size_t i)
+    {
+      return m_data.begin()[i];
+    }
+
+    T
+    operator[](size_t i) const
+    {
+      return m_data.begin()[i];
+    }
+
+    T*
+    data()
+    {
+      return m_data.begin();
+    }
+
+    const T*
+    data() const
+    {
+      return m_data.begin();
+    }
+
+    T*
+    begin()
+    {
+      return m_data.begin();
+    }
+
+    const T*
+    begin() const
+    {
+      return m_data.begin();
+    }
+
+    T*
+    end()
+    {
+      return m_data.begin() + size();
+    }
+
+    const T*
+    end() const
+    {
+      return m_data.begin() + size();
+    }
+
+    // The same elements as an n x 1 matrix
+    const basic_matrix<T>&
+    column() const
+    {
+      return m_data;
+    }
+
+    basic_vector&
+    operator+=(const basic_vector& other)
+    {
+      if (size() == other.size())
+        detail::simd<T>().add(size(), data(), other.data());
+      else
+        std::cerr << "Cannot add vectors of different sizes\n";
+      return *this;
+    }
+
+    basic_vector&
+    operator-=(const basic_vector& other)
+    {
+      if (size() == other.size())
+        detail::simd<T>().sub(size(), data(), other.data());
+      else
+        std::cerr << "Cannot subtract vectors of different sizes\n";
+      return *this;
+    }
+
+    basic_vector&
+    operator*=(T k)
+    {
+      detail::simd<T>().scale(size(), data(), k);
+      return *this;
+    }
+
+  private:
+    basic_matrix<T> m_data;
+  };
+
+  using vector = basic_vector<elem_t>;
+
+  // y = alpha A x + beta y
+  template <typename T>
+  void
+  gemv(const basic_matrix<T>& A, const basic_vector<T>& x, basic_vector<T>& y,
+       T alpha = T(1), T beta = T(0))
+  {
+    if (A.cols() != x.size() || A.rows() != y.size())
+    {
+      std::cerr << "Cannot multiply, sizes differ\n";
+      return;
+    }
+    detail::gemv(A.rows(), A.cols(), A.begin(), A.cols(), x.data(), y.data(), alpha, beta);
+  }
+
+  // y = alpha A^T x + beta y
+  template <typename T>
+  void
+  gemvTransposed(const basic_matrix<T>& A, const basic_vector<T>& x, basic_vector<T>& y,
+                 T alpha = T(1), T beta = T(0))
+  {
+    if (A.rows() != x.size() || A.cols() != y.size())
+    {
+      std::cerr << "Cannot multiply, sizes differ\n";
+      return;
+    }
+    detail::gemvTransposed(A.rows(), A.cols(), A.begin(), A.cols(), x.data(), y.data(), alpha, beta);
+  }
+
+  // A += alpha x y^T
+  template <typename T>
+  void
+  ger(basic_matrix<T>& A, const basic_vector<T>& x, const basic_vector<T>& y, T alpha = T(1))
+  {
+    if (A.rows() != x.size() || A.cols() != y.size())
+    {
+      std::cerr << "Cannot update, sizes differ\n";
+      return;
+    }
+    detail::ger(A.rows(), A.cols(), A.begin(), A.cols(), x.data(), y.data(), alpha);
+  }
+
+  // x^T y, unconjugated; the same for any thread count
+  template <typename T>
+  T
+  dot(const basic_vector<T>& x, const basic_vector<T>& y)
+  {
+    if (x.size() != y.size())
+    {
+      std::cerr << "Cannot take dot product, sizes differ\n";
+      return T(0);
+    }
+    return detail::parallelDot(x.size(), x.data(), y.data());
+  }
+
+  // y += alpha x
+  template <typename T>
+  void
+  axpy(T alpha, const basic_vector<T>& x, basic_vector<T>& y)
+  {
+    if (x.size() != y.size())
+    {
+      std::cerr << "Cannot add vectors of different sizes\n";
+      return;
+    }
+    detail::axpy(x.size(), alpha, x.data(), y.data());
+  }
+
+  // Euclidean norm
+  template <typename T>
+  detail::real_t<T>
+  norm(const basic_vector<T>& x)
+  {
+    detail::real_t<T> sum = 0;
+    for (size_t i = 0; i < x.size(); ++i)
+    {
+      detail::real_t<T> a = std::abs(x[i]);
+      sum += a * a;
+    }
+    return std::sqrt(sum);
+  }
+
+  template <typename T>
+  basic_vector<T>
+  operator*(const basic_matrix<T>& A, const basic_vector<T>& x)
+  {
+    basic_vector<T> y(A.rows());
+    gemv(A, x, y);
+    return y;
+  }
+
+  // x^T A, as a vector
+  template <typename T>
+  basic_vector<T>
+  operator*(const basic_vector<T>& x, const basic_matrix<T>& A)
+  {
+    basic_vector<T> y(A.cols());
+    gemvTransposed(A, x, y);
+    return y;
+  }
+
+  template <typename T>
+  basic_vector<T>
+  operator+(basic_vector<T> x, const basic_vector<T>& y)
+  {
+    return x += y;
+  }
+
+  template <typename T>
+  basic_vector<T>
+  operator-(basic_vector<T> x, const basic_vector<T>& y)
+  {
+    return x -= y;
+  }
+
+  template <typename T>
+  basic_vector<T>
+  operator*(basic_vector<T> x, T k)
+  {
+    return x *= k;
+  }
+
+  template <typename T>
+  std::ostream&
+  operator<<(std::ostream& output, const basic_vector<T>& x)
+  {
+    return output << x.column();
+  }
+
+  /**********************************************************************/
+  // Sparse matrices
+  //
+  // sparse_matrix stores only its nonzeros in compressed sparse row form:
+  // rowStart[i] .. rowStart[i + 1] index the column numbers and values
+  // of row i, columns ascending. The compressed column form of A is the
+  // row form of A^T, which transpose builds in O(nnz). Products touch
+  // only stored entries: sparse x dense (SpMV when the dense side is a
+  // column) and dense x sparse scatter rows, and sparse x sparse uses
+  // Gustavson's row-by-row algorithm with a dense accumulator, counting
+  // each row's nonzeros before filling it so rows can be produced in
+  // parallel straight into the final arrays.
+  template <typename T = elem_t>
+  class sparse_matrix
+  {
+  public:
+    using value_type = T;
+
+    sparse_matrix() = default;
+
+    // rows x cols with no stored entries
+    sparse_matrix(size_t rows, size_t cols)
+      : m_rows(rows),
+        m_cols(cols),
+        m_rowStart(rows + 1, 0)
+    {
+    }
+
+    // Keeps the nonzero entries of A
+    explicit sparse_matrix(const basic_matrix<T>& A)
+      : sparse_matrix(A.rows(), A.cols())
+    {
+      for (size_t i = 0; i < m_rows; ++i)
+      {
+        for (size_t j = 0; j < m_cols; ++j)
+          if (A(i, j) != T(0))
+          {
+            m_columns.push_back(j);
+            m_values.push_back(A(i, j));
+          }
+        m_rowStart[i + 1] = m_columns.size();
+      }
+    }
+
+    // From (row, col, value) triplets in any order; duplicates are summed
+    sparse_matrix(size_t rows, size_t cols, std::vector<std::tuple<size_t, size_t, T>> entries)
+      : sparse_matrix(rows, cols)
+    {
+      std::sort(entries.begin(), entries.end(), [](const auto& a, const auto& b) {
+        return std::tie(std::get<0>(a), std::get<1>(a)) < std::tie(std::get<0>(b), std::get<1>(b));
+      });
+
+      bool any = false;
+      for (const auto& [i, j, value] : entries)
+      {
+        if (i >= rows || j >= cols)
+        {
+          std::cerr << "Sparse entry out of range, ignoring it\n";
+          continue;
+        }
+
+        // Sorted, so a duplicate follows its first occurrence directly
+        if (any && m_rowStart[i + 1] == m_columns.size() && m_columns.back() == j)
+          m_values.back() += value;
+        else
+        {
+          m_columns.push_back(j);
+          m_values.push_back(value);
+        }
+        m_rowStart[i + 1] = m_columns.size();
+        any = true;
+      }
+
+      // Rows without entries end where the previous row ended
+      for (size_t i = 0; i < rows; ++i)
+        m_rowStart[i + 1] = std::max(m_rowStart[i + 1], m_rowStart[i]);
+    }
+
+    // Adopts ready-made CSR arrays
+    sparse_matrix(size_t rows, size_t cols, std::vector<size_t> rowStart,
+                  std::vector<size_t> columns, std::vector<T> values)
+      : m_rows(rows),
+        m_cols(cols),
+        m_rowStart(std::move(rowStart)),
+        m_columns(std::move(columns)),
+        m_values(std::move(values))
+    {
+    }
+
+    size_t
+    rows() const
+    {
+      return m_rows;
+    }
+
+    size_t
+    cols() const
+    {
+      return m_cols;
+    }
+
+    // number of stored entries
+    size_t
+    nonZeros() const
+    {
+      return m_values.size();
+    }
+
+    const std::vector<size_t>&
+    rowStart() const
+    {
+      return m_rowStart;
+    }
+
+    const std::vector<size_t>&
+    columns() const
+    {
+      return m_columns;
+    }
+
+    const std::vector<T>&
+    values() const
+    {
+      return m_values;
+    }
+
+    // Binary search within the row; zero when not stored
+    T
+    operator()(size_t row, size_t col) const
+    {
+      auto first = m_columns.begin() + m_rowStart[row];
+      auto last = m_columns.begin() + m_rowStart[row + 1];
+      auto it = std::lower_bound(first, last, col);
+      if (it == last || *it != col)
+        return T(0);
+      return m_values[it - m_columns.begin()];
+    }
+
+    basic_matrix<T>
+    dense() const
+    {
+      basic_matrix<T> A(m_rows, m_cols, T(0));
+      for (size_t i = 0; i < m_rows; ++i)
+        for (size_t p = m_rowStart[i]; p < m_rowStart[i + 1]; ++p)
+          A(i, m_columns[p]) = m_values[p];
+      return A;
+    }
+
+    sparse_matrix&
+    operator*=(T k)
+    {
+      for (T& value : m_values)
+        value *= k;
+      return *this;
+    }
+
+  private:
+    size_t m_rows = 0;
+    size_t m_cols = 0;
+    std::vector<size_t> m_rowStart = std::vector<size_t>(1, 0);
+    std::vector<size_t> m_columns;
+    std::vector<T> m_values;
+  };
+
+  // Counting sort by column: O(nnz + cols), and the result's rows come
+  // out with ascending columns because A's rows are visited in order
+  template <typename T>
+  sparse_matrix<T>
+  transpose(const sparse_matrix<T>& A)
+  {
+    const auto& start = A.rowStart();
+    const auto& columns = A.columns();
+    const auto& values = A.values();
+
+    std::vector<size_t> rowStart(A.cols() + 1, 0);
+    for (size_t j : columns)
+      ++rowStart[j + 1];
+    for (size_t j = 0; j < A.cols(); ++j)
+      rowStart[j + 1] += rowStart[j];
+
+    std::vector<size_t> next(rowStart.begin(), rowStart.end() - 1);
+    std::vector<size_t> transposedColumns(A.nonZeros());
+    std::vector<T> transposedValues(A.nonZeros());
+    for (size_t i = 0; i < A.rows(); ++i)
+      for (size_t p = start[i]; p < start[i + 1]; ++p)
+      {
+        size_t q = next[columns[p]]++;
+        transposedColumns[q] = i;
+        transposedValues[q] = values[p];
+      }
+
+    return sparse_matrix<T>(A.cols(), A.rows(), std::move(rowStart),
+                            std::move(transposedColumns), std::move(transposedValues));
+  }
+
+  // Sparse x dense. Each stored A(i, k) adds A(i, k) * B(k, :) to C(i, :);
+  // for a single column this is SpMV.
+  template <typename T>
+  basic_matrix<T>
+  operator*(const sparse_matrix<T>& A, const basic_matrix<T>& B)
+  {
+    if (A.cols() != B.rows())
+    {
+      std::cerr << "Cannot multiply, returning first matrix\n";
+      return A.dense();
+    }
+
+    const auto& start = A.rowStart();
+    const auto& columns = A.columns();
+    const auto& values = A.values();
+    size_t n = B.cols();
+    basic_matrix<T> C(A.rows(), n, T(0));
+
+    detail::forRowRanges(A.rows(), A.nonZeros() * n, [&](size_t first, size_t last) {
+      for (size_t i = first; i < last; ++i)
+      {
+        if (n == 1)
+        {
+          T sum = T(0);
+          for (size_t p = start[i]; p < start[i + 1]; ++p)
+            sum += values[p] * B(columns[p], 0);
+          C(i, 0) = sum;
+        }
+        else
+          for (size_t p = start[i]; p < start[i + 1]; ++p)
+            detail::simd<T>().axpy(n, &C(i, 0), B.begin() + columns[p] * n, values[p], false);
+      }
+    });
+    return C;
+  }
+
+  // Dense x sparse. Row i of C gathers A(i, k) * B(k, :) over the stored
+  // entries of each row k of B.
+  template <typename T>
+  basic_matrix<T>
+  operator*(const basic_matrix<T>& A, const sparse_matrix<T>& B)
+  {
+    if (A.cols() != B.rows())
+    {
+      std::cerr << "Cannot multiply, returning first matrix\n";
+      return A;
+    }
+
+    const auto& start = B.rowStart();
+    const auto& columns = B.columns();
+    const auto& values = B.values();
+    basic_matrix<T> C(A.rows(), B.cols(), T(0));
+
+    detail::forRowRanges(A.rows(), A.rows() * B.nonZeros(), [&](size_t first, size_t last) {
+      for (size_t i = first; i < last; ++i)
+      {
+        T* ci = &C(i, 0);
+        for (size_t k = 0; k < A.cols(); ++k)
+        {
+          T aik = A(i, k);
+          if (aik == T(0))
+            continue;
+          for (size_t p = start[k]; p < start[k + 1]; ++p)
+            ci[columns[p]] += aik * values[p];
+        }
+      }
+    });
+    return C;
+  }
+
+  // Sparse x sparse (SpGEMM)
+  template <typename T>
+  sparse_matrix<T>
+  operator*(const sparse_matrix<T>& A, const sparse_matrix<T>& B)
+  {
+    if (A.cols() != B.rows())
+    {
+      std::cerr << "Cannot multiply, returning first matrix\n";
+      return A;
+    }
+
+    const auto& aStart = A.rowStart();
+    const auto& aColumns = A.columns();
+    const auto& aValues = A.values();
+    const auto& bStart = B.rowStart();
+    const auto& bColumns = B.columns();
+    const auto& bValues = B.values();
+    constexpr size_t unseen = std::numeric_limits<size_t>::max();
+
+    // Flops, estimated as the sum over stored A(i, k) of nnz(B(k, :))
+    size_t work = 0;
+    for (size_t k : aColumns)
+      work += bStart[k + 1] - bStart[k];
+
+    // Symbolic pass: the number of distinct columns in each result row
+    std::vector<size_t> rowStart(A.rows() + 1, 0);
+    detail::forRowRanges(A.rows(), work, [&](size_t first, size_t last) {
+      std::vector<size_t> marker(B.cols(), unseen);
+      for (size_t i = first; i < last; ++i)
+      {
+        size_t count = 0;
+        for (size_t p = aStart[i]; p < aStart[i + 1]; ++p)
+        {
+          size_t k = aColumns[p];
+          for (size_t q = bStart[k]; q < bStart[k + 1]; ++q)
+            if (marker[bColumns[q]] != i)
+            {
+              marker[bColumns[q]] = i;
+              ++count;
+            }
+        }
+        rowStart[i + 1] = count;
+      }
+    });
+    for (size_t i = 0; i < A.rows(); ++i)
+      rowStart[i + 1] += rowStart[i];
+
+    // Numeric pass into the final arrays
+    std::vector<size_t> columns(rowStart.back());
+    std::vector<T> values(rowStart.back());
+    detail::forRowRanges(A.rows(), work, [&](size_t first, size_t last) {
+      std::vector<size_t> marker(B.cols(), unseen);
+      std::vector<T> accumulator(B.cols());
+      for (size_t i = first; i < last; ++i)
+      {
+        size_t end = rowStart[i];
+        for (size_t p = aStart[i]; p < aStart[i + 1]; ++p)
+        {
+          size_t k = aColumns[p];
+          T aik = aValues[p];
+          for (size_t q = bStart[k]; q < bStart[k + 1]; ++q)
+          {
+            size_t j = bColumns[q];
+            if (marker[j] != i)
+            {
+              marker[j] = i;
+              columns[end++] = j;
+              accumulator[j] = aik * bValues[q];
+            }
+            else
+              accumulator[j] += aik * bValues[q];
+          }
+        }
+
+        std::sort(columns.begin() + rowStart[i], columns.begin() + end);
+        for (size_t p = rowStart[i]; p < end; ++p)
+          values[p] = accumulator[columns[p]];
+      }
+    });
+
+    return sparse_matrix<T>(A.rows(), B.cols(), std::move(rowStart),
+                            std::move(columns), std::move(values));
+  }
+
+  template <typename T>
+  sparse_matrix<T>
+  operator*(sparse_matrix<T> A, typename sparse_matrix<T>::value_type k)
+  {
+    return A *= k;
+  }
+
+  template <typename T>
+  sparse_matrix<T>
+  operator*(typename sparse_matrix<T>::value_type k, sparse_matrix<T> A)
+  {
+    return A *= k;
+  }
+
+  template <typename T>
+  std::ostream&
+  operator<<(std::ostream& output, const sparse_matrix<T>& A)
+  {
+    return output << A.dense();
+  }
+
+  /**********************************************************************/
+  // Structured matrices
+  //
+  // Square matrices whose structure is known up front store only the
+  // entries that can be nonzero. symmetric_matrix and triangular_matrix
+  // keep one triangle packed row by row: row i holds columns 0..i at
+  // offset i (i + 1) / 2, so n (n + 1) / 2 elements instead of n^2. The
+  // same array read column by column is the upper triangle of the
+  // transpose, so an upper triangular_matrix is a flag on that layout
+  // and transposing one moves no data. banded_matrix keeps the diagonals
+  // from -lower to +upper, one row of lower + upper + 1 slots at a time,
+  // and band_lu_factorization solves banded systems in
+  // O(n lower (lower + upper)). Products with dense matrices visit only
+  // the stored entries and run a block of rows per thread.
+  enum class triangle
+  {
+    lower,
+    upper
+  };
+
+  namespace detail
+  {
+    // Offset of (i, j), j <= i, in a packed lower triangle
+    constexpr size_t
+    packedIndex(size_t i, size_t j)
+    {
+      return i * (i + 1) / 2 + j;
+    }
+  } // namespace detail
+
+  template <typename T = elem_t>
+  class symmetric_matrix
+  {
+  public:
+    using value_type = T;
+
+    symmetric_matrix() = default;
+
+    explicit symmetric_matrix(size_t size, T init = T(0))
+      : m_size(size),
+        m_packed(size * (size + 1) / 2, init)
+    {
+    }
+
+    // Reads the lower triangle of A
+    explicit symmetric_matrix(const basic_matrix<T>& A)
+      : symmetric_matrix(A.rows())
+    {
+      if (A.rows() != A.cols())
+      {
+        std::cerr << "Symmetric matrix must be square, returning empty matrix\n";
+        *this = symmetric_matrix();
+        return;
+      }
+
+      for (size_t i = 0; i < m_size; ++i)
+        std::copy_n(A.begin() + i * m_size, i + 1, m_packed.begin() + detail::packedIndex(i, 0));
+    }
+
+    size_t
+    size() const
+    {
+      return m_size;
+    }
+
+    size_t
+    rows() const
+    {
+      return m_size;
+    }
+
+    size_t
+    cols() const
+    {
+      return m_size;
+    }
+
+    // (i, j) and (j, i) are the same element
+    T&
+    operator()(size_t row, size_t col)
+    {
+      return row >= col ? m_packed[detail::packedIndex(row, col)]
+                        : m_packed[detail::packedIndex(col, row)];
+    }
+
+    const T&
+    operator()(size_t row, size_t col) const
+    {
+      return row >= col ? m_packed[detail::packedIndex(row, col)]
+                        : m_packed[detail::packedIndex(col, row)];
+    }
+
+    // The lower triangle, row by row
+    const std::vector<T>&
+    packed() const
+    {
+      return m_packed;
+    }
+
+    T*
+    data()
+    {
+      return m_packed.data();
+    }
+
+    basic_matrix<T>
+    dense() const
+    {
+      basic_matrix<T> A(m_size, m_size);
+      for (size_t i = 0; i < m_size; ++i)
+        for (size_t j = 0; j <= i; ++j)
+          A(i, j) = A(j, i) = m_packed[detail::packedIndex(i, j)];
+      return A;
+    }
+
+  private:
+    size_t m_size = 0;
+    std::vector<T> m_packed;
+  };
+
+  template <typename T = elem_t>
+  class triangular_matrix
+  {
+  public:
+    using value_type = T;
+
+    triangular_matrix() = default;
+
+    explicit triangular_matrix(size_t size, triangle which = triangle::lower, T init = T(0))
+      : m_size(size),
+        m_upper(which == triangle::upper),
+        m_packed(size * (size + 1) / 2, init)
+    {
+    }
+
+    // Reads one triangle of A; the other is taken to be zero
+    explicit triangular_matrix(const basic_matrix<T>& A, triangle which = triangle::lower)
+      : triangular_matrix(A.rows(), which)
+    {
+      if (A.rows() != A.cols())
+      {
+        std::cerr << "Triangular matrix must be square, returning empty matrix\n";
+        *this = triangular_matrix();
+        return;
+      }
+
+      for (size_t i = 0; i < m_size; ++i)
+        for (size_t j = 0; j <= i; ++j)
+          m_packed[detail::packedIndex(i, j)] = m_upper ? A(j, i) : A(i, j);
+    }
+
+    size_t
+    size() const
+    {
+      return m_size;
+    }
+
+    size_t
+    rows() const
+    {
+      return m_size;
+    }
+
+    size_t
+    cols() const
+    {
+      return m_size;
+    }
+
+    triangle
+    which() const
+    {
+      return m_upper ? triangle::upper : triangle::lower;
+    }
+
+    // Zero outside the triangle
+    T
+    operator()(size_t row, size_t col) const
+    {
+      if (m_upper)
+        std::swap(row, col);
+      return col <= row ? m_packed[detail::packedIndex(row, col)] : T(0);
+    }
+
+    // Only entries inside the triangle can be written
+    void
+    set(size_t row, size_t col, T value)
+    {
+      if (m_upper)
+        std::swap(row, col);
+      if (col > row || row >= m_size)
+      {
+        std::cerr << "Entry is outside the triangle, ignoring write\n";
+        return;
+      }
+      m_packed[detail::packedIndex(row, col)] = value;
+    }
+
+    // The lower triangle row by row, or the upper one column by column
+    const std::vector<T>&
+    packed() const
+    {
+      return m_packed;
+    }
+
+    T*
+    data()
+    {
+      return m_packed.data();
+    }
+
+    basic_matrix<T>
+    dense() const
+    {
+      basic_matrix<T> A(m_size, m_size, T(0));
+      for (size_t i = 0; i < m_size; ++i)
+        for (size_t j = 0; j <= i; ++j)
+          (m_upper ? A(j, i) : A(i, j)) = m_packed[detail::packedIndex(i, j)];
+      return A;
+    }
+
+    // Flips between L and L^T without touching the elements
+    triangular_matrix&
+    transposeInPlace()
+    {
+      m_upper = !m_upper;
+      return *this;
+    }
+
+  private:
+    size_t m_size = 0;
+    bool m_upper = false;
+    std::vector<T> m_packed;
+  };
+
+  template <typename T = elem_t>
+  class banded_matrix
+  {
+  public:
+    using value_type = T;
+
+    banded_matrix() = default;
+
+    // size x size with nonzeros allowed from lower diagonals below the
+    // main one to upper diagonals above it
+    banded_matrix(size_t size, size_t lower, size_t upper, T init = T(0))
+      : m_size(size),
+        m_lower(lower),
+        m_upper(upper),
+        m_band(size * (lower + upper + 1), init)
+    {
+    }
+
+    // Keeps the band of A and drops everything outside it
+    banded_matrix(const basic_matrix<T>& A, size_t lower, size_t upper)
+      : banded_matrix(A.rows(), lower, upper)
+    {
+      if (A.rows() != A.cols())
+      {
+        std::cerr << "Banded matrix must be square, returning empty matrix\n";
+        *this = banded_matrix();
+        return;
+      }
+
+      for (size_t i = 0; i < m_size; ++i)
+        for (size_t j = first(i); j < last(i); ++j)
+          set(i, j, A(i, j));
+    }
+
+    size_t
+    size() const
+    {
+      return m_size;
+    }
+
+    size_t
+    rows() const
+    {
+      return m_size;
+    }
+
+    size_t
+    cols() const
+    {
+      return m_size;
+    }
+
+    size_t
+    lower() const
+    {
+      return m_lower;
+    }
+
+    size_t
+    upper() const
+    {
+      return m_upper;
+    }
+
+    // Columns [first(i), last(i)) of row i lie in the band
+    size_t
+    first(size_t row) const
+    {
+      return row > m_lower ? row - m_lower : 0;
+    }
+
+    size_t
+    last(size_t row) const
+    {
+      return std::min(m_size, row + m_upper + 1);
+    }
+
+    // Zero outside the band
+    T
+    operator()(size_t row, size_t col) const
+    {
+      if (col + m_lower < row || col > row + m_upper)
+        return T(0);
+      return m_band[row * (m_lower + m_upper + 1) + col + m_lower - row];
+    }
+
+    // Only entries inside the band can be written
+    void
+    set(size_t row, size_t col, T value)
+    {
+      if (col + m_lower < row || col > row + m_upper || row >= m_size || col >= m_size)
+      {
+        std::cerr << "Entry is outside the band, ignoring write\n";
+        return;
+      }
+      m_band[row * (m_lower + m_upper + 1) + col + m_lower - row] = value;
+    }
+
+    basic_matrix<T>
+    dense() const
+    {
+      basic_matrix<T> A(m_size, m_size, T(0));
+      for (size_t i = 0; i < m_size; ++i)
+        for (size_t j = first(i); j < last(i); ++j)
+          A(i, j) = (*this)(i, j);
+      return A;
+    }
+
+  private:
+    size_t m_size = 0;
+    size_t m_lower = 0;
+    size_t m_upper = 0;
+    std::vector<T> m_band;
+  };
+
+  /**********************************************************************/
+  // Structured products
+
+  // C(i, :) gathers A(i, j) B(j, :) over the j where row i of A can be
+  // nonzero. Rows of C are independent, so blocks of them go to threads.
+  namespace detail
+  {
+    template <typename A_t, typename T>
+    basic_matrix<T>
+    structuredMultiply(const A_t& A, const basic_matrix<T>& B, size_t work)
+    {
+      size_t n = B.cols();
+      basic_matrix<T> C(A.rows(), n, T(0));
+      forRowRanges(A.rows(), work * n, [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; ++i)
+        {
+          T* ci = &C(i, 0);
+          A.forRow(i, [&](size_t j, T a) {
+            simd<T>().axpy(n, ci, B.begin() + j * n, a, false);
+          });
+        }
+      });
+      return C;
+    }
+
+    // Visits the stored entries of one row as (column, value)
+    template <typename T>
+    struct symmetric_rows
+    {
+      const symmetric_matrix<T>& m;
+
+      size_t
+      rows() const
+      {
+        return m.size();
+      }
+
+      template <typename F>
+      void
+      forRow(size_t i, F f) const
+      {
+        const T* row = &m.packed()[packedIndex(i, 0)];
+        for (size_t j = 0; j <= i; ++j)
+          f(j, row[j]);
+        for (size_t j = i + 1; j < m.size(); ++j)
+          f(j, m.packed()[packedIndex(j, i)]);
+      }
+    };
+
+    template <typename T>
+    struct triangular_rows
+    {
+      const triangular_matrix<T>& m;
+
+      size_t
+      rows() const
+      {
+        return m.size();
+      }
+
+      template <typename F>
+      void
+      forRow(size_t i, F f) const
+      {
+        if (m.which() == triangle::lower)
+        {
+          const T* row = &m.packed()[packedIndex(i, 0)];
+          for (size_t j = 0; j <= i; ++j)
+            f(j, row[j]);
+        }
+        else
+          for (size_t j = i; j < m.size(); ++j)
+            f(j, m.packed()[packedIndex(j, i)]);
+      }
+    };
+
+    template <typename T>
+    struct banded_rows
+    {
+      const banded_matrix<T>& m;
+
+      size_t
+      rows() const
+      {
+        return m.size();
+      }
+
+      template <typename F>
+      void
+      forRow(size_t i, F f) const
+      {
+        for (size_t j = m.first(i); j < m.last(i); ++j)
+          f(j, m(i, j));
+      }
+    };
+  } // namespace detail
+
+  template <typename T>
+  basic_matrix<T>
+  operator*(const symmetric_matrix<T>& A, const basic_matrix<T>& B)
+  {
+    if (A.cols() != B.rows())
+    {
+      std::cerr << "Cannot multiply, returning first matrix\n";
+      return A.dense();
+    }
+    return detail::structuredMultiply(detail::symmetric_rows<T>{ A }, B, A.size() * A.size());
+  }
+
+  template <typename T>
+  basic_matrix<T>
+  operator*(const triangular_matrix<T>& A, const basic_matrix<T>& B)
+  {
+    if (A.cols() != B.rows())
+    {
+      std::cerr << "Cannot multiply, returning first matrix\n";
+      return A.dense();
+    }
+    return detail::structuredMultiply(detail::triangular_rows<T>{ A }, B, A.packed().size());
+  }
+
+  template <typename T>
+  basic_matrix<T>
+  operator*(const banded_matrix<T>& A, const basic_matrix<T>& B)
+  {
+    if (A.cols() != B.rows())
+    {
+      std::cerr << "Cannot multiply, returning first matrix\n";
+      return A.dense();
+    }
+    return detail::structuredMultiply(detail::banded_rows<T>{ A }, B,
+                                      A.size() * (A.lower() + A.upper() + 1));
+  }
+
+  // B A = (A^T B^T)^T, and A^T is free or cheap for every structure
+  template <typename T>
+  basic_matrix<T>
+  operator*(const basic_matrix<T>& B, const symmetric_matrix<T>& A)
+  {
+    if (B.cols() != A.rows())
+    {
+      std::cerr << "Cannot multiply, returning first matrix\n";
+      return B;
+    }
+    return transpose(transpose(A) * transpose(B));
+  }
+
+  template <typename T>
+  basic_matrix<T>
+  operator*(const basic_matrix<T>& B, const triangular_matrix<T>& A)
+  {
+    if (B.cols() != A.rows())
+    {
+      std::cerr << "Cannot multiply, returning first matrix\n";
+      return B;
+    }
+    return transpose(transpose(A) * transpose(B));
+  }
+
+  template <typename T>
+  basic_matrix<T>
+  operator*(const basic_matrix<T>& B, const banded_matrix<T>& A)
+  {
+    if (B.cols() != A.rows())
+    {
+      std::cerr << "Cannot multiply, returning first matrix\n";
+      return B;
+    }
+    return transpose(transpose(A) * transpose(B));
+  }
+
+  template <typename T>
+  symmetric_matrix<T>
+  transpose(const symmetric_matrix<T>& A)
+  {
+    return A;
+  }
+
+  template <typename T>
+  triangular_matrix<T>
+  transpose(triangular_matrix<T> A)
+  {
+    return A.transposeInPlace();
+  }
+
+  template <typename T>
+  banded_matrix<T>
+  transpose(const banded_matrix<T>& A)
+  {
+    banded_matrix<T> transposed(A.size(), A.upper(), A.lower());
+    for (size_t i = 0; i < A.size(); ++i)
+      for (size_t j = A.first(i); j < A.last(i); ++j)
+        transposed.set(j, i, A(i, j));
+    return transposed;
+  }
+
+  template <typename T>
+  std::ostream&
+  operator<<(std::ostream& output, const symmetric_matrix<T>& A)
+  {
+    return output << A.dense();
+  }
+
+  template <typename T>
+  std::ostream&
+  operator<<(std::ostream& output, const triangular_matrix<T>& A)
+  {
+    return output << A.dense();
+  }
+
+  template <typename T>
+  std::ostream&
+  operator<<(std::ostream& output, const banded_matrix<T>& A)
+  {
+    return output << A.dense();
+  }
+
+  /**********************************************************************/
+  // Structured solves and factorizations
+
+  // Overwrites B with A^-1 B by forward substitution for a lower and
+  // back substitution for an upper triangle, a row of B at a time
+  template <typename T>
+  void
+  solveInPlace(const triangular_matrix<T>& A, basic_matrix<T>& B)
+  {
+    if (A.size() != B.rows())
+    {
+      std::cerr << "Cannot solve, sizes differ\n";
+      return;
+    }
+
+    // B is left as it was when A is singular, so the diagonal is checked
+    // before any row is touched
+    size_t n = A.size();
+    const std::vector<T>& packed = A.packed();
+    for (size_t i = 0; i < n; ++i)
+      if (packed[detail::packedIndex(i, i)] == T(0))
+      {
+        std::cerr << "Cannot solve, triangular matrix is singular\n";
+        return;
+      }
+
+    size_t m = B.cols();
+    bool lower = A.which() == triangle::lower;
+    for (size_t step = 0; step < n; ++step)
+    {
+      size_t i = lower ? step : n - 1 - step;
+      T* bi = &B(i, 0);
+      if (lower)
+        for (size_t r = 0; r < i; ++r)
+          detail::simd<T>().axpy(m, bi, &B(r, 0), -packed[detail::packedIndex(i, r)], false);
+      else
+        for (size_t r = i + 1; r < n; ++r)
+          detail::simd<T>().axpy(m, bi, &B(r, 0), -packed[detail::packedIndex(r, i)], false);
+
+      detail::simd<T>().scale(m, bi, T(1) / packed[detail::packedIndex(i, i)]);
+    }
+  }
+
+  template <typename T>
+  basic_matrix<T>
+  solve(const triangular_matrix<T>& A, basic_matrix<T> B)
+  {
+    solveInPlace(A, B);
+    return B;
+  }
+
+  template <typename T>
+  T
+  determinant(const triangular_matrix<T>& A)
+  {
+    T det = T(1);
+    for (size_t i = 0; i < A.size(); ++i)
+      det *= A.packed()[detail::packedIndex(i, i)];
+    return det;
+  }
+
+  // Packed Cholesky, left-looking: L(i, j) is A(i, j) less the dot
+  // product of rows i and j of L left of column j, and both rows are
+  // contiguous in the packed layout. Columns go CHOLESKY_BLOCK at a time:
+  // the diagonal block first, then every row below it in parallel.
+  // Returns L, or an empty matrix if A is not positive definite.
+  template <typename T>
+  triangular_matrix<T>
+  cholesky(const symmetric_matrix<T>& A)
+  {
+    static_assert(std::is_floating_point_v<T>,
+                  "Cholesky factorization needs a real floating-point type");
+
+    size_t n = A.size();
+    triangular_matrix<T> L(n);
+    T* l = L.data();
+    std::copy(A.packed().begin(), A.packed().end(), l);
+
+    auto row = [&](size_t i, size_t k, size_t end) {
+      T* li = l + detail::packedIndex(i, 0);
+      for (size_t j = k; j < end; ++j)
+      {
+        const T* lj = l + detail::packedIndex(j, 0);
+        li[j] = (li[j] - detail::dot(j, li, lj)) / lj[j];
+      }
+    };
+
+    detail::thread_pool& pool = detail::thread_pool::instance();
+    for (size_t k = 0; k < n; k += detail::CHOLESKY_BLOCK)
+    {
+      size_t end = std::min(n, k + detail::CHOLESKY_BLOCK);
+      for (size_t i = k; i < end; ++i)
+      {
+        row(i, k, i);
+        T* li = l + detail::packedIndex(i, 0);
+        T d = li[i] - detail::dot(i, li, li);
+        if (!(d > 0))
+        {
+          std::cerr << "Matrix is not positive definite.\n";
+          return triangular_matrix<T>();
+        }
+        li[i] = std::sqrt(d);
+      }
+
+      size_t chunks = (n - end + detail::CHOLESKY_ROWS - 1) / detail::CHOLESKY_ROWS;
+      pool.parallelFor(chunks, [&](size_t chunk) {
+        size_t begin = end + chunk * detail::CHOLESKY_ROWS;
+        size_t stop = std::min(n, begin + detail::CHOLESKY_ROWS);
+        for (size_t i = begin; i < stop; ++i)
+          row(i, k, end);
+      });
+    }
+
+    return L;
+  }
+
+  // A X = B through A = L L^T
+  template <typename T>
+  basic_matrix<T>
+  solve(const symmetric_matrix<T>& A, basic_matrix<T> B)
+  {
+    triangular_matrix<T> L = cholesky(A);
+    if (L.size() != A.size() || A.size() != B.rows())
+    {
+      std::cerr << "Cannot solve, matrix is not positive definite or sizes differ\n";
+      return B;
+    }
+
+    solveInPlace(L, B);
+    solveInPlace(transpose(std::move(L)), B);
+    return B;
+  }
+
+  // PA = LU of a banded matrix with partial pivoting. Pivoting can push
+  // U's upper bandwidth to lower + upper, so each row keeps columns
+  // i - lower .. i + lower + upper; the multipliers of L fill the slots
+  // left of the diagonal.
+  template <typename T = elem_t>
+  class band_lu_factorization
+  {
+    static_assert(!std::is_integral_v<T>,
+                  "LU factorization needs a field type; use mod for integers");
+
+  public:
+    band_lu_factorization() = default;
+
+    explicit band_lu_factorization(const banded_matrix<T>& A)
+      : m_size(A.size()),
+        m_lower(A.lower()),
+        m_upper(A.lower() + A.upper()),
+        m_lu(A.size() * (2 * A.lower() + A.upper() + 1), T(0)),
+        m_pivots(A.size())
+    {
+      for (size_t i = 0; i < m_size; ++i)
+        for (size_t j = A.first(i); j < A.last(i); ++j)
+          at(i, j) = A(i, j);
+      factor();
+    }
+
+    size_t
+    size() const
+    {
+      return m_size;
+    }
+
+    bool
+    singular() const
+    {
+      return m_singular;
+    }
+
+    T
+    determinant() const
+    {
+      if (m_singular)
+        return T(0);
+
+      T det = T(1);
+      for (size_t k = 0; k < m_size; ++k)
+        det *= m_pivots[k] == k ? at(k, k) : -at(k, k);
+      return det;
+    }
+
+    basic_matrix<T>
+    solve(basic_matrix<T> B) const
+    {
+      solveInPlace(B);
+      return B;
+    }
+
+    void
+    solveInPlace(basic_matrix<T>& B) const
+    {
+      if (m_singular || B.rows() != m_size)
+      {
+        std::cerr << "Cannot solve, matrix is singular or sizes differ\n";
+        return;
+      }
+
+      size_t m = B.cols();
+      for (size_t k = 0; k < m_size; ++k)
+      {
+        if (m_pivots[k] != k)
+          std::swap_ranges(&B(k, 0), &B(k, 0) + m, &B(m_pivots[k], 0));
+        for (size_t i = k + 1; i < std::min(m_size, k + m_lower + 1); ++i)
+          detail::simd<T>().axpy(m, &B(i, 0), &B(k, 0), -at(i, k), false);
+      }
+
+      for (size_t i = m_size; i-- > 0; )
+      {
+        T* bi = &B(i, 0);
+        for (size_t j = i + 1; j < std::min(m_size, i + m_upper + 1); ++j)
+          detail::simd<T>().axpy(m, bi, &B(j, 0), -at(i, j), false);
+        detail::simd<T>().scale(m, bi, T(1) / at(i, i));
+      }
+    }
+
+  private:
+    T&
+    at(size_t row, size_t col)
+    {
+      return m_lu[row * (m_lower + m_upper + 1) + col + m_lower - row];
+    }
+
+    const T&
+    at(size_t row, size_t col) const
+    {
+      return m_lu[row * (m_lower + m_upper + 1) + col + m_lower - row];
+    }
+
+    void
+    factor()
+    {
+      for (size_t k = 0; k < m_size; ++k)
+      {
+        size_t last = std::min(m_size, k + m_lower + 1);
+        size_t right = std::min(m_size, k + m_upper + 1);
+
+        size_t p = k;
+        for (size_t i = k + 1; i < last; ++i)
+          if (std::abs(at(i, k)) > std::abs(at(p, k)))
+            p = i;
+        m_pivots[k] = p;
+        if (at(p, k) == T(0))
+        {
+          m_singular = true;
+          continue;
+        }
+
+        if (p != k)
+          std::swap_ranges(&at(k, k), &at(k, k) + (right - k), &at(p, k));
+
+        for (size_t i = k + 1; i < last; ++i)
+        {
+          T l = at(i, k) /= at(k, k);
+          detail::simd<T>().axpy(right - k - 1, &at(i, k + 1), &at(k, k + 1), -l, false);
+        }
+      }
+    }
+
+    size_t m_size = 0;
+    size_t m_lower = 0;
+    // Upper bandwidth of U, lower + upper of the original matrix
+    size_t m_upper = 0;
+    std::vector<T> m_lu;
+    std::vector<size_t> m_pivots;
+    bool m_singular = false;
+  };
+
+  template <typename T>
+  basic_matrix<T>
+  solve(const banded_matrix<T>& A, basic_matrix<T> B)
+  {
+    band_lu_factorization<T> lu(A);
+    lu.solveInPlace(B);
+    return B;
+  }
+
+  template <typename T>
+  T
+  determinant(const banded_matrix<T>& A)
+  {
+    return band_lu_factorization<T>(A).determinant();
+  }
+
+  /**********************************************************************/
+  // Linear solves
+  //
+  // solve(A, B) returns X with AX = B without forming A^-1. A
+  // triangular A needs only substitution. A symmetric A with a positive
+  // diagonal tries Cholesky, at half the flops of LU, and falls back to
+  // LU if it turns out not to be positive definite. Any other A gets LU
+  // with partial pivoting. Callers solving repeatedly against one A can
+  // keep its lu_factorization or cholesky_factorization and call solve on
+  // it. Or they can give solve a cache with setSolveCacheBudget: the most
+  // recently used factorizations are then kept with a copy of the A they
+  // came from, so solving against an unchanged A again costs an O(n^2)
+  // comparison and the substitutions, not a new O(n^3) factorization.
+  namespace detail
+  {
+    template <typename T>
+    struct solve_entry
+    {
+      basic_matrix<T> a;
+      // Exactly one is in use, depending on the structure of a
+      triangular_matrix<T> triangular;
+      cholesky_factorization<T> cholesky;
+      lu_factorization<T> lu;
+      enum { TRIANGULAR, CHOLESKY, LU } kind = LU;
+    };
+
+    // Memory an entry for an n x n A is charged: the copy of A and a
+    // factorization of at most n^2 elements
+    template <typename T>
+    size_t
+    solveEntryBytes(size_t n)
+    {
+      return 2 * n * n * sizeof(T);
+    }
+
+    // Off until given a budget; entries most recently used first
+    template <typename T>
+    struct solve_cache
+    {
+      std::mutex mutex;
+      size_t budget = 0;
+      size_t bytes = 0;
+      std::vector<std::shared_ptr<const solve_entry<T>>> entries;
+
+      // Drops the least recently used entries until they fit the budget
+      void
+      trim()
+      {
+        while (!entries.empty() && (budget == 0 || bytes > budget))
+        {
+          bytes -= solveEntryBytes<T>(entries.back()->a.rows());
+          entries.pop_back();
+        }
+      }
+
+      static solve_cache&
+      instance()
+      {
+        static solve_cache cache;
+        return cache;
+      }
+    };
+
+    // Whether every entry strictly above (or below) the diagonal is zero
+    template <typename T>
+    bool
+    isTriangular(const basic_matrix<T>& A, triangle which)
+    {
+      for (size_t i = 0; i < A.rows(); ++i)
+        for (size_t j = 0; j < A.cols(); ++j)
+          if ((which == triangle::lower ? j > i : j < i) && A(i, j) != T(0))
+            return false;
+      return true;
+    }
+
+    // Symmetric with a positive diagonal, which Cholesky needs (but which
+    // does not guarantee it succeeds)
+    template <typename T>
+    bool
+    maybePositiveDefinite(const basic_matrix<T>& A)
+    {
+      if constexpr (!std::is_floating_point_v<T>)
+        return false;
+      else
+      {
+        for (size_t i = 0; i < A.rows(); ++i)
+        {
+          if (!(A(i, i) > 0))
+            return false;
+          for (size_t j = 0; j < i; ++j)
+            if (A(i, j) != A(j, i))
+              return false;
+        }
+        return true;
+      }
+    }
+
+    template <typename T>
+    std::shared_ptr<const solve_entry<T>>
+    solveFactorization(const basic_matrix<T>& A)
+    {
+      solve_cache<T>& cache = solve_cache<T>::instance();
+      bool cached;
+      {
+        std::lock_guard<std::mutex> lock(cache.mutex);
+        cached = cache.budget > 0 && solveEntryBytes<T>(A.rows()) <= cache.budget;
+        auto& entries = cache.entries;
+        for (size_t e = 0; e < entries.size(); ++e)
+          // Exact comparison: operator== tolerates rounding differences
+          // that would give a different factorization
+          if (entries[e]->a.rows() == A.rows() && entries[e]->a.cols() == A.cols()
+              && std::equal(A.begin(), A.end(), entries[e]->a.begin()))
+          {
+            std::rotate(entries.begin(), entries.begin() + e, entries.begin() + e + 1);
+            return entries.front();
+          }
+      }
+
+      auto entry = std::make_shared<solve_entry<T>>();
+      if (isTriangular(A, triangle::lower) || isTriangular(A, triangle::upper))
+      {
+        triangle which = isTriangular(A, triangle::lower) ? triangle::lower : triangle::upper;
+        entry->triangular = triangular_matrix<T>(A, which);
+        entry->kind = solve_entry<T>::TRIANGULAR;
+      }
+      else
+      {
+        if constexpr (std::is_floating_point_v<T>)
+          if (maybePositiveDefinite(A))
+          {
+            entry->cholesky = cholesky_factorization<T>(A);
+            if (entry->cholesky.positiveDefinite())
+              entry->kind = solve_entry<T>::CHOLESKY;
+          }
+        if (entry->kind == solve_entry<T>::LU)
+          entry->lu = lu_factorization<T>(A);
+      }
+
+      if (!cached)
+        return entry;
+
+      entry->a = A;
+      std::lock_guard<std::mutex> lock(cache.mutex);
+      cache.entries.insert(cache.entries.begin(), entry);
+      cache.bytes += solveEntryBytes<T>(A.rows());
+      cache.trim();
+      return entry;
+    }
+  } // namespace detail
+
+  // Solves AX = B for every column of B
+  template <typename T>
+  basic_matrix<T>
+  solve(const basic_matrix<T>& A, basic_matrix<T> B)
+  {
+    static_assert(!std::is_integral_v<T>,
+                  "Solving needs a field type; use mod for integers");
+
+    if (A.rows() != A.cols() || A.rows() != B.rows())
+    {
+      std::cerr << "Cannot solve, matrix is not square or sizes differ\n";
+      return B;
+    }
+
+    auto entry = detail::solveFactorization(A);
+    if (entry->kind == detail::solve_entry<T>::TRIANGULAR)
+      solveInPlace(entry->triangular, B);
+    else if (entry->kind == detail::solve_entry<T>::CHOLESKY)
+      entry->cholesky.solveInPlace(B);
+    else if (entry->lu.nullity() > 0)
+      std::cerr << "Cannot solve, matrix is singular\n";
+    else
+      entry->lu.solveInPlace(B);
+    return B;
+  }
+
+  // Lets solve cache factorizations of T matrices in up to bytes of
+  // memory, an n x n A taking 2 n^2 sizeof(T). 0, the default, turns the
+  // cache off.
+  template <typename T = elem_t>
+  void
+  setSolveCacheBudget(size_t bytes)
+  {
+    detail::solve_cache<T>& cache = detail::solve_cache<T>::instance();
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    cache.budget = bytes;
+    cache.trim();
+  }
+
+  // Drops every cached factorization of T matrices, keeping the budget
+  template <typename T = elem_t>
+  void
+  clearSolveCache()
+  {
+    detail::solve_cache<T>& cache = detail::solve_cache<T>::instance();
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    cache.entries.clear();
+    cache.bytes = 0;
+  }
+
+  /**********************************************************************/
+  // Mixed-precision solves
+  //
+  // solveMixed factors A once in a lower precision, float by default,
+  // which halves the memory and roughly doubles the speed of the O(n^3)
+  // step. It then refines X in the working precision: r = B - AX is
+  // computed in T, the correction d with Ad = r comes from the cheap
+  // factorization, and X += d. Each round gains about as many digits as
+  // float carries, for as long as A's condition number is well below
+  // 1 / float epsilon. If the backward error stops shrinking, A is too
+  // ill-conditioned for this, and the solve is redone with a full T
+  // factorization.
+
+  // Copies A with its elements converted to U
+  template <typename U, typename T>
+  basic_matrix<U>
+  convert(const basic_matrix<T>& A)
+  {
+    basic_matrix<U> converted(A.rows(), A.cols());
+    std::transform(A.begin(), A.end(), converted.begin(), [](const T& x) { return static_cast<U>(x); });
+    return converted;
+  }
+
+  template <typename T = elem_t>
+  struct refinement_result
+  {
+    basic_matrix<T> x;
+    // Refinement steps taken in low precision
+    size_t iterations = 0;
+    // Normwise backward error max_j ||b_j - A x_j|| / (||A|| ||x_j||), in
+    // the infinity norm
+    detail::real_t<T> residual = 0;
+    // True if refinement stalled and x came from a full-precision solve
+    bool fellBack = false;
+  };
+
+  namespace detail
+  {
+    template <typename T>
+    real_t<T>
+    normInf(const basic_matrix<T>& A)
+    {
+      real_t<T> norm = 0;
+      for (size_t i = 0; i < A.rows(); ++i)
+      {
+        real_t<T> sum = 0;
+        for (size_t j = 0; j < A.cols(); ++j)
+          sum += std::abs(A(i, j));
+        norm = std::max(norm, sum);
+      }
+      return norm;
+    }
+
+    // Overwrites R with B - AX and returns the backward error of X
+    template <typename T>
+    real_t<T>
+    backwardError(const basic_matrix<T>& A, real_t<T> normA, const basic_matrix<T>& X,
+                  const basic_matrix<T>& B, basic_matrix<T>& R)
+    {
+      R = B;
+      gemm(A.rows(), X.cols(), A.cols(), A.begin(), A.cols(), X.begin(), X.cols(),
+           R.begin(), R.cols(), T(-1));
+
+      real_t<T> worst = 0;
+      for (size_t j = 0; j < X.cols(); ++j)
+      {
+        real_t<T> r = 0;
+        real_t<T> x = 0;
+        for (size_t i = 0; i < X.rows(); ++i)
+        {
+          r = std::max(r, real_t<T>(std::abs(R(i, j))));
+          x = std::max(x, real_t<T>(std::abs(X(i, j))));
+        }
+        if (r > 0)
+          worst = std::max(worst, r / (normA * x));
+      }
+      return worst;
+    }
+  } // namespace detail
+
+  // Solves AX = B to T accuracy with a Low-precision factorization and
+  // iterative refinement. Stops once the backward error is below
+  // tolerance, which defaults to sqrt(n) T epsilon as in LAPACK's dsgesv.
+  template <typename T = elem_t, typename Low = float>
+  refinement_result<T>
+  solveMixed(const basic_matrix<T>& A, const basic_matrix<T>& B, detail::real_t<T> tolerance = 0,
+             size_t maxIterations = 30)
+  {
+    refinement_result<T> result;
+    if (A.rows() != A.cols() || A.rows() != B.rows())
+    {
+      std::cerr << "Cannot solve, matrix is not square or sizes differ\n";
+      result.x = B;
+      return result;
+    }
+
+    size_t n = A.rows();
+    if (tolerance <= 0)
+      tolerance = std::sqrt(detail::real_t<T>(n)) * std::numeric_limits<detail::real_t<T>>::epsilon();
+    detail::real_t<T> normA = detail::normInf(A);
+
+    lu_factorization<Low> low(convert<Low>(A));
+    basic_matrix<T> R;
+    if (!low.singular())
+    {
+      result.x = convert<T>(low.solve(convert<Low>(B)));
+      result.residual = detail::backwardError(A, normA, result.x, B, R);
+      while (result.residual > tolerance && result.iterations < maxIterations)
+      {
+        basic_matrix<T> D = convert<T>(low.solve(convert<Low>(R)));
+        basic_matrix<T> X = result.x + D;
+        detail::real_t<T> residual = detail::backwardError(A, normA, X, B, R);
+        ++result.iterations;
+
+        // A correction that does not help means refinement has stalled
+        if (!(residual < result.residual))
+          break;
+        result.x = std::move(X);
+        result.residual = residual;
+      }
+
+      if (result.residual <= tolerance)
+        return result;
+    }
+
+    lu_factorization<T> full(A);
+    if (full.singular())
+    {
+      std::cerr << "Cannot solve, matrix is singular\n";
+      result.x = B;
+      return result;
+    }
+    result.x = full.solve(B);
+    result.residual = detail::backwardError(A, normA, result.x, B, R);
+    result.fellBack = true;
+    return result;
+  }
+
+  /**********************************************************************/
+  // QR factorization
+  //
+  // A = QR by Householder reflections H = I - tau v v^T, kept the way
+  // LAPACK keeps them: R on and above the diagonal, each v below it
+  // with its leading 1 implied. Columns are factored in QR_BLOCK-wide
+  // panels. The panel's reflectors are combined into the compact WY
+  // form H_1 ... H_b = I - V T V^T, with T small and upper triangular,
+  // so the trailing columns are updated by three GEMMs, spread across
+  // the thread pool, instead of b rank-1 updates. Q itself is never
+  // formed. Products with Q and Q^T replay the blocks, and the thin Q
+  // is Q applied to the first columns of the identity, m x min(m, n)
+  // rather than m x m.
+  namespace detail
+  {
+    // V and T with H_k ... H_{k+nb-1} = I - V T V^T for the reflectors
+    // kept in columns k .. k + nb - 1 of H: reflector c has its implied
+    // unit entry in row c + shift and the rest of its vector below that
+    template <typename T>
+    void
+    blockReflector(const basic_matrix<T>& H, const std::vector<T>& tau, size_t k, size_t nb,
+                   size_t shift, basic_matrix<T>& V, basic_matrix<T>& Tb)
+    {
+      size_t first = k + shift;
+      size_t m = H.rows() - first;
+      V = basic_matrix<T>(m, nb, T(0));
+      for (size_t i = 0; i < m; ++i)
+        for (size_t c = 0; c < nb && c <= i; ++c)
+          V(i, c) = i == c ? T(1) : H(first + i, k + c);
+
+      // T(0 : c, c) = -tau_c T(0 : c, 0 : c) V(:, 0 : c)^T v_c, with the
+      // V^T V products from one GEMM
+      basic_matrix<T> G(nb, nb, T(0));
+      gemmStrided(nb, nb, m, V.begin(), size_t(1), nb, V.begin(), nb, size_t(1),
+                  G.begin(), nb, T(1));
+      Tb = basic_matrix<T>(nb, nb, T(0));
+      for (size_t c = 0; c < nb; ++c)
+      {
+        for (size_t r = 0; r < c; ++r)
+        {
+          T sum = 0;
+          for (size_t s = r; s < c; ++s)
+            sum += Tb(r, s) * G(s, c);
+          Tb(r, c) = -tau[k + c] * sum;
+        }
+        Tb(c, c) = tau[k + c];
+      }
+    }
+
+    // C = (I - V T V^T)^T C, or (I - V T V^T) C when not transposed, for
+    // C with V.rows() rows
+    template <typename T>
+    void
+    applyBlockReflector(const basic_matrix<T>& V, const basic_matrix<T>& Tb,
+                        T* C, size_t ldc, size_t cols, bool transposed)
+    {
+      size_t nb = V.cols();
+      size_t m = V.rows();
+      if (cols == 0 || m == 0)
+        return;
+
+      basic_matrix<T> W(nb, cols, T(0));
+      basic_matrix<T> TW(nb, cols, T(0));
+      gemmStrided(nb, cols, m, V.begin(), size_t(1), nb, C, ldc, size_t(1),
+                  W.begin(), cols, T(1));
+      if (transposed)
+        gemmStrided(nb, cols, nb, Tb.begin(), size_t(1), nb, W.begin(), cols, size_t(1),
+                    TW.begin(), cols, T(1));
+      else
+        gemm(nb, cols, nb, Tb.begin(), nb, W.begin(), cols, TW.begin(), cols);
+      gemm(m, cols, nb, V.begin(), nb, TW.begin(), cols, C, ldc, T(-1));
+    }
+  } // namespace detail
+
+  template <typename T = elem_t>
+  class qr_factorization
+  {
+    static_assert(std::is_floating_point_v<T>,
+                  "QR factorization needs a real floating-point type");
+
+  public:
+    static constexpr size_t QR_BLOCK = 32;
+
+    qr_factorization() = default;
+
+    explicit qr_factorization(const basic_matrix<T>& A)
+      : qr_factorization(basic_matrix<T>(A))
+    {
+    }
+
+    explicit qr_factorization(basic_matrix<T>&& A)
+      : m_qr(std::move(A)),
+        m_tau(std::min(m_qr.rows(), m_qr.cols()), T(0))
+    {
+      factor();
+    }
+
+    size_t
+    rows() const
+    {
+      return m_qr.rows();
+    }
+
+    size_t
+    cols() const
+    {
+      return m_qr.cols();
+    }
+
+    // R on and above the diagonal, Householder vectors below it
+    const basic_matrix<T>&
+    factors() const
+    {
+      return m_qr;
+    }
+
+    const std::vector<T>&
+    tau() const
+    {
+      return m_tau;
+    }
+
+    // The min(m, n) x n upper trapezoidal factor
+    basic_matrix<T>
+    r() const
+    {
+      size_t k = m_tau.size();
+      basic_matrix<T> R(k, cols(), T(0));
+      for (size_t i = 0; i < k; ++i)
+        std::copy(m_qr.begin() + i * cols() + i, m_qr.begin() + (i + 1) * cols(), &R(i, 0) + i);
+      return R;
+    }
+
+    // The first min(m, n) columns of Q
+    basic_matrix<T>
+    thinQ() const
+    {
+      basic_matrix<T> Q(rows(), m_tau.size(), T(0));
+      for (size_t i = 0; i < m_tau.size(); ++i)
+        Q(i, i) = T(1);
+      applyQ(Q);
+      return Q;
+    }
+
+    // False if a diagonal entry of R is negligible next to the largest
+    bool
+    fullRank() const
+    {
+      T largest = 0;
+      for (size_t i = 0; i < m_tau.size(); ++i)
+        largest = std::max(largest, std::abs(m_qr(i, i)));
+      T tolerance = largest * std::max(rows(), cols()) * std::numeric_limits<T>::epsilon();
+      for (size_t i = 0; i < m_tau.size(); ++i)
+        if (!(std::abs(m_qr(i, i)) > tolerance))
+          return false;
+      return true;
+    }
+
+    // B = Q^T B
+    void
+    applyQt(basic_matrix<T>& B) const
+    {
+      if (B.rows() != rows())
+      {
+        std::cerr << "Right-hand side has the wrong number of rows\n";
+        return;
+      }
+
+      for (size_t k = 0; k < m_tau.size(); k += QR_BLOCK)
+        applyBlock(k, B, true);
+    }
+
+    // B = Q B
+    void
+    applyQ(basic_matrix<T>& B) const
+    {
+      if (B.rows() != rows())
+      {
+        std::cerr << "Right-hand side has the wrong number of rows\n";
+        return;
+      }
+
+      size_t blocks = (m_tau.size() + QR_BLOCK - 1) / QR_BLOCK;
+      for (size_t block = blocks; block-- > 0; )
+        applyBlock(block * QR_BLOCK, B, false);
+    }
+
+    // Least-squares X minimizing ||AX - B|| for m >= n and full rank:
+    // R X = (Q^T B) restricted to its first n rows
+    basic_matrix<T>
+    solve(basic_matrix<T> B) const
+    {
+      if (rows() < cols() || B.rows() != rows() || !fullRank())
+      {
+        std::cerr << "Cannot solve, matrix is rank deficient, has fewer rows than columns, or sizes differ\n";
+        return B;
+      }
+
+      applyQt(B);
+      size_t n = cols();
+      basic_matrix<T> X(B.block(0, 0, n, B.cols()));
+      solveInPlace(triangular_matrix<T>(r(), triangle::upper), X);
+      return X;
+    }
+
+  private:
+    // Unblocked Householder QR of columns [k, end), updating only those
+    // columns; the rows are contiguous within the panel, so each
+    // reflector is applied a row segment at a time
+    void
+    factorPanel(size_t k, size_t end)
+    {
+      size_t m = rows();
+      std::vector<T> w(end - k);
+      for (size_t j = k; j < end; ++j)
+      {
+        // Reflector zeroing A(j + 1 :, j), as in LAPACK's dlarfg
+        T alpha = m_qr(j, j);
+        T sigma = 0;
+        for (size_t i = j + 1; i < m; ++i)
+          sigma += m_qr(i, j) * m_qr(i, j);
+        if (sigma == T(0))
+        {
+          m_tau[j] = T(0);
+          continue;
+        }
+
+        T beta = std::sqrt(alpha * alpha + sigma);
+        if (alpha > 0)
+          beta = -beta;
+        m_tau[j] = (beta - alpha) / beta;
+        T scale = T(1) / (alpha - beta);
+        for (size_t i = j + 1; i < m; ++i)
+          m_qr(i, j) *= scale;
+        m_qr(j, j) = beta;
+
+        // A(j :, j + 1 : end) -= tau v (v^T A(j :, j + 1 : end))
+        size_t width = end - j - 1;
+        if (width == 0)
+          continue;
+        std::copy_n(&m_qr(j, 0) + j + 1, width, w.begin());
+        for (size_t i = j + 1; i < m; ++i)
+          detail::simd<T>().axpy(width, w.data(), &m_qr(i, 0) + j + 1, m_qr(i, j), false);
+        detail::simd<T>().axpy(width, &m_qr(j, 0) + j + 1, w.data(), -m_tau[j], false);
+        for (size_t i = j + 1; i < m; ++i)
+          detail::simd<T>().axpy(width, &m_qr(i, 0) + j + 1, w.data(), -m_tau[j] * m_qr(i, j), false);
+      }
+    }
+
+    void
+    blockReflector(size_t k, basic_matrix<T>& V, basic_matrix<T>& Tb) const
+    {
+      detail::blockReflector(m_qr, m_tau, k, std::min(QR_BLOCK, m_tau.size() - k), 0, V, Tb);
+    }
+
+    void
+    applyBlock(size_t k, basic_matrix<T>& B, bool transposed) const
+    {
+      basic_matrix<T> V, Tb;
+      blockReflector(k, V, Tb);
+      detail::applyBlockReflector(V, Tb, &B(k, 0), B.cols(), B.cols(), transposed);
+    }
+
+    void
+    factor()
+    {
+      size_t n = cols();
+      basic_matrix<T> V, Tb;
+      for (size_t k = 0; k < m_tau.size(); k += QR_BLOCK)
+      {
+        size_t end = std::min(k + QR_BLOCK, m_tau.size());
+        factorPanel(k, end);
+        if (end < n)
+        {
+          blockReflector(k, V, Tb);
+          detail::applyBlockReflector(V, Tb, &m_qr(k, 0) + end, n, n - end, true);
+        }
+      }
+    }
+
+    basic_matrix<T> m_qr;
+    std::vector<T> m_tau;
+  };
+
+  // Least-squares solution of AX = B. With at least as many rows as
+  // columns this minimizes ||AX - B||; with fewer it is the minimum-norm
+  // solution, through the QR factorization of A^T: A = R^T Q^T, so
+  // X = Q R^-T B.
+  template <typename T>
+  basic_matrix<T>
+  leastSquares(const basic_matrix<T>& A, const basic_matrix<T>& B)
+  {
+    if (A.rows() != B.rows())
+    {
+      std::cerr << "Cannot solve, sizes differ\n";
+      return B;
+    }
+
+    if (A.rows() >= A.cols())
+      return qr_factorization<T>(A).solve(B);
+
+    qr_factorization<T> qr(transpose(A));
+    if (!qr.fullRank())
+    {
+      std::cerr << "Cannot solve, matrix is rank deficient\n";
+      return B;
+    }
+
+    basic_matrix<T> X(A.cols(), B.cols(), T(0));
+    basic_matrix<T> Y(B);
+    solveInPlace(transpose(triangular_matrix<T>(qr.r(), triangle::upper)), Y);
+    X.block(0, 0, Y.rows(), Y.cols()) = Y;
+    qr.applyQ(X);
+    return X;
+  }
+
+  /**********************************************************************/
+  // Views and other dense expressions
+  //
+  // The factorizations work on contiguous storage, so a view, minor or
+  // unevaluated expression is copied into a basic_matrix first. Calls on
+  // a basic_matrix itself still pick the overloads above.
+
+  template <typename E>
+  basic_matrix<typename E::value_type>
+  rowEchelon(const expr<E>& A)
+  {
+    return rowEchelon(basic_matrix<typename E::value_type>(A.self()));
+  }
+
+  template <typename E>
+  basic_matrix<typename E::value_type>
+  reducedRowEchelon(const expr<E>& A)
+  {
+    return reducedRowEchelon(basic_matrix<typename E::value_type>(A.self()));
+  }
+
+  template <typename E>
+  typename E::value_type
+  determinant(const expr<E>& A)
+  {
+    return determinant(basic_matrix<typename E::value_type>(A.self()));
+  }
+
+  template <typename E>
+  basic_matrix<typename E::value_type>
+  inverse(const expr<E>& A)
+  {
+    return inverse(basic_matrix<typename E::value_type>(A.self()));
+  }
+
+  template <typename E>
+  basic_matrix<typename E::value_type>
+  adjugate(const expr<E>& A)
+  {
+    return adjugate(basic_matrix<typename E::value_type>(A.self()));
+  }
+
+  template <typename E>
+  basic_matrix<typename E::value_type>
+  cholesky(const expr<E>& A)
+  {
+    return cholesky(basic_matrix<typename E::value_type>(A.self()));
+  }
+
+  template <typename EA, typename EB>
+  basic_matrix<typename EA::value_type>
+  solve(const expr<EA>& A, const expr<EB>& B)
+  {
+    using T = typename EA::value_type;
+    return solve(basic_matrix<T>(A.self()), basic_matrix<T>(B.self()));
+  }
+
+  template <typename EA, typename EB>
+  basic_matrix<typename EA::value_type>
+  leastSquares(const expr<EA>& A, const expr<EB>& B)
+  {
+    using T = typename EA::value_type;
+    return leastSquares(basic_matrix<T>(A.self()), basic_matrix<T>(B.self()));
+  }
+
+  template <typename E>
+  size_t
+  rank(const expr<E>& A, typename E::value_type tolerance = typename E::value_type(-1))
+  {
+    return rank(basic_matrix<typename E::value_type>(A.self()), tolerance);
+  }
+
+  /**********************************************************************/
+  // Symmetric eigenvalues
+  //
+  // A = Q T Q^T with T tridiagonal, by Householder reflections kept the
+  // same way as QR's but one row below the diagonal. The reduction runs
+  // in TRIDIAGONAL_BLOCK-wide panels as in LAPACK's dsytrd: inside a
+  // panel each column sees the earlier reflectors through the two n x b
+  // matrices V and W, and the trailing matrix is then updated in one go,
+  // A -= V W^T + W V^T, by GEMMs on its lower triangle. What is left is
+  // one symmetric matrix-vector product per column, spread over rows.
+  //
+  // T is then solved in one of three ways:
+  //  - values only: implicit QL with Wilkinson shifts, O(n^2);
+  //  - everything: Cuppen's divide and conquer. T is torn in two by a
+  //    rank-one change, the halves are solved recursively, and the
+  //    pieces are glued back with the secular equation. Eigenvectors
+  //    come from Gu and Eisenstat's recomputed z, so they stay
+  //    orthogonal, and the merge is one GEMM per level;
+  //  - the k largest or smallest: Sturm-count bisection for the values,
+  //    inverse iteration for the vectors, and only those k vectors are
+  //    sent back through Q.
+  template <typename T = elem_t>
+  struct eigen_decomposition
+  {
+    std::vector<T> values;
+    // The eigenvectors, one per column in the order of values
+    basic_matrix<T> vectors;
+  };
+
+  namespace detail
+  {
+    constexpr size_t TRIDIAGONAL_BLOCK = 32;
+    // Tridiagonal blocks at most this size are finished by QL
+    constexpr size_t DIVIDE_BASE = 32;
+
+    template <typename T>
+    struct tridiagonal_form
+    {
+      // Reflector j is stored in column j below row j + 1
+      basic_matrix<T> reflectors;
+      std::vector<T> tau;
+      // Diagonal, and subdiagonal e[i] coupling rows i and i + 1
+      std::vector<T> d;
+      std::vector<T> e;
+    };
+
+    // Rows per partial sum of a symmetric product, fixed so the result
+    // does not depend on the thread count
+    constexpr size_t SYMMETRIC_BLOCK = 256;
+
+    // y = S x for S = A(offset :, offset :) symmetric, reading only its
+    // lower triangle, so each entry is loaded once and used twice. Each
+    // block of rows i sums into its own partial of length i + 1, and the
+    // partials are added into y in block order.
+    template <typename T>
+    void
+    symmetricProduct(const basic_matrix<T>& A, size_t offset, const T* x, T* y)
+    {
+      size_t m = A.rows() - offset;
+      std::fill(y, y + m, T(0));
+      size_t blocks = (m + SYMMETRIC_BLOCK - 1) / SYMMETRIC_BLOCK;
+      auto end = [&](size_t b) { return std::min(m, (b + 1) * SYMMETRIC_BLOCK); };
+      auto sumBlock = [&](size_t b, T* part) {
+        std::fill(part, part + end(b), T(0));
+        for (size_t i = b * SYMMETRIC_BLOCK; i < end(b); ++i)
+        {
+          const T* row = A.begin() + (offset + i) * A.cols() + offset;
+          part[i] += dot(i + 1, row, x);
+          simd<T>().axpy(i, part, row, x[i], false);
+        }
+      };
+
+      if (m * m / 2 < ROW_PARALLEL || thread_pool::instance().size() == 1 || blocks == 1)
+      {
+        std::vector<T> part(m);
+        for (size_t b = 0; b < blocks; ++b)
+        {
+          sumBlock(b, part.data());
+          simd<T>().axpy(end(b), y, part.data(), T(1), false);
+        }
+        return;
+      }
+
+      // Block b's partial has (b + 1) SYMMETRIC_BLOCK entries, or fewer
+      // for the last block, so they are packed one after another
+      auto start = [](size_t b) { return SYMMETRIC_BLOCK * b * (b + 1) / 2; };
+      std::vector<T> partial(start(blocks - 1) + m);
+      forRowRanges(blocks, m * m / 2, [&](size_t first, size_t last) {
+        for (size_t b = first; b < last; ++b)
+          sumBlock(b, partial.data() + start(b));
+      });
+      for (size_t b = 0; b < blocks; ++b)
+        simd<T>().axpy(end(b), y, partial.data() + start(b), T(1), false);
+    }
+
+    // Q^T A Q = T for symmetric A, reading only its lower triangle
+    template <typename T>
+    tridiagonal_form<T>
+    tridiagonalize(basic_matrix<T> A)
+    {
+      size_t n = A.rows();
+      tridiagonal_form<T> form;
+      form.d.assign(n, T(0));
+      form.e.assign(n > 0 ? n - 1 : 0, T(0));
+      form.tau.assign(n > 0 ? n - 1 : 0, T(0));
+      if (n == 0)
+        return form;
+
+      std::vector<T> v(n), y(n), p(TRIDIAGONAL_BLOCK), q(TRIDIAGONAL_BLOCK);
+      for (size_t k = 0; k + 1 < n; k += TRIDIAGONAL_BLOCK)
+      {
+        size_t end = std::min(k + TRIDIAGONAL_BLOCK, n - 1);
+        size_t nb = end - k;
+        size_t rows = n - k;
+        // Row r of V and W is row k + r of the matrix
+        basic_matrix<T> V(rows, nb, T(0));
+        basic_matrix<T> W(rows, nb, T(0));
+
+        for (size_t j = k; j < end; ++j)
+        {
+          size_t c = j - k;
+          // Bring column j up to date with the panel's reflectors so far
+          for (size_t i = j; i < n; ++i)
+            A(i, j) -= dot(c, &V(i - k, 0), &W(j - k, 0)) + dot(c, &W(i - k, 0), &V(j - k, 0));
+          form.d[j] = A(j, j);
+
+          // Reflector zeroing A(j + 2 :, j), as in LAPACK's dlarfg
+          T alpha = A(j + 1, j);
+          T sigma = 0;
+          for (size_t i = j + 2; i < n; ++i)
+            sigma += A(i, j) * A(i, j);
+          T tau = 0;
+          if (sigma == T(0))
+            form.e[j] = alpha;
+          else
+          {
+            T beta = std::sqrt(alpha * alpha + sigma);
+            if (alpha > 0)
+              beta = -beta;
+            tau = (beta - alpha) / beta;
+            T scale = T(1) / (alpha - beta);
+            for (size_t i = j + 2; i < n; ++i)
+              A(i, j) *= scale;
+            form.e[j] = beta;
+          }
+          form.tau[j] = tau;
+
+          size_t m = n - j - 1;
+          v[0] = T(1);
+          for (size_t i = 1; i < m; ++i)
+            v[i] = A(j + 1 + i, j);
+          for (size_t i = 0; i < m; ++i)
+            V(j + 1 + i - k, c) = v[i];
+          if (tau == T(0))
+            continue;
+
+          // w = tau (A - V W^T - W V^T) v - (tau^2 / 2)(v^T A v) v, with
+          // A the trailing matrix as of the start of the panel
+          symmetricProduct(A, j + 1, v.data(), y.data());
+          std::fill(p.begin(), p.begin() + c, T(0));
+          std::fill(q.begin(), q.begin() + c, T(0));
+          for (size_t i = 0; i < m; ++i)
+            for (size_t l = 0; l < c; ++l)
+            {
+              p[l] += W(j + 1 + i - k, l) * v[i];
+              q[l] += V(j + 1 + i - k, l) * v[i];
+            }
+          for (size_t i = 0; i < m; ++i)
+          {
+            T correction = dot(c, &V(j + 1 + i - k, 0), p.data()) + dot(c, &W(j + 1 + i - k, 0), q.data());
+            y[i] = tau * (y[i] - correction);
+          }
+          T half = -tau / T(2) * dot(m, y.data(), v.data());
+          for (size_t i = 0; i < m; ++i)
+            W(j + 1 + i - k, c) = y[i] + half * v[i];
+        }
+
+        // A(end :, end :) -= V W^T + W V^T, lower triangle only, a strip
+        // of rows at a time
+        for (size_t r = end; r < n; r += 2 * TRIDIAGONAL_BLOCK)
+        {
+          size_t height = std::min(2 * TRIDIAGONAL_BLOCK, n - r);
+          size_t width = r + height - end;
+          T* C = &A(r, 0) + end;
+          gemmStrided(height, width, nb, &V(r - k, 0), nb, size_t(1), &W(end - k, 0), size_t(1), nb,
+                      C, n, T(-1));
+          gemmStrided(height, width, nb, &W(r - k, 0), nb, size_t(1), &V(end - k, 0), size_t(1), nb,
+                      C, n, T(-1));
+        }
+      }
+      form.d[n - 1] = A(n - 1, n - 1);
+      form.reflectors = std::move(A);
+      return form;
+    }
+
+    // Z = Q Z, for Z with as many rows as the tridiagonalized matrix
+    template <typename T>
+    void
+    applyTridiagonalQ(const tridiagonal_form<T>& form, basic_matrix<T>& Z)
+    {
+      size_t count = form.tau.size();
+      if (count == 0 || Z.cols() == 0)
+        return;
+
+      basic_matrix<T> V, Tb;
+      size_t blocks = (count + TRIDIAGONAL_BLOCK - 1) / TRIDIAGONAL_BLOCK;
+      for (size_t block = blocks; block-- > 0; )
+      {
+        size_t k = block * TRIDIAGONAL_BLOCK;
+        blockReflector(form.reflectors, form.tau, k, std::min(TRIDIAGONAL_BLOCK, count - k), 1, V, Tb);
+        applyBlockReflector(V, Tb, &Z(k + 1, 0), Z.cols(), Z.cols(), false);
+      }
+    }
+
+    // Implicit QL with Wilkinson shifts on the tridiagonal (d, e), e[i]
+    // coupling i and i + 1, as in EISPACK's tql2. d ends up holding the
+    // eigenvalues, unsorted. With Z, each rotation is also applied to
+    // its columns.
+    template <typename T>
+    void
+    tridiagonalQl(std::vector<T>& d, std::vector<T> e, basic_matrix<T>* Z)
+    {
+      size_t n = d.size();
+      e.resize(n, T(0));
+      if (n > 0)
+        e[n - 1] = T(0);
+      const T eps = std::numeric_limits<T>::epsilon();
+      T shift = 0;
+      T largest = 0;
+      for (size_t l = 0; l < n; ++l)
+      {
+        largest = std::max(largest, std::abs(d[l]) + std::abs(e[l]));
+        size_t m = l;
+        while (m + 1 < n && std::abs(e[m]) > eps * largest)
+          ++m;
+
+        // Sweeps usually converge in two or three; the cap only stops an
+        // endless loop on NaN input
+        for (size_t sweep = 0; m > l && sweep < 64; ++sweep)
+        {
+          T g = d[l];
+          T p = (d[l + 1] - g) / (T(2) * e[l]);
+          T r = std::hypot(p, T(1));
+          if (p < 0)
+            r = -r;
+          d[l] = e[l] / (p + r);
+          d[l + 1] = e[l] * (p + r);
+          T dl1 = d[l + 1];
+          T h = g - d[l];
+          for (size_t i = l + 2; i < n; ++i)
+            d[i] -= h;
+          shift += h;
+
+          p = d[m];
+          T c = 1, c2 = 1, c3 = 1, s = 0, s2 = 0;
+          T el1 = e[l + 1];
+          for (size_t i = m; i-- > l; )
+          {
+            c3 = c2;
+            c2 = c;
+            s2 = s;
+            g = c * e[i];
+            h = c * p;
+            r = std::hypot(p, e[i]);
+            e[i + 1] = s * r;
+            s = e[i] / r;
+            c = p / r;
+            p = c * d[i] - s * g;
+            d[i + 1] = h + s * (c * g + s * d[i]);
+            if (Z)
+              for (size_t row = 0; row < Z->rows(); ++row)
+              {
+                T* z = &(*Z)(row, 0);
+                h = z[i + 1];
+                z[i + 1] = s * z[i] + c * h;
+                z[i] = c * z[i] - s * h;
+              }
+          }
+          p = -s * s2 * c3 * el1 * e[l] / dl1;
+          e[l] = s * p;
+          d[l] = c * p;
+          if (!(std::abs(e[l]) > eps * largest))
+            break;
+        }
+        d[l] += shift;
+        e[l] = T(0);
+      }
+    }
+
+    // Reorders values ascending, and the columns of Z with them
+    template <typename T>
+    void
+    sortEigenpairs(std::vector<T>& values, basic_matrix<T>& Z)
+    {
+      size_t n = values.size();
+      std::vector<size_t> order(n);
+      for (size_t i = 0; i < n; ++i)
+        order[i] = i;
+      std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return values[a] < values[b]; });
+
+      std::vector<T> sorted(n);
+      basic_matrix<T> S(Z.rows(), n);
+      for (size_t j = 0; j < n; ++j)
+        sorted[j] = values[order[j]];
+      for (size_t i = 0; i < Z.rows(); ++i)
+        for (size_t j = 0; j < n; ++j)
+          S(i, j) = Z(i, order[j]);
+      values = std::move(sorted);
+      Z = std::move(S);
+    }
+
+    // Root of 1 + rho sum z_j^2 / (delta_j - mu) = 0 for mu in (lo, hi),
+    // where delta_j = d_j - origin. Newton's step when it stays inside
+    // the bracket, bisection when it does not.
+    template <typename T>
+    T
+    secularRoot(const std::vector<T>& delta, const std::vector<T>& z, T rho, T lo, T hi)
+    {
+      const T eps = std::numeric_limits<T>::epsilon();
+      size_t K = delta.size();
+      T mu = (lo + hi) / T(2);
+      for (int iteration = 0; iteration < 200; ++iteration)
+      {
+        T f = 1, slope = 0, size = 1;
+        for (size_t j = 0; j < K; ++j)
+        {
+          T t = z[j] / (delta[j] - mu);
+          f += rho * z[j] * t;
+          slope += rho * t * t;
+          size += std::abs(rho * z[j] * t);
+        }
+        if (std::abs(f) <= T(8) * K * eps * size)
+          break;
+        if (f < 0)
+          lo = mu;
+        else
+          hi = mu;
+        if (hi - lo <= T(2) * eps * std::max(std::abs(lo), std::abs(hi)))
+          break;
+
+        T next = mu - f / slope;
+        mu = next > lo && next < hi ? next : (lo + hi) / T(2);
+      }
+      return mu;
+    }
+
+    // Eigenvalues (ascending) and eigenvectors of D + rho z z^T, rho > 0,
+    // |z| = 1, with Q = diag(Q1, Q2) the eigenvectors of the two halves,
+    // Q1 being h x h
+    template <typename T>
+    void
+    mergeRankOne(std::vector<T>& d, std::vector<T>& z, T rho, basic_matrix<T>& Q, size_t h)
+    {
+      const T eps = std::numeric_limits<T>::epsilon();
+      size_t n = d.size();
+      std::vector<size_t> order(n);
+      for (size_t i = 0; i < n; ++i)
+        order[i] = i;
+      std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return d[a] < d[b]; });
+
+      T dmax = 0, zmax = 0;
+      for (size_t i = 0; i < n; ++i)
+      {
+        dmax = std::max(dmax, std::abs(d[i]));
+        zmax = std::max(zmax, std::abs(z[i]));
+      }
+      T tolerance = T(8) * eps * std::max(dmax, zmax);
+
+      // Deflation, as in LAPACK's dlaed2: a negligible z_i leaves (d_i,
+      // column i) an eigenpair, and two nearly equal d values are
+      // rotated so that one of their z components vanishes
+      std::vector<size_t> kept;
+      std::vector<T> values(n);
+      std::vector<bool> deflated(n, false);
+      // Bit 0: column i has nonzeros in the top h rows, bit 1: below them
+      std::vector<unsigned char> halves(n);
+      for (size_t i = 0; i < n; ++i)
+        halves[i] = i < h ? 1 : 2;
+      size_t previous = n;
+      for (size_t index : order)
+      {
+        if (rho * std::abs(z[index]) <= tolerance)
+        {
+          deflated[index] = true;
+          continue;
+        }
+        if (previous != n)
+        {
+          T tau = std::hypot(z[previous], z[index]);
+          T c = z[index] / tau;
+          T s = -z[previous] / tau;
+          if (std::abs((d[index] - d[previous]) * c * s) <= tolerance)
+          {
+            z[index] = tau;
+            z[previous] = T(0);
+            for (size_t row = 0; row < n; ++row)
+            {
+              T* q = &Q(row, 0);
+              T a = q[previous];
+              q[previous] = c * a + s * q[index];
+              q[index] = c * q[index] - s * a;
+            }
+            T t = d[previous] * c * c + d[index] * s * s;
+            d[index] = d[previous] * s * s + d[index] * c * c;
+            d[previous] = t;
+            deflated[previous] = true;
+            halves[index] |= halves[previous];
+          }
+          else
+            kept.push_back(previous);
+        }
+        previous = index;
+      }
+      if (previous != n)
+        kept.push_back(previous);
+      std::sort(kept.begin(), kept.end(), [&](size_t a, size_t b) { return d[a] < d[b]; });
+
+      // Secular equation for the K undeflated values. Each root is held
+      // as (origin, mu) next to the nearer pole, so d_i - lambda_j is
+      // formed without cancellation.
+      size_t K = kept.size();
+      std::vector<T> dk(K), zk(K), zz(K), delta(K), mu(K);
+      std::vector<size_t> origin(K);
+      for (size_t i = 0; i < K; ++i)
+      {
+        dk[i] = d[kept[i]];
+        zk[i] = z[kept[i]];
+      }
+      T norm = 0;
+      for (size_t i = 0; i < K; ++i)
+        norm += zk[i] * zk[i];
+
+      basic_matrix<T> gaps(K, K);
+      for (size_t i = 0; i < K; ++i)
+      {
+        T lo, hi;
+        if (i + 1 == K)
+        {
+          origin[i] = i;
+          lo = T(0);
+          hi = rho * norm;
+        }
+        else
+        {
+          T half = (dk[i + 1] - dk[i]) / T(2);
+          T f = 1;
+          for (size_t j = 0; j < K; ++j)
+            f += rho * zk[j] * zk[j] / ((dk[j] - dk[i]) - half);
+          origin[i] = f >= 0 ? i : i + 1;
+          lo = f >= 0 ? T(0) : -half;
+          hi = f >= 0 ? half : T(0);
+        }
+        for (size_t j = 0; j < K; ++j)
+          delta[j] = dk[j] - dk[origin[i]];
+        mu[i] = secularRoot(delta, zk, rho, lo, hi);
+        for (size_t j = 0; j < K; ++j)
+          gaps(j, i) = delta[j] - mu[i];
+      }
+
+      // Gu and Eisenstat: the z for which the computed values are exact,
+      // so the vectors z / (d - lambda_j) come out orthogonal
+      for (size_t i = 0; i < K; ++i)
+      {
+        T w = gaps(i, i);
+        for (size_t j = 0; j < K; ++j)
+          if (j != i)
+            w *= gaps(i, j) / (dk[i] - dk[j]);
+        zz[i] = std::copysign(std::sqrt(std::max(-w, T(0))), zk[i]);
+      }
+
+      basic_matrix<T> U(K, K);
+      for (size_t j = 0; j < K; ++j)
+      {
+        T sum = 0;
+        for (size_t i = 0; i < K; ++i)
+        {
+          U(i, j) = zz[i] / gaps(i, j);
+          sum += U(i, j) * U(i, j);
+        }
+        T scale = T(1) / std::sqrt(sum);
+        for (size_t i = 0; i < K; ++i)
+          U(i, j) *= scale;
+      }
+
+      // Q(:, kept) U, one GEMM per half over only the columns that are
+      // nonzero there, which halves the work when few rotations mixed
+      // the halves
+      basic_matrix<T> QU(n, K, T(0));
+      for (unsigned char half = 1; half <= 2; ++half)
+      {
+        size_t top = half == 1 ? 0 : h;
+        size_t height = half == 1 ? h : n - h;
+        std::vector<size_t> used;
+        for (size_t i = 0; i < K; ++i)
+          if (halves[kept[i]] & half)
+            used.push_back(i);
+        if (used.empty())
+          continue;
+
+        size_t width = used.size();
+        basic_matrix<T> QK(height, width), UK(width, K);
+        for (size_t row = 0; row < height; ++row)
+          for (size_t i = 0; i < width; ++i)
+            QK(row, i) = Q(top + row, kept[used[i]]);
+        for (size_t i = 0; i < width; ++i)
+          std::copy_n(&U(used[i], 0), K, &UK(i, 0));
+        gemm(height, K, width, QK.begin(), width, UK.begin(), K, &QU(top, 0), K);
+      }
+
+      // Deflated pairs stay where they are; the undeflated columns take
+      // the new vectors
+      for (size_t i = 0; i < n; ++i)
+        if (deflated[i])
+          values[i] = d[i];
+      for (size_t i = 0; i < K; ++i)
+      {
+        values[kept[i]] = dk[origin[i]] + mu[i];
+        for (size_t row = 0; row < n; ++row)
+          Q(row, kept[i]) = QU(row, i);
+      }
+      d = std::move(values);
+      sortEigenpairs(d, Q);
+    }
+
+    // Eigenvalues (ascending) and eigenvectors of the tridiagonal (d, e)
+    template <typename T>
+    void
+    divideAndConquer(std::vector<T>& d, const std::vector<T>& e, basic_matrix<T>& Z)
+    {
+      size_t n = d.size();
+      Z = basic_matrix<T>(n, n, T(0));
+      for (size_t i = 0; i < n; ++i)
+        Z(i, i) = T(1);
+      if (n <= DIVIDE_BASE)
+      {
+        tridiagonalQl(d, e, &Z);
+        sortEigenpairs(d, Z);
+        return;
+      }
+
+      // T = diag(T1, T2) + beta u u^T with u = e_{h-1} + sign(beta) e_h
+      size_t h = n / 2;
+      T beta = e[h - 1];
+      T rho = std::abs(beta);
+      T sign = beta < 0 ? T(-1) : T(1);
+      std::vector<T> d1(d.begin(), d.begin() + h), d2(d.begin() + h, d.end());
+      std::vector<T> e1(e.begin(), e.begin() + (h - 1)), e2(e.begin() + h, e.end());
+      d1[h - 1] -= rho;
+      d2[0] -= rho;
+
+      basic_matrix<T> Z1, Z2;
+      divideAndConquer(d1, e1, Z1);
+      divideAndConquer(d2, e2, Z2);
+
+      // z = diag(Z1, Z2)^T u, scaled to unit length
+      std::vector<T> z(n);
+      T root = T(1) / std::sqrt(T(2));
+      for (size_t i = 0; i < h; ++i)
+      {
+        d[i] = d1[i];
+        z[i] = Z1(h - 1, i) * root;
+        std::copy_n(&Z1(i, 0), h, &Z(i, 0));
+      }
+      for (size_t i = 0; i < n - h; ++i)
+      {
+        d[h + i] = d2[i];
+        z[h + i] = sign * Z2(0, i) * root;
+        std::copy_n(&Z2(i, 0), n - h, &Z(h + i, 0) + h);
+      }
+      if (rho == T(0))
+      {
+        sortEigenpairs(d, Z);
+        return;
+      }
+      mergeRankOne(d, z, T(2) * rho, Z, h);
+    }
+
+    // Number of eigenvalues of the tridiagonal (d, e) below x
+    template <typename T>
+    size_t
+    sturmCount(const std::vector<T>& d, const std::vector<T>& e, T x)
+    {
+      const T tiny = std::numeric_limits<T>::min();
+      size_t count = 0;
+      T q = 1;
+      for (size_t i = 0; i < d.size(); ++i)
+      {
+        q = d[i] - x - (i > 0 ? e[i - 1] * e[i - 1] / q : T(0));
+        if (q == T(0))
+          q = -tiny;
+        if (q < 0)
+          ++count;
+      }
+      return count;
+    }
+
+    // x = (T - lambda I)^-1 x by Gaussian elimination with partial
+    // pivoting, which keeps a third band above the diagonal
+    template <typename T>
+    void
+    shiftedTridiagonalSolve(const std::vector<T>& d, const std::vector<T>& e, T lambda, T floor,
+                            std::vector<T>& x)
+    {
+      size_t n = d.size();
+      std::vector<T> u0(n), u1(n, T(0)), u2(n, T(0)), l(n, T(0));
+      std::vector<bool> swapped(n, false);
+      for (size_t i = 0; i < n; ++i)
+        u0[i] = d[i] - lambda;
+      for (size_t i = 0; i + 1 < n; ++i)
+        u1[i] = e[i];
+
+      for (size_t i = 0; i + 1 < n; ++i)
+      {
+        if (std::abs(u0[i]) >= std::abs(e[i]))
+        {
+          if (u0[i] == T(0))
+            u0[i] = floor;
+          l[i] = e[i] / u0[i];
+          u0[i + 1] -= l[i] * u1[i];
+        }
+        else
+        {
+          swapped[i] = true;
+          l[i] = u0[i] / e[i];
+          T below = u0[i + 1];
+          u0[i] = e[i];
+          u0[i + 1] = u1[i] - l[i] * below;
+          u1[i] = below;
+          if (i + 2 < n)
+          {
+            u2[i] = u1[i + 1];
+            u1[i + 1] = -l[i] * u1[i + 1];
+          }
+        }
+      }
+
+      for (size_t i = 0; i + 1 < n; ++i)
+      {
+        if (swapped[i])
+          std::swap(x[i], x[i + 1]);
+        x[i + 1] -= l[i] * x[i];
+      }
+      for (size_t i = n; i-- > 0; )
+      {
+        if (std::abs(u0[i]) < floor)
+          u0[i] = std::copysign(floor, u0[i]);
+        T sum = x[i];
+        if (i + 1 < n)
+          sum -= u1[i] * x[i + 1];
+        if (i + 2 < n)
+          sum -= u2[i] * x[i + 2];
+        x[i] = sum / u0[i];
+      }
+    }
+
+    // The eigenpairs of the tridiagonal (d, e) with indices [first, last)
+    // in ascending order: bisection on the Sturm count for the values,
+    // then inverse iteration, reorthogonalized within clusters of close
+    // values as in LAPACK's dstein
+    template <typename T>
+    void
+    tridiagonalRange(const std::vector<T>& d, const std::vector<T>& e, size_t first, size_t last,
+                     std::vector<T>& values, basic_matrix<T>& Z)
+    {
+      const T eps = std::numeric_limits<T>::epsilon();
+      size_t n = d.size();
+      size_t k = last - first;
+
+      // Gershgorin bounds
+      T lower = std::numeric_limits<T>::max(), upper = std::numeric_limits<T>::lowest();
+      T norm = 0;
+      for (size_t i = 0; i < n; ++i)
+      {
+        T radius = (i > 0 ? std::abs(e[i - 1]) : T(0)) + (i + 1 < n ? std::abs(e[i]) : T(0));
+        lower = std::min(lower, d[i] - radius);
+        upper = std::max(upper, d[i] + radius);
+        norm = std::max(norm, std::abs(d[i]) + radius);
+      }
+      T pad = T(2) * eps * std::max(norm, std::numeric_limits<T>::min());
+      lower -= pad;
+      upper += pad;
+
+      values.assign(k, T(0));
+      for (size_t j = 0; j < k; ++j)
+      {
+        T lo = lower, hi = upper;
+        while (hi - lo > T(2) * eps * std::max(std::abs(lo), std::abs(hi)) && hi - lo > pad)
+        {
+          T mid = lo + (hi - lo) / T(2);
+          if (mid <= lo || mid >= hi)
+            break;
+          if (sturmCount(d, e, mid) > first + j)
+            hi = mid;
+          else
+            lo = mid;
+        }
+        values[j] = lo + (hi - lo) / T(2);
+        // The next value is at least this one
+        lower = lo;
+      }
+
+      Z = basic_matrix<T>(n, k, T(0));
+      T floor = eps * std::max(norm, std::numeric_limits<T>::min());
+      T separation = T(1e-3) * norm;
+      std::vector<T> x(n);
+      size_t clusterStart = 0;
+      T previous = 0;
+      size_t seed = 12345;
+      for (size_t j = 0; j < k; ++j)
+      {
+        // Equal values are nudged apart so their vectors differ
+        T lambda = values[j];
+        if (j > 0 && lambda - previous < T(10) * floor)
+          lambda = previous + T(10) * floor;
+        if (j == 0 || lambda - previous > separation)
+          clusterStart = j;
+        previous = lambda;
+
+        for (size_t i = 0; i < n; ++i)
+        {
+          seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+          x[i] = T(seed >> 40) / T(1 << 24) - T(0.5);
+        }
+        for (int iteration = 0; iteration < 3; ++iteration)
+        {
+          shiftedTridiagonalSolve(d, e, lambda, floor, x);
+          for (size_t c = clusterStart; c < j; ++c)
+          {
+            T overlap = 0;
+            for (size_t i = 0; i < n; ++i)
+              overlap += Z(i, c) * x[i];
+            for (size_t i = 0; i < n; ++i)
+              x[i] -= overlap * Z(i, c);
+          }
+          T scale = T(1) / std::sqrt(dot(n, x.data(), x.data()));
+          for (size_t i = 0; i < n; ++i)
+            x[i] *= scale;
+        }
+        for (size_t i = 0; i < n; ++i)
+          Z(i, j) = x[i];
+      }
+    }
+
+    template <typename T>
+    bool
+    checkSquare(const basic_matrix<T>& A)
+    {
+      if (A.rows() != A.cols())
+      {
+        std::cerr << "Eigenvalues need a square matrix\n";
+        return false;
+      }
+      return true;
+    }
+  } // namespace detail
+
+  // Eigenvalues of symmetric A in ascending order, without eigenvectors.
+  // Only the lower triangle of A is read.
+  template <typename T>
+  std::vector<T>
+  symmetricEigenvalues(const basic_matrix<T>& A)
+  {
+    static_assert(std::is_floating_point_v<T>, "Eigenvalues need a real floating-point type");
+    if (!detail::checkSquare(A))
+      return {};
+
+    detail::tridiagonal_form<T> form = detail::tridiagonalize(A);
+    detail::tridiagonalQl(form.d, form.e, static_cast<basic_matrix<T>*>(nullptr));
+    std::sort(form.d.begin(), form.d.end());
+    return form.d;
+  }
+
+  // A = V diag(values) V^T for symmetric A, values ascending
+  template <typename T>
+  eigen_decomposition<T>
+  symmetricEigen(const basic_matrix<T>& A)
+  {
+    static_assert(std::is_floating_point_v<T>, "Eigenvalues need a real floating-point type");
+    if (!detail::checkSquare(A))
+      return {};
+
+    detail::tridiagonal_form<T> form = detail::tridiagonalize(A);
+    eigen_decomposition<T> result;
+    result.values = form.d;
+    detail::divideAndConquer(result.values, form.e, result.vectors);
+    detail::applyTridiagonalQ(form, result.vectors);
+    return result;
+  }
+
+  // The k largest eigenpairs of symmetric A, largest first, or the k
+  // smallest, smallest first. Costs the reduction plus O(nk) per pair,
+  // rather than the full decomposition.
+  template <typename T>
+  eigen_decomposition<T>
+  symmetricEigen(const basic_matrix<T>& A, size_t k, bool largest = true)
+  {
+    static_assert(std::is_floating_point_v<T>, "Eigenvalues need a real floating-point type");
+    if (!detail::checkSquare(A))
+      return {};
+
+    size_t n = A.rows();
+    k = std::min(k, n);
+    if (k == 0)
+      return {};
+    detail::tridiagonal_form<T> form = detail::tridiagonalize(A);
+    eigen_decomposition<T> result;
+    size_t first = largest ? n - k : 0;
+    detail::tridiagonalRange(form.d, form.e, first, first + k, result.values, result.vectors);
+    detail::applyTridiagonalQ(form, result.vectors);
+    if (largest)
+    {
+      std::reverse(result.values.begin(), result.values.end());
+      for (size_t i = 0; i < n; ++i)
+        std::reverse(&result.vectors(i, 0), &result.vectors(i, 0) + k);
+    }
+    return result;
+  }
+
+  template <typename T>
+  std::vector<T>
+  symmetricEigenvalues(const symmetric_matrix<T>& A)
+  {
+    return symmetricEigenvalues(A.dense());
+  }
+
+  template <typename T>
+  eigen_decomposition<T>
+  symmetricEigen(const symmetric_matrix<T>& A)
+  {
+    return symmetricEigen(A.dense());
+  }
+
+  template <typename T>
+  eigen_decomposition<T>
+  symmetricEigen(const symmetric_matrix<T>& A, size_t k, bool largest = true)
+  {
+    return symmetricEigen(A.dense(), k, largest);
+  }
+
+  /**********************************************************************/
+  // Singular value decomposition
+  //
+  // A = U diag(values) V^T, thin: for m x n A with p = min(m, n), U is
+  // m x p, V is n x p, and the values are descending. A wide A is
+  // decomposed through A^T. A tall one (m >= 2n) is first reduced to its
+  // n x n R by the blocked QR above, as LAPACK's dgesvd does, since that
+  // is cheaper than bidiagonalizing all m rows.
+  //
+  // The bidiagonal reduction A = Q B P^T alternates left and right
+  // Householder reflections. It runs in BIDIAGONAL_BLOCK-wide panels as
+  // in LAPACK's dgebrd: the panel's reflectors reach later columns and
+  // rows through the four thin matrices V, Y, X and U, and the trailing
+  // matrix is updated once per panel, A -= V Y^T + X U^T, by two GEMMs.
+  // B is then diagonalized by implicit-shift QR sweeps as in LINPACK's
+  // dsvdc, accumulating the rotations into rows of U^T and V^T so each
+  // one touches two contiguous rows. Q and P are never formed; their
+  // blocks are replayed onto the small factors at the end.
+  //
+  // randomizedSvd is Halko, Martinsson and Tropp's range finder: A is
+  // multiplied by a Gaussian block, a few power passes sharpen the
+  // range, and only the small projected matrix gets a full SVD. All the
+  // work on A itself is GEMMs.
+  template <typename T = elem_t>
+  struct svd_decomposition
+  {
+    // Left singular vectors as columns
+    basic_matrix<T> u;
+    std::vector<T> values;
+    // Right singular vectors as columns
+    basic_matrix<T> v;
+  };
+
+  namespace detail
+  {
+    constexpr size_t BIDIAGONAL_BLOCK = 32;
+
+    template <typename T>
+    struct bidiagonal_form
+    {
+      // Left reflector i in column i below the diagonal, right reflector
+      // i in row i right of the superdiagonal
+      basic_matrix<T> reflectors;
+      std::vector<T> tauq;
+      std::vector<T> taup;
+      // Diagonal, and superdiagonal e[i] coupling columns i and i + 1
+      std::vector<T> d;
+      std::vector<T> e;
+    };
+
+    // Reflector H = I - tau v v^T with H x = (beta, 0, ...)^T, as in
+    // LAPACK's dlarfg. x[0] becomes beta and the rest of x becomes v,
+    // read with the given stride; returns tau.
+    template <typename T>
+    T
+    householder(size_t n, T* x, size_t stride)
+    {
+      T sigma = 0;
+      for (size_t i = 1; i < n; ++i)
+        sigma += x[i * stride] * x[i * stride];
+      if (sigma == T(0))
+        return T(0);
+
+      T alpha = x[0];
+      T beta = std::sqrt(alpha * alpha + sigma);
+      if (alpha > 0)
+        beta = -beta;
+      T scale = T(1) / (alpha - beta);
+      for (size_t i = 1; i < n; ++i)
+        x[i * stride] *= scale;
+      x[0] = beta;
+      return (beta - alpha) / beta;
+    }
+
+    // Q^T A P = B upper bidiagonal, for A with at least as many rows as
+    // columns
+    template <typename T>
+    bidiagonal_form<T>
+    bidiagonalize(basic_matrix<T> A)
+    {
+      size_t m = A.rows();
+      size_t n = A.cols();
+      bidiagonal_form<T> form;
+      form.d.assign(n, T(0));
+      form.tauq.assign(n, T(0));
+      form.e.assign(n > 0 ? n - 1 : 0, T(0));
+      form.taup.assign(n > 0 ? n - 1 : 0, T(0));
+
+      std::vector<T> left(m), right(n), v(m), t(n), p(BIDIAGONAL_BLOCK + 1), q(BIDIAGONAL_BLOCK);
+      for (size_t k = 0; k < n; k += BIDIAGONAL_BLOCK)
+      {
+        size_t end = std::min(k + BIDIAGONAL_BLOCK, n);
+        size_t nb = end - k;
+        // Row r of V and X is row k + r of A; row r of Y and U is
+        // column k + r of A
+        basic_matrix<T> V(m - k, nb, T(0)), X(m - k, nb, T(0));
+        basic_matrix<T> Y(n - k, nb, T(0)), U(n - k, nb, T(0));
+
+        for (size_t i = k; i < end; ++i)
+        {
+          size_t c = i - k;
+          // Column i, then its left reflector
+          for (size_t r = i; r < m; ++r)
+            A(r, i) -= dot(c, &V(r - k, 0), &Y(i - k, 0)) + dot(c, &X(r - k, 0), &U(i - k, 0));
+          T tauq = householder(m - i, &A(i, 0) + i, n);
+          form.tauq[i] = tauq;
+          form.d[i] = A(i, i);
+          for (size_t r = i; r < m; ++r)
+            V(r - k, c) = r == i ? T(1) : A(r, i);
+          if (i + 1 == n)
+            break;
+
+          // Y(:, c) = tauq (A - V Y^T - X U^T)^T v over the columns
+          // right of i, with A as of the start of the panel. A^T v goes
+          // through gemvTransposed, whose partial sums are added in a
+          // fixed order.
+          size_t width = n - i - 1;
+          for (size_t r = i; r < m; ++r)
+            v[r - i] = V(r - k, c);
+          gemvTransposed(m - i, width, &A(i, 0) + i + 1, n, v.data(), t.data(), T(1), T(0));
+          std::fill(p.begin(), p.begin() + c, T(0));
+          std::fill(q.begin(), q.begin() + c, T(0));
+          for (size_t r = i; r < m; ++r)
+          {
+            simd<T>().axpy(c, p.data(), &V(r - k, 0), V(r - k, c), false);
+            simd<T>().axpy(c, q.data(), &X(r - k, 0), V(r - k, c), false);
+          }
+          for (size_t j = i + 1; j < n; ++j)
+            Y(j - k, c) = tauq * (t[j - i - 1] - dot(c, &Y(j - k, 0), p.data()) - dot(c, &U(j - k, 0), q.data()));
+
+          // Row i, then its right reflector
+          for (size_t j = i + 1; j < n; ++j)
+            A(i, j) -= dot(c + 1, &Y(j - k, 0), &V(i - k, 0)) + dot(c, &U(j - k, 0), &X(i - k, 0));
+          T taup = householder(width, &A(i, 0) + i + 1, size_t(1));
+          form.taup[i] = taup;
+          form.e[i] = A(i, i + 1);
+          for (size_t j = i + 1; j < n; ++j)
+            U(j - k, c) = j == i + 1 ? T(1) : A(i, j);
+          if (taup == T(0) || i + 1 == m)
+            continue;
+
+          // X(:, c) = taup (A - V Y^T - X U^T) u over the rows below i
+          for (size_t j = i + 1; j < n; ++j)
+            right[j - i - 1] = U(j - k, c);
+          forRowRanges(m - i - 1, (m - i - 1) * width, [&](size_t first, size_t last) {
+            for (size_t r = i + 1 + first; r < i + 1 + last; ++r)
+              left[r] = dot(width, &A(r, 0) + i + 1, right.data());
+          });
+          std::fill(p.begin(), p.begin() + c + 1, T(0));
+          std::fill(q.begin(), q.begin() + c, T(0));
+          for (size_t j = i + 1; j < n; ++j)
+          {
+            simd<T>().axpy(c + 1, p.data(), &Y(j - k, 0), U(j - k, c), false);
+            simd<T>().axpy(c, q.data(), &U(j - k, 0), U(j - k, c), false);
+          }
+          for (size_t r = i + 1; r < m; ++r)
+            X(r - k, c) = taup * (left[r] - dot(c + 1, &V(r - k, 0), p.data()) - dot(c, &X(r - k, 0), q.data()));
+        }
+
+        // A(end :, end :) -= V Y^T + X U^T
+        if (end < n)
+        {
+          T* C = &A(end, 0) + end;
+          gemmStrided(m - end, n - end, nb, &V(end - k, 0), nb, size_t(1), &Y(end - k, 0), size_t(1), nb,
+                      C, n, T(-1));
+          gemmStrided(m - end, n - end, nb, &X(end - k, 0), nb, size_t(1), &U(end - k, 0), size_t(1), nb,
+                      C, n, T(-1));
+        }
+      }
+      form.reflectors = std::move(A);
+      return form;
+    }
+
+    // x, y = c x + s y, c y - s x
+    template <typename T>
+    void
+    rotateRows(size_t n, T* x, T* y, T c, T s)
+    {
+      for (size_t i = 0; i < n; ++i)
+      {
+        T t = c * x[i] + s * y[i];
+        y[i] = c * y[i] - s * x[i];
+        x[i] = t;
+      }
+    }
+
+    // Singular values of the upper bidiagonal (d, e) by implicit-shift QR,
+    // after LINPACK's dsvdc. With Ut and Vt, whose rows are the singular
+    // vectors of B, the rotations are accumulated into them. The values
+    // come out nonnegative but unsorted.
+    template <typename T>
+    void
+    bidiagonalQr(std::vector<T>& d, std::vector<T> e, basic_matrix<T>* Ut, basic_matrix<T>* Vt)
+    {
+      size_t n = d.size();
+      e.resize(n, T(0));
+      if (n > 0)
+        e[n - 1] = T(0);
+      const T eps = std::numeric_limits<T>::epsilon();
+      const T tiny = std::numeric_limits<T>::min() / eps;
+      size_t width = Ut ? Ut->cols() : 0;
+      // A handful of sweeps per value is usual; the cap only stops an
+      // endless loop on NaN input
+      size_t sweeps = 0;
+      size_t limit = 75 * n + 100;
+
+      size_t p = n;
+      while (p > 0 && sweeps < limit)
+      {
+        // k is the last index above p - 1 with a negligible e[k], or -1
+        ptrdiff_t k = ptrdiff_t(p) - 2;
+        for (; k >= 0; --k)
+          if (std::abs(e[k]) <= tiny + eps * (std::abs(d[k]) + std::abs(d[k + 1])))
+          {
+            e[k] = T(0);
+            break;
+          }
+
+        int kase;
+        if (k == ptrdiff_t(p) - 2)
+          kase = 4;
+        else
+        {
+          ptrdiff_t ks = ptrdiff_t(p) - 1;
+          for (; ks > k; --ks)
+          {
+            T t = (ks != ptrdiff_t(p) ? std::abs(e[ks]) : T(0)) + (ks != k + 1 ? std::abs(e[ks - 1]) : T(0));
+            if (std::abs(d[ks]) <= tiny + eps * t)
+            {
+              d[ks] = T(0);
+              break;
+            }
+          }
+          if (ks == k)
+            kase = 3;
+          else if (ks == ptrdiff_t(p) - 1)
+            kase = 1;
+          else
+          {
+            kase = 2;
+            k = ks;
+          }
+        }
+        size_t lo = size_t(k + 1);
+
+        if (kase == 1)
+        {
+          // d[p - 1] is negligible: chase e[p - 2] out from the right
+          T f = e[p - 2];
+          e[p - 2] = T(0);
+          for (size_t j = p - 1; j-- > lo; )
+          {
+            T t = std::hypot(d[j], f);
+            T cs = d[j] / t;
+            T sn = f / t;
+            d[j] = t;
+            if (j != lo)
+            {
+              f = -sn * e[j - 1];
+              e[j - 1] = cs * e[j - 1];
+            }
+            if (Vt)
+              rotateRows(width, &(*Vt)(j, 0), &(*Vt)(p - 1, 0), cs, sn);
+          }
+        }
+        else if (kase == 2)
+        {
+          // d[lo - 1] is negligible: split there
+          T f = e[lo - 1];
+          e[lo - 1] = T(0);
+          for (size_t j = lo; j < p; ++j)
+          {
+            T t = std::hypot(d[j], f);
+            T cs = d[j] / t;
+            T sn = f / t;
+            d[j] = t;
+            f = -sn * e[j];
+            e[j] = cs * e[j];
+            if (Ut)
+              rotateRows(width, &(*Ut)(j, 0), &(*Ut)(lo - 1, 0), cs, sn);
+          }
+        }
+        else if (kase == 3)
+        {
+          // One QR sweep with the shift from the trailing 2 x 2
+          T scale = std::max({ std::abs(d[p - 1]), std::abs(d[p - 2]), std::abs(e[p - 2]),
+                               std::abs(d[lo]), std::abs(e[lo]) });
+          T sp = d[p - 1] / scale;
+          T spm1 = d[p - 2] / scale;
+          T epm1 = e[p - 2] / scale;
+          T sk = d[lo] / scale;
+          T ek = e[lo] / scale;
+          T b = ((spm1 + sp) * (spm1 - sp) + epm1 * epm1) / T(2);
+          T c = (sp * epm1) * (sp * epm1);
+          T shift = 0;
+          if (b != T(0) || c != T(0))
+          {
+            shift = std::sqrt(b * b + c);
+            if (b < 0)
+              shift = -shift;
+            shift = c / (b + shift);
+          }
+          T f = (sk + sp) * (sk - sp) + shift;
+          T g = sk * ek;
+
+          for (size_t j = lo; j + 1 < p; ++j)
+          {
+            T t = std::hypot(f, g);
+            T cs = f / t;
+            T sn = g / t;
+            if (j != lo)
+              e[j - 1] = t;
+            f = cs * d[j] + sn * e[j];
+            e[j] = cs * e[j] - sn * d[j];
+            g = sn * d[j + 1];
+            d[j + 1] = cs * d[j + 1];
+            if (Vt)
+              rotateRows(width, &(*Vt)(j, 0), &(*Vt)(j + 1, 0), cs, sn);
+
+            t = std::hypot(f, g);
+            cs = f / t;
+            sn = g / t;
+            d[j] = t;
+            f = cs * e[j] + sn * d[j + 1];
+            d[j + 1] = -sn * e[j] + cs * d[j + 1];
+            g = sn * e[j + 1];
+            e[j + 1] = cs * e[j + 1];
+            if (Ut)
+              rotateRows(width, &(*Ut)(j, 0), &(*Ut)(j + 1, 0), cs, sn);
+          }
+          e[p - 2] = f;
+          ++sweeps;
+        }
+        else
+        {
+          // d[lo] has converged; make it nonnegative
+          if (d[lo] < 0)
+          {
+            d[lo] = -d[lo];
+            if (Vt)
+              simd<T>().scale(width, &(*Vt)(lo, 0), T(-1));
+          }
+          --p;
+        }
+      }
+    }
+
+    // Thin SVD of A with m >= n
+    template <typename T>
+    svd_decomposition<T>
+    tallSvd(const basic_matrix<T>& A, bool vectors)
+    {
+      size_t m = A.rows();
+      size_t n = A.cols();
+      if (m >= 2 * n && n > 0)
+      {
+        qr_factorization<T> qr(A);
+        svd_decomposition<T> result = tallSvd(qr.r(), vectors);
+        if (vectors)
+        {
+          basic_matrix<T> U(m, n, T(0));
+          U.block(0, 0, n, n) = result.u;
+          qr.applyQ(U);
+          result.u = std::move(U);
+        }
+        return result;
+      }
+
+      bidiagonal_form<T> form = bidiagonalize(A);
+      svd_decomposition<T> result;
+      result.values = form.d;
+      if (!vectors)
+      {
+        bidiagonalQr(result.values, form.e, static_cast<basic_matrix<T>*>(nullptr),
+                     static_cast<basic_matrix<T>*>(nullptr));
+        std::sort(result.values.begin(), result.values.end(), std::greater<T>());
+        return result;
+      }
+
+      basic_matrix<T> Ut(n, n, T(0)), Vt(n, n, T(0));
+      for (size_t i = 0; i < n; ++i)
+        Ut(i, i) = Vt(i, i) = T(1);
+      bidiagonalQr(result.values, form.e, &Ut, &Vt);
+
+      // Descending order, with the vectors as columns
+      std::vector<size_t> order(n);
+      for (size_t i = 0; i < n; ++i)
+        order[i] = i;
+      std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return result.values[a] > result.values[b]; });
+      std::vector<T> sorted(n);
+      basic_matrix<T> U(m, n, T(0)), V(n, n);
+      for (size_t j = 0; j < n; ++j)
+      {
+        sorted[j] = result.values[order[j]];
+        for (size_t i = 0; i < n; ++i)
+        {
+          U(i, j) = Ut(order[j], i);
+          V(i, j) = Vt(order[j], i);
+        }
+      }
+      result.values = std::move(sorted);
+
+      // U = Q [U_B; 0] and V = P V_B. P's reflectors are in rows, so
+      // they are replayed from the transposed factors.
+      basic_matrix<T> W, Tb;
+      size_t blocks = (n + BIDIAGONAL_BLOCK - 1) / BIDIAGONAL_BLOCK;
+      for (size_t block = blocks; block-- > 0; )
+      {
+        size_t k = block * BIDIAGONAL_BLOCK;
+        blockReflector(form.reflectors, form.tauq, k, std::min(BIDIAGONAL_BLOCK, n - k), 0, W, Tb);
+        applyBlockReflector(W, Tb, &U(k, 0), n, n, false);
+      }
+      if (n > 1)
+      {
+        basic_matrix<T> Pt = transpose(form.reflectors);
+        size_t count = n - 1;
+        blocks = (count + BIDIAGONAL_BLOCK - 1) / BIDIAGONAL_BLOCK;
+        for (size_t block = blocks; block-- > 0; )
+        {
+          size_t k = block * BIDIAGONAL_BLOCK;
+          blockReflector(Pt, form.taup, k, std::min(BIDIAGONAL_BLOCK, count - k), 1, W, Tb);
+          applyBlockReflector(W, Tb, &V(k + 1, 0), n, n, false);
+        }
+      }
+      result.u = std::move(U);
+      result.v = std::move(V);
+      return result;
+    }
+  } // namespace detail
+
+  // Thin SVD, A = U diag(values) V^T with values descending
+  template <typename T>
+  svd_decomposition<T>
+  svd(const basic_matrix<T>& A)
+  {
+    static_assert(std::is_floating_point_v<T>, "SVD needs a real floating-point type");
+    if (A.rows() >= A.cols())
+      return detail::tallSvd(A, true);
+
+    svd_decomposition<T> result = detail::tallSvd(transpose(A), true);
+    std::swap(result.u, result.v);
+    return result;
+  }
+
+  // Singular values of A in descending order, without the vectors
+  template <typename T>
+  std::vector<T>
+  singularValues(const basic_matrix<T>& A)
+  {
+    static_assert(std::is_floating_point_v<T>, "SVD needs a real floating-point type");
+    if (A.rows() >= A.cols())
+      return detail::tallSvd(A, false).values;
+    return detail::tallSvd(transpose(A), false).values;
+  }
+
+  // Number of singular values above tolerance. The default tolerance is
+  // max(m, n) eps times the largest singular value, as in MATLAB's rank.
+  template <typename T>
+  size_t
+  rank(const basic_matrix<T>& A, T tolerance = T(-1))
+  {
+    std::vector<T> values = singularValues(A);
+    if (values.empty())
+      return 0;
+    if (tolerance < 0)
+      tolerance = std::max(A.rows(), A.cols()) * std::numeric_limits<T>::epsilon() * values[0];
+    return std::count_if(values.begin(), values.end(), [&](T s) { return s > tolerance; });
+  }
+
+  // Moore-Penrose pseudo-inverse V diag(1 / values) U^T, dropping
+  // singular values at or below tolerance (defaulted as in rank)
+  template <typename T>
+  basic_matrix<T>
+  pseudoInverse(const basic_matrix<T>& A, T tolerance = T(-1))
+  {
+    svd_decomposition<T> s = svd(A);
+    size_t p = s.values.size();
+    if (tolerance < 0)
+      tolerance = p > 0 ? std::max(A.rows(), A.cols()) * std::numeric_limits<T>::epsilon() * s.values[0] : T(0);
+
+    // V diag(1 / values) as a scaled copy of V
+    basic_matrix<T> VS(s.v);
+    for (size_t i = 0; i < VS.rows(); ++i)
+      for (size_t j = 0; j < p; ++j)
+        VS(i, j) = s.values[j] > tolerance ? VS(i, j) / s.values[j] : T(0);
+
+    basic_matrix<T> result(A.cols(), A.rows(), T(0));
+    detail::gemmStrided(A.cols(), A.rows(), p, VS.begin(), p, size_t(1), s.u.begin(), size_t(1), p,
+                        result.begin(), A.rows(), T(1));
+    return result;
+  }
+
+  // Rank-k SVD of A by randomized range finding. oversample extra
+  // columns and powerIterations passes of A A^T improve accuracy when
+  // the singular values decay slowly. The result is exact, up to
+  // rounding, when A has rank at most k.
+  template <typename T>
+  svd_decomposition<T>
+  randomizedSvd(const basic_matrix<T>& A, size_t k, size_t oversample = 10, size_t powerIterations = 2,
+                unsigned long seed = 1)
+  {
+    static_assert(std::is_floating_point_v<T>, "SVD needs a real floating-point type");
+    size_t m = A.rows();
+    size_t n = A.cols();
+    k = std::min(k, std::min(m, n));
+    size_t l = std::min(k + oversample, std::min(m, n));
+    if (k == 0)
+      return {};
+
+    std::mt19937_64 gen(seed);
+    std::normal_distribution<T> dist;
+    basic_matrix<T> omega(n, l);
+    for (T& x : omega)
+      x = dist(gen);
+
+    // Q spans the range of A Omega, refined by Q = orth(A orth(A^T Q))
+    basic_matrix<T> Q = qr_factorization<T>(A * omega).thinQ();
+    for (size_t pass = 0; pass < powerIterations; ++pass)
+    {
+      basic_matrix<T> Z(n, l, T(0));
+      detail::gemmStrided(n, l, m, A.begin(), size_t(1), n, Q.begin(), l, size_t(1), Z.begin(), l, T(1));
+      Q = qr_factorization<T>(A * qr_factorization<T>(Z).thinQ()).thinQ();
+    }
+
+    // B = Q^T A is l x n; its SVD gives A's through U = Q U_B
+    basic_matrix<T> B(l, n, T(0));
+    detail::gemmStrided(l, n, m, Q.begin(), size_t(1), l, A.begin(), n, size_t(1), B.begin(), n, T(1));
+    svd_decomposition<T> small = svd(B);
+
+    svd_decomposition<T> result;
+    basic_matrix<T> QU = Q * small.u;
+    result.values.assign(small.values.begin(), small.values.begin() + k);
+    result.u = basic_matrix<T>(QU.block(0, 0, m, k));
+    result.v = basic_matrix<T>(small.v.block(0, 0, n, k));
+    return result;
+  }
+
+  /**********************************************************************/
+  // Matrix batches
+  //
+  // matrix_batch holds many small matrices of one shape interleaved, so
+  // that one SIMD lane works on one matrix. The batch is cut into blocks
+  // of batchLanes<T> matrices (one 64-byte cache line of T). Within a
+  // block, element (i, j) of every matrix sits in one contiguous,
+  // aligned line, so the kernels below are plain loops over the lanes
+  // that compile to full-width vector arithmetic with no shuffles. Each
+  // block is contiguous, and blocks are spread across the thread pool.
+  // Pivoting is per lane: the pivot search is a vectorized select, and
+  // only the row swap itself touches lanes one at a time.
+  namespace detail
+  {
+    template <typename T>
+    constexpr size_t batchLanes = std::max(STORAGE_ALIGNMENT / sizeof(T), size_t(1));
+
+    // C = A B for the `blocks` blocks starting at A, B and C
+    template <typename T>
+    inline void
+    batchGemm(size_t blocks, size_t M, size_t N, size_t K, const T* A, const T* B, T* C)
+    {
+      constexpr size_t L = batchLanes<T>;
+      for (size_t block = 0; block < blocks; ++block)
+      {
+        const T* a = A + block * M * K * L;
+        const T* b = B + block * K * N * L;
+        T* c = C + block * M * N * L;
+        for (size_t i = 0; i < M; ++i)
+          for (size_t j = 0; j < N; ++j)
+          {
+            T sum[L] = {};
+            for (size_t k = 0; k < K; ++k)
+            {
+              const T* aik = a + (i * K + k) * L;
+              const T* bkj = b + (k * N + j) * L;
+              for (size_t l = 0; l < L; ++l)
+                sum[l] += aik[l] * bkj[l];
+            }
+            std::copy_n(sum, L, c + (i * N + j) * L);
+          }
+      }
+    }
+
+    // Swaps, lane by lane, row k of an n x width block with row pivot[l]
+    // chosen as the largest |a(i, k)| for i >= k
+    template <typename T>
+    inline void
+    batchPivot(size_t n, size_t width, size_t k, T* a, size_t* pivot)
+    {
+      constexpr size_t L = batchLanes<T>;
+      real_t<T> best[L];
+      for (size_t l = 0; l < L; ++l)
+      {
+        pivot[l] = k;
+        best[l] = std::abs(a[(k * width + k) * L + l]);
+      }
+      for (size_t i = k + 1; i < n; ++i)
+        for (size_t l = 0; l < L; ++l)
+        {
+          real_t<T> v = std::abs(a[(i * width + k) * L + l]);
+          pivot[l] = v > best[l] ? i : pivot[l];
+          best[l] = v > best[l] ? v : best[l];
+        }
+
+      // One pass per distinct pivot row, blending whole lines so the
+      // swap vectorizes like the elimination does
+      T* ak = a + k * width * L;
+      for (size_t i = k + 1; i < n; ++i)
+      {
+        bool chosen[L];
+        bool any = false;
+        for (size_t l = 0; l < L; ++l)
+        {
+          chosen[l] = pivot[l] == i;
+          any = any || chosen[l];
+        }
+        if (!any)
+          continue;
+
+        T* ai = a + i * width * L;
+        for (size_t j = 0; j < width * L; j += L)
+          for (size_t l = 0; l < L; ++l)
+          {
+            T x = ak[j + l];
+            T y = ai[j + l];
+            ak[j + l] = chosen[l] ? y : x;
+            ai[j + l] = chosen[l] ? x : y;
+          }
+      }
+    }
+
+    // In-place PA = LU of each n x n matrix, with its determinant
+    template <typename T>
+    inline void
+    batchLu(size_t blocks, size_t n, T* A, size_t* pivots, T* det)
+    {
+      constexpr size_t L = batchLanes<T>;
+      for (size_t block = 0; block < blocks; ++block)
+      {
+        T* a = A + block * n * n * L;
+        size_t* p = pivots + block * n * L;
+        T* d = det + block * L;
+        std::fill_n(d, L, T(1));
+
+        for (size_t k = 0; k < n; ++k)
+        {
+          batchPivot(n, n, k, a, p + k * L);
+
+          T inv[L];
+          const T* akk = a + (k * n + k) * L;
+          for (size_t l = 0; l < L; ++l)
+          {
+            d[l] *= p[k * L + l] != k ? -akk[l] : akk[l];
+            inv[l] = akk[l] != T(0) ? T(1) / akk[l] : T(0);
+          }
+
+          for (size_t i = k + 1; i < n; ++i)
+          {
+            // The multipliers are copied out so the compiler need not
+            // assume the row update overwrites them
+            T* aik = a + (i * n + k) * L;
+            T f[L];
+            for (size_t l = 0; l < L; ++l)
+              f[l] = aik[l] *= inv[l];
+            for (size_t j = k + 1; j < n; ++j)
+            {
+              T* aij = a + (i * n + j) * L;
+              const T* akj = a + (k * n + j) * L;
+              for (size_t l = 0; l < L; ++l)
+                aij[l] -= f[l] * akj[l];
+            }
+          }
+        }
+      }
+    }
+
+    // Gauss-Jordan on [A | I], n x 2n per matrix in `work`, leaving A^-1
+    // in A. Lanes whose matrix is singular are counted and left alone.
+    template <typename T>
+    inline size_t
+    batchInverse(size_t blocks, size_t n, T* A, T* work)
+    {
+      constexpr size_t L = batchLanes<T>;
+      size_t width = 2 * n;
+      size_t singular = 0;
+      for (size_t block = 0; block < blocks; ++block)
+      {
+        T* a = A + block * n * n * L;
+        for (size_t i = 0; i < n; ++i)
+          for (size_t j = 0; j < n; ++j)
+          {
+            std::copy_n(a + (i * n + j) * L, L, work + (i * width + j) * L);
+            std::fill_n(work + (i * width + n + j) * L, L, T(i == j));
+          }
+
+        bool ok[L];
+        std::fill_n(ok, L, true);
+        size_t pivot[L];
+        for (size_t k = 0; k < n; ++k)
+        {
+          batchPivot(n, width, k, work, pivot);
+
+          T inv[L];
+          T* wk = work + k * width * L;
+          for (size_t l = 0; l < L; ++l)
+          {
+            ok[l] = ok[l] && wk[k * L + l] != T(0);
+            inv[l] = wk[k * L + l] != T(0) ? T(1) / wk[k * L + l] : T(0);
+          }
+          for (size_t j = k; j < width; ++j)
+            for (size_t l = 0; l < L; ++l)
+              wk[j * L + l] *= inv[l];
+
+          for (size_t i = 0; i < n; ++i)
+          {
+            if (i == k)
+              continue;
+            T* wi = work + i * width * L;
+            T f[L];
+            std::copy_n(wi + k * L, L, f);
+            for (size_t j = k; j < width; ++j)
+              for (size_t l = 0; l < L; ++l)
+                wi[j * L + l] -= f[l] * wk[j * L + l];
+          }
+        }
+
+        for (size_t l = 0; l < L; ++l)
+        {
+          if (!ok[l])
+          {
+            ++singular;
+            continue;
+          }
+          for (size_t i = 0; i < n; ++i)
+            for (size_t j = 0; j < n; ++j)
+              a[(i * n + j) * L + l] = work[(i * width + n + j) * L + l];
+        }
+      }
+      return singular;
+    }
+
+    // The same kernels compiled for wider vector units. flatten inlines
+    // the loops above so the target applies to them.
+#if defined(__x86_64__) || defined(__i386__)
+    template <typename T>
+    __attribute__((target("avx2"), flatten)) void
+    batchGemmAvx2(size_t blocks, size_t M, size_t N, size_t K, const T* A, const T* B, T* C)
+    {
+      batchGemm(blocks, M, N, K, A, B, C);
+    }
+
+    template <typename T>
+    __attribute__((target("avx2"), flatten)) void
+    batchLuAvx2(size_t blocks, size_t n, T* A, size_t* pivots, T* det)
+    {
+      batchLu(blocks, n, A, pivots, det);
+    }
+
+    template <typename T>
+    __attribute__((target("avx2"), flatten)) size_t
+    batchInverseAvx2(size_t blocks, size_t n, T* A, T* work)
+    {
+      return batchInverse(blocks, n, A, work);
+    }
+
+    template <typename T>
+    __attribute__((target("avx512f"), flatten)) void
+    batchGemmAvx512(size_t blocks, size_t M, size_t N, size_t K, const T* A, const T* B, T* C)
+    {
+      batchGemm(blocks, M, N, K, A, B, C);
+    }
+
+    template <typename T>
+    __attribute__((target("avx512f"), flatten)) void
+    batchLuAvx512(size_t blocks, size_t n, T* A, size_t* pivots, T* det)
+    {
+      batchLu(blocks, n, A, pivots, det);
+    }
+
+    template <typename T>
+    __attribute__((target("avx512f"), flatten)) size_t
+    batchInverseAvx512(size_t blocks, size_t n, T* A, T* work)
+    {
+      return batchInverse(blocks, n, A, work);
+    }
+#endif
+
+    template <typename T>
+    struct batch_kernels
+    {
+      void (*gemm)(size_t blocks, size_t M, size_t N, size_t K, const T* A, const T* B, T* C);
+      void (*lu)(size_t blocks, size_t n, T* A, size_t* pivots, T* det);
+      size_t (*inverse)(size_t blocks, size_t n, T* A, T* work);
+    };
+
+    // Follows the element-wise kernel choice, so MATRIX_SIMD applies here too
+    template <typename T>
+    const batch_kernels<T>&
+    batchKernels()
+    {
+      static const batch_kernels<T> kernels = [] {
+        std::string level = simd<T>().name;
+#if defined(__x86_64__) || defined(__i386__)
+        if (level == "avx512")
+          return batch_kernels<T> { batchGemmAvx512<T>, batchLuAvx512<T>, batchInverseAvx512<T> };
+        if (level == "avx2")
+          return batch_kernels<T> { batchGemmAvx2<T>, batchLuAvx2<T>, batchInverseAvx2<T> };
+#endif
+        return batch_kernels<T> { batchGemm<T>, batchLu<T>, batchInverse<T> };
+      }();
+      return kernels;
+    }
+  } // namespace detail
+
+  template <typename T = elem_t>
+  class matrix_batch
+  {
+  public:
+    using value_type = T;
+
+    // Matrices per block, the SIMD width of the batch kernels
+    static constexpr size_t LANES = detail::batchLanes<T>;
+
+    matrix_batch() = default;
+
+    // count matrices of rows x cols, zeroed; the last block is padded
+    // with zero matrices
+    matrix_batch(size_t count, size_t rows, size_t cols)
+      : m_count(count),
+        m_rows(rows),
+        m_cols(cols),
+        m_data((count + LANES - 1) / LANES, rows * cols * LANES, T(0))
+    {
+    }
+
+    matrix_batch(size_t count, size_t rows, size_t cols, T init)
+      : matrix_batch(count, rows, cols)
+    {
+      for (size_t b = 0; b < count; ++b)
+        for (size_t e = 0; e < rows * cols; ++e)
+          m_data(b / LANES, e * LANES + b % LANES) = init;
+    }
+
+    size_t
+    count() const
+    {
+      return m_count;
+    }
+
+    size_t
+    rows() const
+    {
+      return m_rows;
+    }
+
+    size_t
+    cols() const
+    {
+      return m_cols;
+    }
+
+    // Number of LANES-wide blocks, including a padded last one
+    size_t
+    blocks() const
+    {
+      return m_data.rows();
+    }
+
+    // Element (row, col) of matrix `index`
+    T&
+    operator()(size_t index, size_t row, size_t col)
+    {
+      return m_data(index / LANES, (row * m_cols + col) * LANES + index % LANES);
+    }
+
+    const T&
+    operator()(size_t index, size_t row, size_t col) const
+    {
+      return data(index / LANES)[(row * m_cols + col) * LANES + index % LANES];
+    }
+
+    // Copies matrix `index` out of the batch
+    basic_matrix<T>
+    get(size_t index) const
+    {
+      basic_matrix<T> A(m_rows, m_cols);
+      for (size_t i = 0; i < m_rows; ++i)
+        for (size_t j = 0; j < m_cols; ++j)
+          A(i, j) = (*this)(index, i, j);
+      return A;
+    }
+
+    void
+    set(size_t index, const basic_matrix<T>& A)
+    {
+      if (A.rows() != m_rows || A.cols() != m_cols)
+      {
+        std::cerr << "Matrix does not match the batch shape\n";
+        return;
+      }
+
+      for (size_t i = 0; i < m_rows; ++i)
+        for (size_t j = 0; j < m_cols; ++j)
+          (*this)(index, i, j) = A(i, j);
+    }
+
+    // Start of block `block`
+    T*
+    data(size_t block)
+    {
+      return m_data.begin() + block * m_data.cols();
+    }
+
+    const T*
+    data(size_t block) const
+    {
+      return m_data.begin() + block * m_data.cols();
+    }
+
+  private:
+    size_t m_count = 0;
+    size_t m_rows = 0;
+    size_t m_cols = 0;
+    // One row per block, so blocks inherit the matrix storage's
+    // cache-line alignment
+    basic_matrix<T> m_data;
+  };
+
+  // Product of each pair A[b] B[b]
+  template <typename T>
+  matrix_batch<T>
+  operator*(const matrix_batch<T>& A, const matrix_batch<T>& B)
+  {
+    if (A.count() != B.count() || A.cols() != B.rows())
+    {
+      std::cerr << "Cannot multiply, returning first batch\n";
+      return A;
+    }
+
+    size_t M = A.rows(), N = B.cols(), K = A.cols();
+    matrix_batch<T> C(A.count(), M, N);
+    if (C.blocks() == 0)
+      return C;
+    detail::forRowRanges(A.blocks(), A.blocks() * M * N * K * A.LANES, [&](size_t first, size_t last) {
+      detail::batchKernels<T>().gemm(last - first, M, N, K, A.data(first), B.data(first), C.data(first));
+    });
+    return C;
+  }
+
+  // PA = LU of every matrix in a batch. L (unit lower) and U share the
+  // batch, and pivots(index, k) is the row swapped with row k.
+  template <typename T = elem_t>
+  class batch_lu_factorization
+  {
+    static_assert(!std::is_integral_v<T>,
+                  "LU factorization needs a field type; use mod for integers");
+
+  public:
+    static constexpr size_t LANES = matrix_batch<T>::LANES;
+
+    batch_lu_factorization() = default;
+
+    explicit batch_lu_factorization(matrix_batch<T> A)
+      : m_lu(std::move(A)),
+        m_pivots(m_lu.blocks() * m_lu.rows() * LANES),
+        m_determinants(m_lu.blocks() * LANES)
+    {
+      if (m_lu.rows() != m_lu.cols())
+      {
+        std::cerr << "LU factorization requires square matrices\n";
+        *this = batch_lu_factorization();
+        return;
+      }
+
+      size_t n = m_lu.rows();
+      if (m_lu.blocks() == 0)
+        return;
+      detail::forRowRanges(m_lu.blocks(), m_lu.blocks() * n * n * n * LANES, [&](size_t first, size_t last) {
+        detail::batchKernels<T>().lu(last - first, n, m_lu.data(first),
+                                     &m_pivots[first * n * LANES], &m_determinants[first * LANES]);
+      });
+      m_determinants.resize(m_lu.count());
+    }
+
+    size_t
+    count() const
+    {
+      return m_lu.count();
+    }
+
+    // Unit lower L below the diagonal and U on and above it
+    const matrix_batch<T>&
+    factors() const
+    {
+      return m_lu;
+    }
+
+    size_t
+    pivot(size_t index, size_t k) const
+    {
+      return m_pivots[(index / LANES * m_lu.rows() + k) * LANES + index % LANES];
+    }
+
+    const std::vector<T>&
+    determinants() const
+    {
+      return m_determinants;
+    }
+
+  private:
+    matrix_batch<T> m_lu;
+    std::vector<size_t> m_pivots;
+    std::vector<T> m_determinants;
+  };
+
+  // Determinant of every matrix in a batch. Each block is factored in a
+  // scratch copy that stays in cache, so the batch is read once and
+  // nothing batch-sized is written.
+  template <typename T>
+  std::vector<T>
+  determinant(const matrix_batch<T>& A)
+  {
+    static_assert(!std::is_integral_v<T>,
+                  "LU factorization needs a field type; use mod for integers");
+
+    if (A.rows() != A.cols())
+    {
+      std::cerr << "Determinant requires square matrices\n";
+      return std::vector<T>(A.count(), T(0));
+    }
+
+    size_t n = A.rows();
+    constexpr size_t L = matrix_batch<T>::LANES;
+    std::vector<T> det(A.blocks() * L);
+    if (A.blocks() > 0)
+      detail::forRowRanges(A.blocks(), A.blocks() * n * n * n * L, [&](size_t first, size_t last) {
+        std::vector<T> work(n * n * L);
+        std::vector<size_t> pivots(n * L);
+        for (size_t block = first; block < last; ++block)
+        {
+          std::copy_n(A.data(block), n * n * L, work.begin());
+          detail::batchKernels<T>().lu(1, n, work.data(), pivots.data(), &det[block * L]);
+        }
+      });
+    det.resize(A.count());
+    return det;
+  }
+
+  // Inverse of every matrix in a batch. Singular matrices are reported
+  // and left as they were.
+  template <typename T>
+  matrix_batch<T>
+  inverse(matrix_batch<T> A)
+  {
+    static_assert(!std::is_integral_v<T>, "Inverse needs a field type");
+
+    if (A.rows() != A.cols())
+    {
+      std::cerr << "Inverse requires square matrices\n";
+      return A;
+    }
+
+    size_t n = A.rows();
+    constexpr size_t L = matrix_batch<T>::LANES;
+    std::atomic<size_t> singular { 0 };
+    if (A.blocks() > 0)
+      detail::forRowRanges(A.blocks(), A.blocks() * n * n * n * L, [&](size_t first, size_t last) {
+        std::vector<T> work(2 * n * n * L);
+        singular += detail::batchKernels<T>().inverse(last - first, n, A.data(first), work.data());
+      });
+
+    // Padding lanes hold zero matrices, which are singular too
+    size_t padding = A.blocks() * L - A.count();
+    if (singular > padding)
+      std::cerr << "Inverse does not exist for " << singular - padding << " matrices\n";
+    return A;
+  }
+
+  /**********************************************************************/
+  // Modular matrices
+  //
+  // modular_matrix holds residues 0 <= a < p for a modulus 2 <= p < 2^31,
+  // so arithmetic over GF(p), or Z/pZ for composite p, is exact. Scalar
+  // products are reduced with Barrett's method: a high multiply by
+  // floor(2^64 / p) and one correction instead of a division. Matrix
+  // products run through the double GEMM above, which is exact while
+  // every partial sum stays below 2^53: the inner dimension is cut into
+  // chunks short enough for that and each chunk's product is reduced
+  // before the next is added. When p is too large for useful chunks, both
+  // operands are split into 16-bit halves and four products combined.
+  // (Strassen is never used here; its differences would break the bound.)
+  //
+  // Elimination is blocked like the LU above: each panel is reduced one
+  // pivot at a time, then the rows below take one modular GEMM. The back
+  // substitution for the reduced form goes panel by panel the same way.
+  // Pivots must be units, so when p is composite and a column has only
+  // zero divisors left, elimination reports it; the determinant then
+  // falls back to Euclid's algorithm on rows, which works for any p.
+  namespace detail
+  {
+    // Moduli stay below this so the sum of two residues fits 32 bits
+    constexpr std::uint64_t MODULUS_LIMIT = std::uint64_t(1) << 31;
+
+    // Panel width of modular elimination
+    constexpr size_t MODULAR_BLOCK = 128;
+
+    // Largest integer below which every double is exact
+    constexpr double EXACT_DOUBLE = 9007199254740992.0;
+
+    // Inner chunks shorter than this split the operands into halves
+    constexpr size_t MODULAR_CHUNK = 64;
+
+    // Arithmetic modulo p with Barrett reduction
+    class modulus
+    {
+    public:
+      explicit modulus(std::uint32_t p = 2)
+        : m_p(p),
+          m_mu(~std::uint64_t(0) / p)
+      {
+      }
+
+      std::uint32_t
+      value() const
+      {
+        return m_p;
+      }
+
+      // x mod p. The estimated quotient is at most one short, so one
+      // subtraction finishes it.
+      std::uint32_t
+      reduce(std::uint64_t x) const
+      {
+#ifdef __SIZEOF_INT128__
+        std::uint64_t q = std::uint64_t((static_cast<unsigned __int128>(x) * m_mu) >> 64);
+        std::uint64_t r = x - q * m_p;
+        return std::uint32_t(r >= m_p ? r - m_p : r);
+#else
+        return std::uint32_t(x % m_p);
+#endif
+      }
+
+      std::uint32_t
+      add(std::uint32_t a, std::uint32_t b) const
+      {
+        std::uint32_t sum = a + b;
+        return sum >= m_p ? sum - m_p : sum;
+      }
+
+      std::uint32_t
+      subtract(std::uint32_t a, std::uint32_t b) const
+      {
+        return a >= b ? a - b : a + (m_p - b);
+      }
+
+      std::uint32_t
+      multiply(std::uint32_t a, std::uint32_t b) const
+      {
+        return reduce(std::uint64_t(a) * b);
+      }
+
+      std::uint32_t
+      negate(std::uint32_t a) const
+      {
+        return a == 0 ? 0 : m_p - a;
+      }
+
+      // a^-1 by the extended Euclidean algorithm, or 0 when gcd(a, p) != 1
+      std::uint32_t
+      inverse(std::uint32_t a) const
+      {
+        long long r0 = m_p, r1 = a, s0 = 0, s1 = 1;
+        while (r1 != 0)
+        {
+          long long q = r0 / r1;
+          std::tie(r0, r1) = std::make_tuple(r1, r0 - q * r1);
+          std::tie(s0, s1) = std::make_tuple(s1, s0 - q * s1);
+        }
+        if (r0 != 1)
+          return 0;
+        return std::uint32_t(s0 < 0 ? s0 + m_p : s0);
+      }
+
+      // Residue of an integer, or of a real rounded to the nearest one
+      template <typename T>
+      std::uint32_t
+      residue(T x) const
+      {
+        if constexpr (std::is_integral_v<T>)
+        {
+          long long r = static_cast<long long>(x) % static_cast<long long>(m_p);
+          return std::uint32_t(r < 0 ? r + m_p : r);
+        }
+        else
+        {
+          // fmod is exact, so large integers lose nothing here
+          double r = std::fmod(std::round(static_cast<double>(x)), double(m_p));
+          if (std::isnan(r))
+            return 0;
+          return std::uint32_t(r < 0 ? r + m_p : r);
+        }
+      }
+
+      // x[j] -= k * y[j] for n residues
+      void
+      subtractMultiple(size_t n, std::uint32_t* x, const std::uint32_t* y, std::uint32_t k) const
+      {
+        std::uint64_t minus = m_p - k;
+        for (size_t j = 0; j < n; ++j)
+          x[j] = reduce(x[j] + minus * y[j]);
+      }
+
+      // x[j] *= k for n residues
+      void
+      scale(size_t n, std::uint32_t* x, std::uint32_t k) const
+      {
+        for (size_t j = 0; j < n; ++j)
+          x[j] = multiply(x[j], k);
+      }
+
+      bool
+      operator==(const modulus& other) const
+      {
+        return m_p == other.m_p;
+      }
+
+    private:
+      std::uint32_t m_p;
+      std::uint64_t m_mu;
+    };
+
+    // C += A * B mod p, or C -= A * B when subtract, for row-major arrays
+    // of residues. Exact through the double GEMM (see above).
+    inline void
+    modularGemm(size_t M, size_t N, size_t K, const std::uint32_t* A, size_t lda,
+                const std::uint32_t* B, size_t ldb, std::uint32_t* C, size_t ldc,
+                const modulus& p, bool subtract)
+    {
+      if (M == 0 || N == 0 || K == 0)
+        return;
+
+      double largest = p.value() - 1;
+      size_t chunk = size_t(EXACT_DOUBLE / (largest * largest));
+      bool split = chunk < std::min(K, MODULAR_CHUNK);
+      // Halves are below 2^16, and the middle term sums two products
+      if (split)
+        chunk = size_t(EXACT_DOUBLE / (2.0 * 65535.0 * 65535.0));
+      chunk = std::min(chunk, K);
+
+      std::vector<double> a(M * chunk), b(chunk * N), t(M * N);
+      std::vector<double> a2(split ? M * chunk : 0), b2(split ? chunk * N : 0);
+      std::uint32_t shift16 = p.reduce(std::uint64_t(1) << 16);
+      std::uint32_t shift32 = p.reduce(std::uint64_t(1) << 32);
+
+      // a (and a2) from A's columns [k0, k0 + kc), high half first when split
+      auto load = [&](size_t k0, size_t kc) {
+        forRowRanges(M, M * kc, [&](size_t first, size_t last) {
+          for (size_t i = first; i < last; ++i)
+            for (size_t q = 0; q < kc; ++q)
+            {
+              std::uint32_t x = A[i * lda + k0 + q];
+              a[i * kc + q] = split ? x >> 16 : x;
+              if (split)
+                a2[i * kc + q] = x & 0xffff;
+            }
+        });
+        forRowRanges(kc, kc * N, [&](size_t first, size_t last) {
+          for (size_t q = first; q < last; ++q)
+            for (size_t j = 0; j < N; ++j)
+            {
+              std::uint32_t x = B[(k0 + q) * ldb + j];
+              b[q * N + j] = split ? x >> 16 : x;
+              if (split)
+                b2[q * N + j] = x & 0xffff;
+            }
+        });
+      };
+
+      // t = x * y, then C +-= (t mod p) * factor
+      auto fold = [&](size_t kc, std::initializer_list<std::pair<const double*, const double*>> terms,
+                      std::uint32_t factor) {
+        std::fill(t.begin(), t.end(), 0.0);
+        for (const auto& [x, y] : terms)
+          gemm(M, N, kc, x, kc, y, N, t.data(), N);
+        forRowRanges(M, M * N, [&](size_t first, size_t last) {
+          for (size_t i = first; i < last; ++i)
+            for (size_t j = 0; j < N; ++j)
+            {
+              std::uint32_t r = p.reduce(std::uint64_t(t[i * N + j]));
+              if (factor != 1)
+                r = p.multiply(r, factor);
+              std::uint32_t& c = C[i * ldc + j];
+              c = subtract ? p.subtract(c, r) : p.add(c, r);
+            }
+        });
+      };
+
+      for (size_t k0 = 0; k0 < K; k0 += chunk)
+      {
+        size_t kc = std::min(chunk, K - k0);
+        load(k0, kc);
+        if (!split)
+          fold(kc, { { a.data(), b.data() } }, 1);
+        else
+        {
+          fold(kc, { { a.data(), b.data() } }, shift32);
+          fold(kc, { { a.data(), b2.data() }, { a2.data(), b.data() } }, shift16);
+          fold(kc, { { a2.data(), b2.data() } }, 1);
+        }
+      }
+    }
+
+    // Inverse of a k x k unit lower (or upper) triangular T. Only the
+    // strict triangle of T is read.
+    inline std::vector<std::uint32_t>
+    unitTriangularInverse(size_t k, const std::uint32_t* T, bool lower, const modulus& p)
+    {
+      std::vector<std::uint32_t> X(k * k, 0);
+      for (size_t n = 0; n < k; ++n)
+      {
+        size_t t = lower ? n : k - 1 - n;
+        std::uint32_t* x = X.data() + t * k;
+        x[t] = 1;
+        if (lower)
+          for (size_t s = 0; s < t; ++s)
+            p.subtractMultiple(s + 1, x, X.data() + s * k, T[t * k + s]);
+        else
+          for (size_t s = t + 1; s < k; ++s)
+            p.subtractMultiple(k - s, x + s, X.data() + s * k + s, T[t * k + s]);
+      }
+      return X;
+    }
+
+    // The k x cols block at A replaced by X times it, for k x k X
+    inline void
+    multiplyRowsLeft(size_t k, const std::uint32_t* X, size_t cols, std::uint32_t* A, size_t lda,
+                     const modulus& p)
+    {
+      std::vector<std::uint32_t> copy(k * cols);
+      for (size_t i = 0; i < k; ++i)
+      {
+        std::copy_n(A + i * lda, cols, copy.data() + i * cols);
+        std::fill_n(A + i * lda, cols, 0);
+      }
+      modularGemm(k, cols, k, X, k, copy.data(), cols, A, lda, p, false);
+    }
+
+    // Blocked Gaussian elimination of the rows x cols residues at A, in
+    // place, to row echelon form with unscaled pivots. pivots gets each
+    // nonzero row's pivot column and det the product of the pivots, signed
+    // by the row swaps. Returns false, leaving A partly reduced, when a
+    // column's remaining entries are nonzero but none is a unit.
+    inline bool
+    modularEchelon(size_t rows, size_t cols, std::uint32_t* A, size_t lda, const modulus& p,
+                   std::vector<size_t>& pivots, std::uint32_t& det)
+    {
+      pivots.clear();
+      det = 1;
+      bool negated = false;
+      size_t rank = 0;
+      std::vector<std::uint32_t> L;
+
+      for (size_t col0 = 0; col0 < cols && rank < rows; col0 += MODULAR_BLOCK)
+      {
+        size_t colEnd = std::min(cols, col0 + MODULAR_BLOCK);
+        size_t first = rank;
+
+        // Panel: each pivot clears its column within the panel, leaving
+        // the multipliers in place of the cleared entries
+        for (size_t c = col0; c < colEnd && rank < rows; ++c)
+        {
+          size_t pivot = rows;
+          bool nonzero = false;
+          for (size_t i = rank; i < rows && pivot == rows; ++i)
+            if (A[i * lda + c] != 0)
+            {
+              nonzero = true;
+              if (p.inverse(A[i * lda + c]) != 0)
+                pivot = i;
+            }
+
+          if (pivot == rows && nonzero)
+            return false;
+          if (pivot == rows)
+            continue;
+
+          if (pivot != rank)
+          {
+            std::swap_ranges(A + pivot * lda, A + pivot * lda + cols, A + rank * lda);
+            negated = !negated;
+          }
+
+          std::uint32_t* top = A + rank * lda;
+          std::uint32_t inverse = p.inverse(top[c]);
+          det = p.multiply(det, top[c]);
+          for (size_t i = rank + 1; i < rows; ++i)
+          {
+            std::uint32_t* row = A + i * lda;
+            if (row[c] == 0)
+              continue;
+            row[c] = p.multiply(row[c], inverse);
+            p.subtractMultiple(colEnd - c - 1, row + c + 1, top + c + 1, row[c]);
+          }
+          pivots.push_back(c);
+          ++rank;
+        }
+
+        size_t k = rank - first;
+        if (k > 0 && colEnd < cols)
+        {
+          // The panel's pivot rows to the right, times the inverse of the
+          // unit lower triangle of their multipliers
+          L.resize(k * k);
+          for (size_t t = 0; t < k; ++t)
+            for (size_t s = 0; s < t; ++s)
+              L[t * k + s] = A[(first + t) * lda + pivots[first + s]];
+          multiplyRowsLeft(k, unitTriangularInverse(k, L.data(), true, p).data(), cols - colEnd,
+                           A + first * lda + colEnd, lda, p);
+
+          // The rows below: one modular GEMM with the gathered multipliers
+          L.resize((rows - rank) * k);
+          for (size_t i = rank; i < rows; ++i)
+            for (size_t s = 0; s < k; ++s)
+              L[(i - rank) * k + s] = A[i * lda + pivots[first + s]];
+          modularGemm(rows - rank, cols - colEnd, k, L.data(), k, A + first * lda + colEnd, lda,
+                      A + rank * lda + colEnd, lda, p, true);
+        }
+
+        for (size_t s = 0; s < k; ++s)
+          for (size_t i = first + s + 1; i < rows; ++i)
+            A[i * lda + pivots[first + s]] = 0;
+      }
+
+      if (rank < std::min(rows, cols) || rows != cols)
+        det = 0;
+      if (negated)
+        det = p.negate(det);
+      return true;
+    }
+
+    // Scales the pivot rows of an echelon form to leading ones and clears
+    // the entries above them, a panel of pivots at a time from the bottom
+    inline void
+    modularBackSubstitute(size_t cols, std::uint32_t* A, size_t lda, const modulus& p,
+                          const std::vector<size_t>& pivots)
+    {
+      size_t rank = pivots.size();
+      for (size_t i = 0; i < rank; ++i)
+        p.scale(cols - pivots[i], A + i * lda + pivots[i], p.inverse(A[i * lda + pivots[i]]));
+
+      std::vector<std::uint32_t> F;
+      for (size_t last = rank; last > 0;)
+      {
+        size_t first = last > MODULAR_BLOCK ? last - MODULAR_BLOCK : 0;
+        size_t col = pivots[first];
+
+        // Within the panel: the inverse of the unit upper triangle in the
+        // pivot columns clears it
+        size_t k = last - first;
+        F.resize(k * k);
+        for (size_t t = 0; t < k; ++t)
+          for (size_t s = t + 1; s < k; ++s)
+            F[t * k + s] = A[(first + t) * lda + pivots[first + s]];
+        multiplyRowsLeft(k, unitTriangularInverse(k, F.data(), false, p).data(), cols - col,
+                         A + first * lda + col, lda, p);
+
+        // Rows above: their entries in the panel's pivot columns times the
+        // panel's rows, which now hold a unit vector in each of those columns
+        F.resize(first * k);
+        for (size_t i = 0; i < first; ++i)
+          for (size_t s = 0; s < k; ++s)
+            F[i * k + s] = A[i * lda + pivots[first + s]];
+        modularGemm(first, cols - col, k, F.data(), k, A + first * lda + col, lda, A + col, lda, p, true);
+
+        last = first;
+      }
+    }
+
+    // Determinant of n x n residues for any modulus. Euclid's algorithm on
+    // pairs of rows clears each column without dividing by a zero divisor.
+    inline std::uint32_t
+    euclideanDeterminant(size_t n, std::uint32_t* A, const modulus& p)
+    {
+      std::uint32_t det = 1;
+      for (size_t c = 0; c < n; ++c)
+      {
+        std::uint32_t* top = A + c * n;
+        for (size_t i = c + 1; i < n; ++i)
+        {
+          std::uint32_t* row = A + i * n;
+          while (row[c] != 0)
+          {
+            p.subtractMultiple(n - c, top + c, row + c, top[c] / row[c]);
+            std::swap_ranges(top + c, top + n, row + c);
+            det = p.negate(det);
+          }
+        }
+        det = p.multiply(det, top[c]);
+      }
+      return det;
+    }
+  } // namespace detail
+
+  // Dense matrix of residues modulo p. Entries are always reduced, so
+  // operator() hands out plain residues.
+  class modular_matrix
+  {
+  public:
+    using value_type = std::uint32_t;
+
+    modular_matrix() = default;
+
+    // rows x cols zeros modulo p
+    modular_matrix(size_t rows, size_t cols, std::uint64_t p)
+    {
+      if (p < 2 || p >= detail::MODULUS_LIMIT)
+      {
+        std::cerr << "Modulus must be between 2 and 2^31 - 1, returning empty matrix\n";
+        return;
+      }
+
+      m_rows = rows;
+      m_cols = cols;
+      m_modulus = detail::modulus(std::uint32_t(p));
+      m_data.assign(rows * cols, 0);
+    }
+
+    // Residues of A's entries, each rounded to the nearest integer first
+    template <typename T>
+    modular_matrix(const basic_matrix<T>& A, std::uint64_t p)
+      : modular_matrix(A.rows(), A.cols(), p)
     {
-      if (r1 >= m_rows || r2 >= m_rows)
+      if (m_data.empty())
         return;
-      for (size_t j = 0; j < m_cols; ++j) 
-      {
-        if (almostEqual((*this)(r2, j), -scalar * (*this)(r1, j)))
-          (*this)(r2, j) = 0;
-        else
-          (*this)(r2, j) += scalar * (*this)(r1, j);
-      }
+
+      auto a = A.begin();
+      for (std::uint32_t& x : m_data)
+        x = m_modulus.residue(*(a++));
     }
 
-    void 
-    multiplyRow(size_t r, elem_t scalar)
+    size_t
+    rows() const
     {
-      for (size_t j = 0; j < m_cols; ++j)
-        if ((*this)(r, j) != 0)
-          (*this)(r, j) *= scalar;
+      return m_rows;
     }
-    
-    void
-    zero()
+
+    size_t
+    cols() const
     {
-      for (auto& elem : *this)
-        elem = 0.0;
+      return m_cols;
     }
 
-    elem_t&
-    operator()(const size_t& row, const size_t& col)
+    std::uint32_t
+    modulus() const
     {
-      return m_matrix[(m_cols * row) + col];
+      return m_modulus.value();
     }
 
-    elem_t
-    operator()(const size_t& row, const size_t& col) const
+    const detail::modulus&
+    arithmetic() const
     {
-      return m_matrix[(m_cols * row) + col];
+      return m_modulus;
     }
 
-    // matrix addition
-    matrix&
-    operator+=(const matrix& other)
+    std::uint32_t
+    operator()(size_t row, size_t col) const
     {
-      if (m_rows == other.rows() && m_cols == other.cols())
-      {
-        for (size_t i = 0; i < other.rows(); ++i)
-          for (size_t j = 0; j < other.cols(); ++j)
-            (*this)(i, j) += other(i, j);
-      }
-      else
-        std::cerr << "Incompatible matrices, cannot add";
-      
+      return m_data[row * m_cols + col];
+    }
 
-      return *this;
+    // Stores value mod p
+    void
+    set(size_t row, size_t col, long long value)
+    {
+      m_data[row * m_cols + col] = m_modulus.residue(value);
     }
 
-    // matrix subtraction
-    matrix&
-    operator-=(const matrix& other)
+    std::uint32_t*
+    data()
     {
-      if (m_rows == other.rows() && m_cols == other.cols())
-      {
-        for (size_t i = 0; i < other.rows(); ++i)
-          for (size_t j = 0; j < other.cols(); ++j)
-            (*this)(i, j) -= other(i, j);
-      }
+      return m_data.data();
+    }
 
-      return *this;
+    const std::uint32_t*
+    data() const
+    {
+      return m_data.data();
     }
 
-    // matrix multiplication
-    matrix&
-    operator*=(const matrix& other)
+    // The residues as ordinary numbers
+    template <typename T = elem_t>
+    basic_matrix<T>
+    toMatrix() const
     {
-      if (m_cols == other.rows())
-      {
-        matrix result(m_rows, other.cols(), elem_t(0));
-        for (size_t i = 0; i < result.rows(); ++i)
-          for (size_t j = 0; j < result.cols(); ++j)
-            for (size_t k = 0; k < m_cols; ++k)
-              result(i, j) += (*this)(i, k) * other(k, j);
-          
-        *this = result;
-      }
-      else
-        std::cerr << "Cannot multiply, returning first matrix\n";
+      basic_matrix<T> A(m_rows, m_cols);
+      std::copy(m_data.begin(), m_data.end(), A.begin());
+      return A;
+    }
 
+    modular_matrix&
+    operator+=(const modular_matrix& B)
+    {
+      if (!compatible(B))
+        return *this;
+      for (size_t i = 0; i < m_data.size(); ++i)
+        m_data[i] = m_modulus.add(m_data[i], B.m_data[i]);
       return *this;
     }
 
-    // Scalar multiplication
-    matrix&
-    operator*=(elem_t k)
+    modular_matrix&
+    operator-=(const modular_matrix& B)
     {
-      for (auto& elem : *this)
-        if (elem != 0)
-          elem *= k;
-      
+      if (!compatible(B))
+        return *this;
+      for (size_t i = 0; i < m_data.size(); ++i)
+        m_data[i] = m_modulus.subtract(m_data[i], B.m_data[i]);
       return *this;
     }
 
-    matrix&
-    operator^=(unsigned long k)
+    modular_matrix&
+    operator*=(long long k)
     {
-      matrix res = *this;
-      for (unsigned long i = 1; i < k; ++i)
-        res *= *this;
-      
-      *this = res;
+      m_modulus.scale(m_data.size(), m_data.data(), m_modulus.residue(k));
       return *this;
     }
 
     bool
-    isRowEchelonForm() const
+    operator==(const modular_matrix& B) const
     {
-      size_t prevCol = 0;
-      for (size_t i = 0; i < m_rows; ++i)
-      {
-        for (size_t j = 0; j < m_cols; ++j)
-        {
-          elem_t elem = (*this)(i, j);
-          if (elem == 1 && j > prevCol)
-          {
-            prevCol = j;
-            break;
-          }
-          else if (elem != 0)
-            return false;
-        }
-      }
-
-      return true;	 
+      return m_rows == B.m_rows && m_cols == B.m_cols && m_modulus == B.m_modulus && m_data == B.m_data;
     }
-    
+
     bool
-    isZeroMatrix() const
+    operator!=(const modular_matrix& B) const
     {
-      for (const auto& elem : *this)
-        if (elem != 0)
-          return false;
-      return true;
+      return !(*this == B);
     }
 
   private:
-    size_t m_rows;
-    size_t m_cols;
-    size_t m_size;
-
-    elem_t* m_matrix;
-    
+    // Same shape and modulus; reports a mismatch
     bool
-    almostEqual(elem_t a, elem_t b)
+    compatible(const modular_matrix& B) const
     {
-      elem_t diff = std::fabs(a - b);
-      return diff <= std::numeric_limits<elem_t>::epsilon();
+      if (m_rows == B.m_rows && m_cols == B.m_cols && m_modulus == B.m_modulus)
+        return true;
+      std::cerr << "Modular matrices differ in shape or modulus\n";
+      return false;
     }
-  };
-  /**********************************************************************/
-  // Global functions
 
-  bool
-  almostEqual(elem_t a, elem_t b)
-  {
-    elem_t diff = std::fabs(a - b);
-    return diff <= std::numeric_limits<elem_t>::epsilon();
-  }
-  
-  // matrix addition
-  matrix
-  operator+(const matrix& A, const matrix& B)
-  {
-    return (matrix) A += B;
-  }
+    size_t m_rows = 0;
+    size_t m_cols = 0;
+    detail::modulus m_modulus;
+    std::vector<std::uint32_t> m_data;
+  };
 
-  matrix
-  operator-(const matrix& A, const matrix& B)
+  modular_matrix
+  operator+(modular_matrix A, const modular_matrix& B)
   {
-    return (matrix) A -= B;
+    return A += B;
   }
 
-  matrix
-  operator-(const matrix& A)
+  modular_matrix
+  operator-(modular_matrix A, const modular_matrix& B)
   {
-    return (matrix) A *= -1;
+    return A -= B;
   }
 
-  // matrix multiplication
-  matrix
-  operator*(const matrix& A, const matrix& B)
-  {
-    return (matrix) A *= B;
-  }
-  
-  // scalar multiplication
-  matrix
-  operator*(elem_t k, const matrix& A)
+  modular_matrix
+  operator-(modular_matrix A)
   {
-    return (matrix) A *= k;
+    return A *= -1;
   }
 
-  matrix
-  operator*(const matrix& A, elem_t k)
+  modular_matrix
+  operator*(modular_matrix A, long long k)
   {
-    return (matrix) A *= k;
+    return A *= k;
   }
 
-  matrix
-  operator^(const matrix& A, unsigned long k)
+  modular_matrix
+  operator*(long long k, modular_matrix A)
   {
-    return (matrix) A ^= k;
+    return A *= k;
   }
 
-  std::ostream&
-  operator<<(std::ostream& output, const matrix& A)
+  modular_matrix
+  operator*(const modular_matrix& A, const modular_matrix& B)
   {
-    output << std::left;
-    for (size_t i = 0; i < A.rows(); ++i)
+    if (A.cols() != B.rows() || A.modulus() != B.modulus())
     {
-      for (size_t j = 0; j < A.cols(); ++j)
-        output << std::setw(10) << A(i, j) << ' ';
-      output << '\n';
+      std::cerr << "Modular product not defined, returning A\n";
+      return A;
     }
 
-    return output;
+    modular_matrix C(A.rows(), B.cols(), A.modulus());
+    detail::modularGemm(A.rows(), B.cols(), A.cols(), A.data(), A.cols(), B.data(), B.cols(),
+                        C.data(), C.cols(), A.arithmetic(), false);
+    return C;
   }
-  
-  bool
-  operator==(const matrix& A, const matrix& B)
+
+  // A^k by repeated squaring
+  modular_matrix
+  operator^(const modular_matrix& A, unsigned long k)
   {
-    if (A.rows() != B.rows() || A.cols() != B.cols())
-      return false;
+    if (A.rows() != A.cols())
+    {
+      std::cerr << "Power of a non-square matrix, returning A\n";
+      return A;
+    }
 
+    modular_matrix result(A.rows(), A.cols(), A.modulus());
     for (size_t i = 0; i < A.rows(); ++i)
-      for (size_t j = 0; j < A.cols(); ++j)
-        if (!almostEqual(A(i, j), B(i, j)))
-          return false;
-
-    return true;
+      result.set(i, i, 1);
+    modular_matrix square = A;
+    for (; k > 0; k >>= 1)
+    {
+      if (k & 1)
+        result = result * square;
+      if (k > 1)
+        square = square * square;
+    }
+    return result;
   }
 
-  bool
-  operator!=(const matrix& A, const matrix& B)
+  std::ostream&
+  operator<<(std::ostream& output, const modular_matrix& A)
   {
-    return !(A == B);
+    return output << A.toMatrix();
   }
-  
-  // Gaussian elimination
-  matrix
-  rowEchelon(matrix A)
-  {
-    if (A.isRowEchelonForm())
-      return A;
 
-    for (size_t currTopRow = 0; currTopRow < A.rows(); ++currTopRow)
+  // Row echelon form with leading ones, as rowEchelon for real matrices
+  modular_matrix
+  rowEchelon(modular_matrix A)
+  {
+    std::vector<size_t> pivots;
+    std::uint32_t det;
+    if (!detail::modularEchelon(A.rows(), A.cols(), A.data(), A.cols(), A.arithmetic(), pivots, det))
     {
-      size_t currRow = currTopRow;
-      size_t currCol = 0;
-      
-      bool found = false;
-      for (size_t j = 0; j < A.cols(); ++j)
-      {
-        for (size_t i = currTopRow; i < A.rows(); ++i)
-        {
-          if (A(i, j) != 0)
-          {
-            found = true;
-            currRow = i;
-            currCol = j;
-            break;
-          }
-        }
-
-        if (found)
-          break;
-      }
-
-      if (!found)
-        return A;
-
-      if (currRow != currTopRow)
-      {
-        A.swapRows(currRow, currTopRow);
-        currRow = currTopRow;
-      }
-
-      elem_t leadingElement = A(currRow, currCol);
-      if (leadingElement != 1)
-        A.multiplyRow(currRow, 1.0 / leadingElement);
-
-      for (size_t i = currRow + 1; i < A.rows(); ++i)
-      {
-        elem_t elem = A(i, currCol);
-        if (elem != 0)
-          A.addRows(currRow, i, -elem);
-      }
+      std::cerr << "Elimination needs a prime modulus: pivot is a zero divisor\n";
+      return A;
     }
 
+    for (size_t i = 0; i < pivots.size(); ++i)
+      A.arithmetic().scale(A.cols() - pivots[i], A.data() + i * A.cols() + pivots[i],
+                           A.arithmetic().inverse(A(i, pivots[i])));
     return A;
   }
 
-  // Gauss-Jordan elimination
-  matrix
-  reducedRowEchelon(matrix A)
+  modular_matrix
+  reducedRowEchelon(modular_matrix A)
   {
-    A = rowEchelon(A);
-
-    for (size_t currBottomRow = A.rows() - 1; currBottomRow > 0; --currBottomRow)
+    std::vector<size_t> pivots;
+    std::uint32_t det;
+    if (!detail::modularEchelon(A.rows(), A.cols(), A.data(), A.cols(), A.arithmetic(), pivots, det))
     {
-      bool allZeros = true;
-      size_t leadingOne = 0;
-      for (size_t j = 0; j < A.cols(); ++j)
-      {
-        if (A(currBottomRow, j) != 0)
-        {
-          allZeros = false;
-          leadingOne = j;
-          break;
-        }
-      }
-
-      if (!allZeros)
-        for (size_t i = 0; i < currBottomRow; ++i)
-          A.addRows(currBottomRow, i, -A(i, leadingOne));
+      std::cerr << "Elimination needs a prime modulus: pivot is a zero divisor\n";
+      return A;
     }
 
+    detail::modularBackSubstitute(A.cols(), A.data(), A.cols(), A.arithmetic(), pivots);
     return A;
   }
-  
-  matrix
-  transpose(const matrix& A)
-  {
-    matrix transposed(A.cols(), A.rows());
-    
-    for (size_t i = 0; i < A.rows(); ++i)
-      for (size_t j = 0; j < A.cols(); ++j)
-        transposed(j, i) = A(i, j);
-
-    return transposed;
-  }
 
-  matrix
-  minorMatrix(const matrix& A, size_t r, size_t c)
+  size_t
+  rank(modular_matrix A)
   {
-    if (A.rows() == 1 || A.cols() == 1)
-      return A;
-
-    matrix M = matrix(A.rows() - 1, A.cols() - 1);
-    auto it = M.begin();
-
-    for (size_t i = 0; i < A.rows(); ++i)
-      for (size_t j = 0; j < A.cols(); ++j)
-        if (i != r && j != c)
-          *(it++) = A(i, j);
-
-    return M;
+    std::vector<size_t> pivots;
+    std::uint32_t det;
+    if (!detail::modularEchelon(A.rows(), A.cols(), A.data(), A.cols(), A.arithmetic(), pivots, det))
+      std::cerr << "Elimination needs a prime modulus: rank is a lower bound\n";
+    return pivots.size();
   }
 
-  elem_t
-  determinant(const matrix& A)
+  std::uint32_t
+  determinant(modular_matrix A)
   {
     if (A.rows() != A.cols())
     {
@@ -531,128 +9670,81 @@ namespace mat
       return 0;
     }
 
-    if (A.rows() == 2)
-      return (A(0, 0) * A(1, 1)) - (A(0, 1) * A(1, 0));
-
-    elem_t det = 0, sign = 1;
-    for (size_t j = 0; j < A.cols(); ++j)
-    {
-      det += sign * A(0, j) * determinant(minorMatrix(A, 0, j));
-      sign *= -1;
-    }
-
-    return det;
+    std::vector<size_t> pivots;
+    std::uint32_t det;
+    modular_matrix copy = A;
+    if (detail::modularEchelon(A.rows(), A.cols(), A.data(), A.cols(), A.arithmetic(), pivots, det))
+      return det;
+    return detail::euclideanDeterminant(copy.rows(), copy.data(), copy.arithmetic());
   }
-  
-  matrix
-  adjugate(const matrix& A)
+
+  namespace detail
   {
-    matrix C(A.rows(), A.cols());
-    elem_t sign = 1;
-    for (size_t i = 0; i < C.rows(); ++i)
+    // X with A X = B from the reduced form of [A | B], or false when A is
+    // not invertible mod p
+    inline bool
+    modularSolve(const modular_matrix& A, const modular_matrix& B, modular_matrix& X)
     {
-      for (size_t j = 0; j < C.cols(); ++j)
+      size_t n = A.rows();
+      size_t m = B.cols();
+      modular_matrix augmented(n, n + m, A.modulus());
+      for (size_t i = 0; i < n; ++i)
       {
-        C(i, j) = sign * determinant(minorMatrix(A, i, j));
-        sign *= -1;
+        std::copy_n(A.data() + i * n, n, augmented.data() + i * (n + m));
+        std::copy_n(B.data() + i * m, m, augmented.data() + i * (n + m) + n);
       }
-      sign *= -1;
-    }
 
-    return mat::transpose(C);
-  }
+      std::vector<size_t> pivots;
+      std::uint32_t det;
+      if (!modularEchelon(n, n + m, augmented.data(), n + m, A.arithmetic(), pivots, det)
+          || pivots.size() < n || (n > 0 && pivots[n - 1] != n - 1))
+        return false;
+      modularBackSubstitute(n + m, augmented.data(), n + m, A.arithmetic(), pivots);
+
+      X = modular_matrix(n, m, A.modulus());
+      for (size_t i = 0; i < n; ++i)
+        std::copy_n(augmented.data() + i * (n + m) + n, m, X.data() + i * m);
+      return true;
+    }
+  } // namespace detail
 
-  matrix
-  inverse(matrix& A)
+  // X with A X = B for square A invertible mod p
+  modular_matrix
+  solve(const modular_matrix& A, const modular_matrix& B)
   {
-    if (A.rows() != A.cols() || determinant(A) == 0)
+    if (A.cols() != A.rows() || B.rows() != A.rows() || A.modulus() != B.modulus())
     {
-      std::cerr << "Inverse does not exist.\n";
-      return A;
+      std::cerr << "Modular solve not defined, returning B\n";
+      return B;
     }
 
-    matrix augmented(A.rows(), 2 * A.cols());
-    
-    for (size_t i = 0; i < A.rows(); ++i)
+    modular_matrix X;
+    if (!detail::modularSolve(A, B, X))
     {
-      for (size_t j = 0; j < A.cols(); ++j)
-        augmented(i, j) = A(i, j);
-      
-      for (size_t j = A.cols(); j < augmented.cols(); ++j)
-        augmented(i, j) = j - A.cols() == i;
+      std::cerr << "Matrix is not invertible modulo " << A.modulus() << ", returning B\n";
+      return B;
     }
-
-    matrix reduced = reducedRowEchelon(augmented);
-    matrix inverse(A.rows(), A.cols());
-
-    for (size_t i = 0; i < reduced.rows(); ++i)
-      for (size_t j = A.cols(); j < reduced.cols(); ++j)
-        inverse(i, j - A.cols()) = reduced(i, j);
-
-    return inverse;
+    return X;
   }
 
-  matrix
-  augment(const matrix& A, const matrix& B)
+  modular_matrix
+  inverse(const modular_matrix& A)
   {
-    if (A.rows() != B.rows())
+    if (A.rows() != A.cols())
     {
-      std::cerr << "Number of rows not equal.\n";
+      std::cerr << "Inverse does not exist.\n";
       return A;
     }
 
-    matrix augmented(A.rows(), A.cols() + B.cols());
-
-    for (size_t i = 0; i < A.rows(); ++i)
-    {
-      size_t j;
-      for (j = 0; j < A.cols(); ++j)
-        augmented(i, j) = A(i, j);
-      for ( ; j < augmented.cols(); ++j)
-        augmented(i, j) = B(i, j - A.cols());
-    }
-
-    return augmented;
-  }
-
-  matrix
-  identity(size_t size)
-  {
-    mat::matrix A(size, size);
+    modular_matrix I(A.rows(), A.cols(), A.modulus());
     for (size_t i = 0; i < A.rows(); ++i)
-      for (size_t j = 0; j < A.cols(); ++j)
-        A(i, j) = i == j;
-
-    return A;
-  }
-
-  matrix
-  zero(size_t rows, size_t cols)
-  {
-    return matrix(rows, cols, 0);
-  }
-  
-  elem_t
-  rowLength(size_t row, matrix A)
-  {
-    elem_t sum = 0;
-    for (size_t j = 0; j < A.cols(); ++j)
-      sum += A(row, j);
-    return sqrt(sum);
-  }
-
-  matrix
-  cholesky(matrix A)
-  {
-    // Use row adds to get matrix to be upper triangular
-    // Divide each row by the diagonal entry in that row
-    for (size_t i = 0; i < A.cols(); ++i)
+      I.set(i, i, 1);
+    modular_matrix X;
+    if (!detail::modularSolve(A, I, X))
     {
-      for (size_t j = i + 1; j < A.rows(); ++j)
-        A.addRows(i, j, -A(j,i)/A(i,i));
-      A.multiplyRow(i, 1 / sqrt(A(i,i)));
+      std::cerr << "Inverse does not exist.\n";
+      return A;
     }
-
-    return A;
+    return X;
   }
 } // namespace mat